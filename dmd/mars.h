@@ -310,6 +310,7 @@ struct Param
     // Codegen cl options
     bool singleObj;
     bool disableRedZone;
+    bool useClassDisplay;   // ancestor display behind class vtbls (-class-display)
     bool noVerify;
 #endif
 };
@@ -374,6 +374,9 @@ Expression *BinExp::arrayOp(Scope *sc)
             fd->protection = PROTpublic;
             fd->linkage = LINKd;
             fd->isArrayOp = 1;
+#if IN_LLVM
+            fd->arrayOpExp = this;
+#endif
 
             sc->module->importedFrom->members->push(fd);
 
@@ -0,0 +1,985 @@
+
+// Compiler implementation of the D programming language
+// Copyright (c) 1999-2011 by Digital Mars
+// All Rights Reserved
+// http://www.digitalmars.com
+// License for redistribution is by either the Artistic License
+// in artistic.txt, or the GNU General Public License in gnu.txt.
+// See the included readme.txt for details.
+
+/* Bytecode interpreter for CTFE.
+ *
+ * Walking the AST allocates a new literal Expression for every
+ * intermediate value. Functions which only compute with integral values
+ * (parameters, locals and return value of integral, character or boolean
+ * type) are instead compiled to a register bytecode on their first CTFE
+ * call, and run by a simple loop on 64 bit registers. Values are only
+ * converted from and to IntegerExps for the outermost call.
+ *
+ * Anything else (arrays, structs, pointers, floating point, switch, goto,
+ * exceptions, calls of functions which cannot be compiled) makes the
+ * function unsuitable, and FuncDeclaration::interpret() walks the AST as
+ * before. Since compiled functions cannot have side effects, a run which
+ * hits an error (division by zero, recursion limit, ...) is simply
+ * abandoned and redone by the AST interpreter, which reports the error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rmem.h"
+
+#include "statement.h"
+#include "expression.h"
+#include "declaration.h"
+#include "init.h"
+#include "mtype.h"
+
+#define LOG     0
+
+// Maximum allowable recursive function calls in CTFE, as in interpret.c
+#define CTFE_RECURSION_LIMIT 1000
+
+enum BcOp
+{
+    BCconst,        // r[a] = imm
+    BCmov,          // r[a] = r[b]
+    BCadd,          // r[a] = r[b] + r[c], likewise up to BCule
+    BCsub,
+    BCmul,
+    BCdiv,          // signed
+    BCmod,
+    BCudiv,         // unsigned
+    BCumod,
+    BCand,
+    BCor,
+    BCxor,
+    BCshl,
+    BCshr,          // arithmetic shift
+    BCushr,         // logical shift of the lowest imm bytes of r[b]
+    BCeq,
+    BCne,
+    BClt,
+    BCle,
+    BCult,
+    BCule,
+    BCneg,          // r[a] = -r[b]
+    BCcom,          // r[a] = ~r[b]
+    BCnot,          // r[a] = !r[b]
+    BCsext,         // r[a] = lowest imm bytes of r[b], sign extended
+    BCzext,         // r[a] = lowest imm bytes of r[b], zero extended
+    BCjmp,          // continue at instruction a
+    BCjz,           // continue at instruction a if r[b] == 0
+    BCjnz,          // continue at instruction a if r[b] != 0
+    BCcall,         // r[a] = callees[imm](r[b] .. r[b + c - 1])
+    BCret,          // return r[a]
+    BCretvoid,      // return from void function
+};
+
+struct BcInstr
+{
+    unsigned op;
+    unsigned a, b, c;
+    dinteger_t imm;
+};
+
+struct CtfeCode
+{
+    BcInstr *code;
+    unsigned length;            // number of instructions
+    unsigned allocated;
+    unsigned numRegs;           // registers used, parameters come first
+    unsigned numParams;
+    int returnsVoid;
+    FuncDeclarations callees;
+
+    CtfeCode();
+
+    static unsigned numCompiled;        // statistics
+    static unsigned numRejected;
+    static unsigned numCalls;
+};
+
+CtfeCode::CtfeCode()
+{
+    code = NULL;
+    length = 0;
+    allocated = 0;
+    numRegs = 0;
+    numParams = 0;
+    returnsVoid = 0;
+}
+
+unsigned CtfeCode::numCompiled = 0;
+unsigned CtfeCode::numRejected = 0;
+unsigned CtfeCode::numCalls = 0;
+
+/* Set as FuncDeclaration::ctfeCode for functions which cannot be compiled,
+ * and while compiling a function (which may be called recursively).
+ */
+static CtfeCode ctfeCodeRejected;
+static CtfeCode ctfeCodeCompiling;
+
+CtfeCode *getCtfeCode(FuncDeclaration *fd);
+
+/****************************** Compiler ******************************/
+
+/* Whether values of type t are held in registers.
+ */
+static int isBcType(Type *t)
+{
+    switch (t->toBasetype()->ty)
+    {
+        case Tint8:  case Tuns8:
+        case Tint16: case Tuns16:
+        case Tint32: case Tuns32:
+        case Tint64: case Tuns64:
+        case Tbool:
+        case Tchar:  case Twchar: case Tdchar:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+struct BcLoop
+{
+    BcLoop *outer;
+    Array breaks;               // jumps to the end of the loop
+    Array continues;            // jumps to the continue target
+
+    BcLoop(BcLoop *outer) : outer(outer) { }
+};
+
+struct BcCompiler
+{
+    FuncDeclaration *fd;
+    CtfeCode *cc;
+    VarDeclarations vars;       // variables, held in register varRegs[i]
+    Array varRegs;
+    BcLoop *loop;
+
+    BcCompiler(FuncDeclaration *fd, CtfeCode *cc) : fd(fd), cc(cc), loop(NULL) { }
+
+    unsigned emit(unsigned op, unsigned a, unsigned b = 0, unsigned c = 0, dinteger_t imm = 0);
+    void patch(unsigned jump, unsigned target);
+    void patchAll(Array *jumps, unsigned target);
+    unsigned newReg() { return cc->numRegs++; }
+    unsigned constant(dinteger_t value);
+    int varReg(VarDeclaration *v);
+    unsigned addVar(VarDeclaration *v);
+    void normalize(unsigned r, Type *t);
+
+    int function();
+    int statement(Statement *s);
+    int loopBody(Statement *body, BcLoop *l);
+    int expression(Expression *e);
+    int declaration(Dsymbol *s);
+    int assign(BinExp *e);
+    int binAssign(BinExp *e, unsigned op, dinteger_t imm = 0);
+    int postIncDec(PostExp *e);
+    int binary(BinExp *e, unsigned op, dinteger_t imm = 0);
+    int compare(BinExp *e, unsigned op, int swap);
+    int logical(BinExp *e);
+    int cast(CastExp *e);
+    int condition(CondExp *e);
+    int call(CallExp *e);
+};
+
+unsigned BcCompiler::emit(unsigned op, unsigned a, unsigned b, unsigned c, dinteger_t imm)
+{
+    if (cc->length == cc->allocated)
+    {
+        cc->allocated = cc->allocated ? cc->allocated * 2 : 32;
+        cc->code = (BcInstr *)mem.realloc(cc->code, cc->allocated * sizeof(BcInstr));
+    }
+    BcInstr *i = &cc->code[cc->length];
+    i->op = op;
+    i->a = a;
+    i->b = b;
+    i->c = c;
+    i->imm = imm;
+    return cc->length++;
+}
+
+void BcCompiler::patch(unsigned jump, unsigned target)
+{
+    cc->code[jump].a = target;
+}
+
+void BcCompiler::patchAll(Array *jumps, unsigned target)
+{
+    for (size_t i = 0; i < jumps->dim; i++)
+        patch((unsigned)(size_t)jumps->data[i], target);
+}
+
+unsigned BcCompiler::constant(dinteger_t value)
+{
+    unsigned r = newReg();
+    emit(BCconst, r, 0, 0, value);
+    return r;
+}
+
+int BcCompiler::varReg(VarDeclaration *v)
+{
+    for (size_t i = 0; i < vars.dim; i++)
+    {
+        if (vars.tdata()[i] == v)
+            return (int)(size_t)varRegs.data[i];
+    }
+    return -1;
+}
+
+unsigned BcCompiler::addVar(VarDeclaration *v)
+{
+    unsigned r = newReg();
+    vars.push(v);
+    varRegs.push((void *)(size_t)r);
+    return r;
+}
+
+/* Truncates the value in register r to the size of type t, and sign or
+ * zero extends it again; this is how all values are kept in registers.
+ */
+void BcCompiler::normalize(unsigned r, Type *t)
+{
+    Type *tb = t->toBasetype();
+    d_uns64 sz = tb->size();
+    if (tb->ty == Tbool || sz >= 8)
+        return;
+    emit(tb->isunsigned() ? BCzext : BCsext, r, r, 0, sz);
+}
+
+int BcCompiler::function()
+{
+    if (fd->semanticRun < PASSsemantic3done || !fd->fbody || fd->needThis() ||
+        fd->isNested() || fd->vresult || fd->isBuiltin() != BUILTINnot)
+        return 0;
+
+    Type *tb = fd->type->toBasetype();
+    assert(tb->ty == Tfunction);
+    TypeFunction *tf = (TypeFunction *)tb;
+    if (tf->varargs || tf->isref)
+        return 0;
+    cc->returnsVoid = tf->next->toBasetype()->ty == Tvoid;
+    if (!cc->returnsVoid && !isBcType(tf->next))
+        return 0;
+
+    if (fd->parameters)
+    {
+        for (size_t i = 0; i < fd->parameters->dim; i++)
+        {
+            VarDeclaration *v = fd->parameters->tdata()[i];
+            if (v->storage_class & (STCref | STCout | STClazy) || !isBcType(v->type))
+                return 0;
+            addVar(v);
+        }
+        cc->numParams = fd->parameters->dim;
+    }
+    else if (Parameter::dim(tf->parameters))
+        return 0;
+
+    if (!statement(fd->fbody))
+        return 0;
+
+    // Falling off the end of a non-void function is an error, which the
+    // interpreter reports.
+    emit(BCretvoid, 0);
+    return 1;
+}
+
+int BcCompiler::statement(Statement *s)
+{
+    if (!s)
+        return 1;
+
+    if (ExpStatement *es = s->isExpStatement())
+    {
+        return !es->exp || expression(es->exp) >= 0;
+    }
+    if (CompoundStatement *cs = s->isCompoundStatement())
+    {
+        for (size_t i = 0; i < cs->statements->dim; i++)
+        {
+            if (!statement(cs->statements->tdata()[i]))
+                return 0;
+        }
+        return 1;
+    }
+    if (ScopeStatement *ss = s->isScopeStatement())
+    {
+        return statement(ss->statement);
+    }
+    if (IfStatement *is = s->isIfStatement())
+    {
+        if (is->match)
+            return 0;
+        int rc = expression(is->condition);
+        if (rc < 0)
+            return 0;
+        unsigned jelse = emit(BCjz, 0, rc);
+        if (!statement(is->ifbody))
+            return 0;
+        if (is->elsebody)
+        {
+            unsigned jend = emit(BCjmp, 0);
+            patch(jelse, cc->length);
+            if (!statement(is->elsebody))
+                return 0;
+            patch(jend, cc->length);
+        }
+        else
+            patch(jelse, cc->length);
+        return 1;
+    }
+    if (ForStatement *fs = s->isForStatement())
+    {
+        if (!statement(fs->init))
+            return 0;
+        unsigned top = cc->length;
+        int jexit = -1;
+        if (fs->condition)
+        {
+            int rc = expression(fs->condition);
+            if (rc < 0)
+                return 0;
+            jexit = emit(BCjz, 0, rc);
+        }
+        BcLoop l(loop);
+        if (!loopBody(fs->body, &l))
+            return 0;
+        patchAll(&l.continues, cc->length);
+        if (fs->increment && expression(fs->increment) < 0)
+            return 0;
+        emit(BCjmp, top);
+        if (jexit >= 0)
+            patch(jexit, cc->length);
+        patchAll(&l.breaks, cc->length);
+        return 1;
+    }
+    if (DoStatement *ds = s->isDoStatement())
+    {
+        unsigned top = cc->length;
+        BcLoop l(loop);
+        if (!loopBody(ds->body, &l))
+            return 0;
+        patchAll(&l.continues, cc->length);
+        int rc = expression(ds->condition);
+        if (rc < 0)
+            return 0;
+        emit(BCjnz, top, rc);
+        patchAll(&l.breaks, cc->length);
+        return 1;
+    }
+    if (BreakStatement *bs = s->isBreakStatement())
+    {
+        if (bs->ident || !loop)
+            return 0;
+        loop->breaks.push((void *)(size_t)emit(BCjmp, 0));
+        return 1;
+    }
+    if (ContinueStatement *cs = s->isContinueStatement())
+    {
+        if (cs->ident || !loop)
+            return 0;
+        loop->continues.push((void *)(size_t)emit(BCjmp, 0));
+        return 1;
+    }
+    if (ReturnStatement *rs = s->isReturnStatement())
+    {
+        if (cc->returnsVoid)
+        {
+            if (rs->exp && expression(rs->exp) < 0)
+                return 0;
+            emit(BCretvoid, 0);
+            return 1;
+        }
+        if (!rs->exp)
+            return 0;
+        int r = expression(rs->exp);
+        if (r < 0)
+            return 0;
+        emit(BCret, r);
+        return 1;
+    }
+    return 0;
+}
+
+int BcCompiler::loopBody(Statement *body, BcLoop *l)
+{
+    loop = l;
+    int ok = statement(body);
+    loop = l->outer;
+    return ok;
+}
+
+/* Compiles e, returns the register holding its value or -1 if e cannot be
+ * compiled. The register of a variable is returned for a VarExp, so the
+ * result is only valid until the next side effect.
+ */
+int BcCompiler::expression(Expression *e)
+{
+    if (e->op == TOKdeclaration)
+        return declaration(((DeclarationExp *)e)->declaration);
+
+    Type *tb = e->type->toBasetype();
+    if (tb->ty != Tvoid && !isBcType(tb))
+        return -1;
+
+    switch (e->op)
+    {
+        case TOKint64:
+            return constant(e->toInteger());
+
+        case TOKvar:
+        {   VarDeclaration *v = ((VarExp *)e)->var->isVarDeclaration();
+            return v ? varReg(v) : -1;
+        }
+
+        case TOKassign:
+        case TOKconstruct:
+        case TOKblit:
+            return assign((BinExp *)e);
+
+        case TOKaddass: return binAssign((BinExp *)e, BCadd);
+        case TOKminass: return binAssign((BinExp *)e, BCsub);
+        case TOKmulass: return binAssign((BinExp *)e, BCmul);
+        case TOKandass: return binAssign((BinExp *)e, BCand);
+        case TOKorass:  return binAssign((BinExp *)e, BCor);
+        case TOKxorass: return binAssign((BinExp *)e, BCxor);
+        case TOKshlass: return binAssign((BinExp *)e, BCshl);
+        /* The op-assign forms work like Div(), Mod(), Shr() and Ushr() in
+         * constfold.c do for the AST interpreter, on the unpromoted type of
+         * e1: division is unsigned if either operand is, and >>>= only
+         * shifts in zeros above the size of e1.
+         */
+        case TOKdivass:
+        case TOKmodass:
+        {   BinExp *be = (BinExp *)e;
+            int uns = be->e1->type->isunsigned() || be->e2->type->isunsigned();
+            if (e->op == TOKdivass)
+                return binAssign(be, uns ? BCudiv : BCdiv);
+            return binAssign(be, uns ? BCumod : BCmod);
+        }
+        case TOKshrass:
+        case TOKushrass:
+        {   BinExp *be = (BinExp *)e;
+            Type *t1 = be->e1->type->toBasetype();
+            if (e->op == TOKshrass && !t1->isunsigned())
+                return binAssign(be, BCshr);
+            return binAssign(be, BCushr, t1->size());
+        }
+
+        case TOKplusplus:
+        case TOKminusminus:
+            return postIncDec((PostExp *)e);
+
+        case TOKadd:    return binary((BinExp *)e, BCadd);
+        case TOKmin:    return binary((BinExp *)e, BCsub);
+        case TOKmul:    return binary((BinExp *)e, BCmul);
+        case TOKand:    return binary((BinExp *)e, BCand);
+        case TOKor:     return binary((BinExp *)e, BCor);
+        case TOKxor:    return binary((BinExp *)e, BCxor);
+        case TOKshl:    return binary((BinExp *)e, BCshl);
+        case TOKdiv:    return binary((BinExp *)e, tb->isunsigned() ? BCudiv : BCdiv);
+        case TOKmod:    return binary((BinExp *)e, tb->isunsigned() ? BCumod : BCmod);
+        case TOKshr:
+            if (tb->isunsigned())
+                return binary((BinExp *)e, BCushr, 8);
+            return binary((BinExp *)e, BCshr);
+        case TOKushr:
+            return binary((BinExp *)e, BCushr, ((BinExp *)e)->e1->type->toBasetype()->size());
+
+        case TOKequal:
+        case TOKidentity:
+            return compare((BinExp *)e, BCeq, 0);
+        case TOKnotequal:
+        case TOKnotidentity:
+            return compare((BinExp *)e, BCne, 0);
+        case TOKlt:
+        case TOKgt:
+        case TOKle:
+        case TOKge:
+        {   BinExp *be = (BinExp *)e;
+            int uns = be->e1->type->toBasetype()->isunsigned();
+            int lt = e->op == TOKlt || e->op == TOKgt;
+            unsigned op = lt ? (uns ? BCult : BClt) : (uns ? BCule : BCle);
+            return compare(be, op, e->op == TOKgt || e->op == TOKge);
+        }
+
+        case TOKandand:
+        case TOKoror:
+            return logical((BinExp *)e);
+
+        case TOKnot:
+        case TOKneg:
+        case TOKtilde:
+        {   int r1 = expression(((UnaExp *)e)->e1);
+            if (r1 < 0)
+                return -1;
+            unsigned r = newReg();
+            emit(e->op == TOKnot ? BCnot : e->op == TOKneg ? BCneg : BCcom, r, r1);
+            normalize(r, e->type);
+            return r;
+        }
+
+        case TOKcast:
+            return cast((CastExp *)e);
+
+        case TOKquestion:
+            return condition((CondExp *)e);
+
+        case TOKcomma:
+            if (expression(((CommaExp *)e)->e1) < 0)
+                return -1;
+            return expression(((CommaExp *)e)->e2);
+
+        case TOKcall:
+            return call((CallExp *)e);
+
+        default:
+            return -1;
+    }
+}
+
+int BcCompiler::declaration(Dsymbol *s)
+{
+    VarDeclaration *v = s->isVarDeclaration();
+    if (!v)
+        return -1;
+    if (v->storage_class & STCmanifest)
+        return newReg();        // uses have been constant folded
+    if (v->isDataseg() || v->storage_class & (STCref | STCout | STClazy) ||
+        !isBcType(v->type) || !v->init)
+        return -1;
+
+    unsigned r = addVar(v);
+    if (v->init->isVoidInitializer())
+    {
+        emit(BCconst, r, 0);
+        return r;
+    }
+    ExpInitializer *ie = v->init->isExpInitializer();
+    if (!ie)
+        return -1;
+    // usually a ConstructExp for v
+    int ri = expression(ie->exp);
+    if (ri < 0)
+        return -1;
+    if ((unsigned)ri != r)
+        emit(BCmov, r, ri);
+    return r;
+}
+
+int BcCompiler::assign(BinExp *e)
+{
+    if (e->e1->op != TOKvar)
+        return -1;
+    VarDeclaration *v = ((VarExp *)e->e1)->var->isVarDeclaration();
+    int rv = v ? varReg(v) : -1;
+    if (rv < 0)
+        return -1;
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    if (r2 != rv)
+        emit(BCmov, rv, r2);
+    return rv;
+}
+
+int BcCompiler::binAssign(BinExp *e, unsigned op, dinteger_t imm)
+{
+    if (e->e1->op != TOKvar)
+        return -1;
+    VarDeclaration *v = ((VarExp *)e->e1)->var->isVarDeclaration();
+    int rv = v ? varReg(v) : -1;
+    if (rv < 0)
+        return -1;
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    emit(op, rv, rv, r2, imm);
+    normalize(rv, e->e1->type);
+    return rv;
+}
+
+int BcCompiler::postIncDec(PostExp *e)
+{
+    if (e->e1->op != TOKvar)
+        return -1;
+    VarDeclaration *v = ((VarExp *)e->e1)->var->isVarDeclaration();
+    int rv = v ? varReg(v) : -1;
+    if (rv < 0)
+        return -1;
+    unsigned r = newReg();
+    emit(BCmov, r, rv);
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    emit(e->op == TOKplusplus ? BCadd : BCsub, rv, rv, r2);
+    normalize(rv, e->e1->type);
+    return r;
+}
+
+int BcCompiler::binary(BinExp *e, unsigned op, dinteger_t imm)
+{
+    int r1 = expression(e->e1);
+    if (r1 < 0)
+        return -1;
+    if (e->e2->hasSideEffect())
+    {   // e1 may be a variable modified by e2
+        unsigned t = newReg();
+        emit(BCmov, t, r1);
+        r1 = t;
+    }
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    unsigned r = newReg();
+    emit(op, r, r1, r2, imm);
+    normalize(r, e->type);
+    return r;
+}
+
+int BcCompiler::compare(BinExp *e, unsigned op, int swap)
+{
+    if (!isBcType(e->e1->type) || !isBcType(e->e2->type))
+        return -1;
+    int r1 = expression(e->e1);
+    if (r1 < 0)
+        return -1;
+    if (e->e2->hasSideEffect())
+    {
+        unsigned t = newReg();
+        emit(BCmov, t, r1);
+        r1 = t;
+    }
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    unsigned r = newReg();
+    if (swap)
+        emit(op, r, r2, r1);
+    else
+        emit(op, r, r1, r2);
+    return r;
+}
+
+int BcCompiler::logical(BinExp *e)
+{
+    if (e->type->toBasetype()->ty != Tbool)
+        return -1;
+    unsigned r = newReg();
+    int r1 = expression(e->e1);
+    if (r1 < 0)
+        return -1;
+    emit(BCne, r, r1, constant(0));
+    unsigned jend = emit(e->op == TOKandand ? BCjz : BCjnz, 0, r);
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    emit(BCne, r, r2, constant(0));
+    patch(jend, cc->length);
+    return r;
+}
+
+int BcCompiler::cast(CastExp *e)
+{
+    Type *tb = e->type->toBasetype();
+    if (tb->ty == Tvoid || !isBcType(e->e1->type))
+        return -1;
+    int r1 = expression(e->e1);
+    if (r1 < 0)
+        return -1;
+    unsigned r = newReg();
+    if (tb->ty == Tbool)
+        emit(BCne, r, r1, constant(0));
+    else
+    {
+        emit(BCmov, r, r1);
+        normalize(r, tb);
+    }
+    return r;
+}
+
+int BcCompiler::condition(CondExp *e)
+{
+    int rc = expression(e->econd);
+    if (rc < 0)
+        return -1;
+    unsigned r = newReg();
+    unsigned jelse = emit(BCjz, 0, rc);
+    int r1 = expression(e->e1);
+    if (r1 < 0)
+        return -1;
+    emit(BCmov, r, r1);
+    unsigned jend = emit(BCjmp, 0);
+    patch(jelse, cc->length);
+    int r2 = expression(e->e2);
+    if (r2 < 0)
+        return -1;
+    emit(BCmov, r, r2);
+    patch(jend, cc->length);
+    return r;
+}
+
+int BcCompiler::call(CallExp *e)
+{
+    if (e->e1->op != TOKvar)
+        return -1;
+    FuncDeclaration *f = ((VarExp *)e->e1)->var->isFuncDeclaration();
+    if (!f || getCtfeCode(f) == &ctfeCodeRejected)
+        return -1;
+
+    size_t nargs = e->arguments ? e->arguments->dim : 0;
+    size_t nparams = f->parameters ? f->parameters->dim : 0;
+    if (nargs != nparams)
+        return -1;
+
+    // the arguments are passed in consecutive registers
+    unsigned args = cc->numRegs;
+    cc->numRegs += nargs;
+    for (size_t i = 0; i < nargs; i++)
+    {
+        int r = expression(e->arguments->tdata()[i]);
+        if (r < 0)
+            return -1;
+        emit(BCmov, args + i, r);
+    }
+
+    cc->callees.push(f);
+    unsigned r = newReg();
+    emit(BCcall, r, args, nargs, cc->callees.dim - 1);
+    return r;
+}
+
+/* Returns the bytecode of fd, compiling it if necessary. Returns
+ * &ctfeCodeRejected if fd cannot be compiled, and &ctfeCodeCompiling
+ * if it is being compiled.
+ */
+CtfeCode *getCtfeCode(FuncDeclaration *fd)
+{
+    if (fd->ctfeCode)
+        return fd->ctfeCode;
+
+    // Don't give up on functions which are not ready yet.
+    if (fd->semanticRun < PASSsemantic3done)
+        return &ctfeCodeRejected;
+
+    fd->ctfeCode = &ctfeCodeCompiling;
+    CtfeCode *cc = new CtfeCode();
+    BcCompiler bc(fd, cc);
+    if (bc.function())
+    {
+#if LOG
+        printf("compiled %s to %u instructions\n", fd->toChars(), cc->length);
+#endif
+        CtfeCode::numCompiled++;
+        fd->ctfeCode = cc;
+    }
+    else
+    {
+        CtfeCode::numRejected++;
+        fd->ctfeCode = &ctfeCodeRejected;
+    }
+    return fd->ctfeCode;
+}
+
+/****************************** Interpreter ******************************/
+
+static dinteger_t *bcStack;     // registers of all active calls
+static size_t bcStackSize;
+static int bcCallDepth;
+
+static void reserveStack(size_t size)
+{
+    if (size <= bcStackSize)
+        return;
+    bcStackSize = size * 2;
+    bcStack = (dinteger_t *)mem.realloc(bcStack, bcStackSize * sizeof(dinteger_t));
+}
+
+/* Runs cc with its registers starting at bcStack[base].
+ * Returns 0 if the call has to be interpreted by walking the AST instead.
+ */
+static int run(CtfeCode *cc, size_t base, dinteger_t *result)
+{
+    if (bcCallDepth >= CTFE_RECURSION_LIMIT)
+        return 0;
+    ++bcCallDepth;
+
+    BcInstr *pc = cc->code;
+    while (1)
+    {
+        dinteger_t *r = bcStack + base;
+        switch (pc->op)
+        {
+            case BCconst:   r[pc->a] = pc->imm;                     break;
+            case BCmov:     r[pc->a] = r[pc->b];                    break;
+            case BCadd:     r[pc->a] = r[pc->b] + r[pc->c];         break;
+            case BCsub:     r[pc->a] = r[pc->b] - r[pc->c];         break;
+            case BCmul:     r[pc->a] = r[pc->b] * r[pc->c];         break;
+            case BCand:     r[pc->a] = r[pc->b] & r[pc->c];         break;
+            case BCor:      r[pc->a] = r[pc->b] | r[pc->c];         break;
+            case BCxor:     r[pc->a] = r[pc->b] ^ r[pc->c];         break;
+
+            case BCdiv:
+            case BCmod:
+            {   sinteger_t x = r[pc->b];
+                sinteger_t y = r[pc->c];
+                if (y == 0)
+                    goto Lfail;
+                /* Leave int.min % -1 and long.min % -1 (errors) and the
+                 * overflowing divisions to the AST interpreter. A long
+                 * operand equal to int.min only falls back needlessly.
+                 */
+                if (y == -1 && (x == (sinteger_t)(1ULL << 63) || x == (sinteger_t)0xFFFFFFFF80000000ULL))
+                    goto Lfail;
+                r[pc->a] = pc->op == BCdiv ? x / y : x % y;
+                break;
+            }
+            case BCudiv:
+            case BCumod:
+                if (r[pc->c] == 0)
+                    goto Lfail;
+                r[pc->a] = pc->op == BCudiv ? r[pc->b] / r[pc->c] : r[pc->b] % r[pc->c];
+                break;
+
+            case BCshl:
+            case BCshr:
+            case BCushr:
+            {   dinteger_t count = r[pc->c];
+                if (count >= 64)
+                    goto Lfail;
+                if (pc->op == BCshl)
+                    r[pc->a] = r[pc->b] << count;
+                else if (pc->op == BCshr)
+                    r[pc->a] = (sinteger_t)r[pc->b] >> count;
+                else
+                {   dinteger_t x = r[pc->b];
+                    if (pc->imm < 8)
+                        x &= (1ULL << (pc->imm * 8)) - 1;
+                    r[pc->a] = x >> count;
+                }
+                break;
+            }
+
+            case BCeq:      r[pc->a] = r[pc->b] == r[pc->c];                            break;
+            case BCne:      r[pc->a] = r[pc->b] != r[pc->c];                            break;
+            case BClt:      r[pc->a] = (sinteger_t)r[pc->b] < (sinteger_t)r[pc->c];     break;
+            case BCle:      r[pc->a] = (sinteger_t)r[pc->b] <= (sinteger_t)r[pc->c];    break;
+            case BCult:     r[pc->a] = r[pc->b] < r[pc->c];                             break;
+            case BCule:     r[pc->a] = r[pc->b] <= r[pc->c];                            break;
+
+            case BCneg:     r[pc->a] = -r[pc->b];                   break;
+            case BCcom:     r[pc->a] = ~r[pc->b];                   break;
+            case BCnot:     r[pc->a] = !r[pc->b];                   break;
+
+            case BCsext:
+            {   unsigned shift = 64 - pc->imm * 8;
+                r[pc->a] = (sinteger_t)(r[pc->b] << shift) >> shift;
+                break;
+            }
+            case BCzext:
+                r[pc->a] = r[pc->b] & ((1ULL << (pc->imm * 8)) - 1);
+                break;
+
+            case BCjmp:
+                pc = cc->code + pc->a;
+                continue;
+            case BCjz:
+                if (!r[pc->b])
+                {   pc = cc->code + pc->a;
+                    continue;
+                }
+                break;
+            case BCjnz:
+                if (r[pc->b])
+                {   pc = cc->code + pc->a;
+                    continue;
+                }
+                break;
+
+            case BCcall:
+            {   CtfeCode *callee = cc->callees.tdata()[pc->imm]->ctfeCode;
+                if (callee == &ctfeCodeRejected || callee == &ctfeCodeCompiling)
+                    goto Lfail;
+                size_t calleeBase = base + cc->numRegs;
+                reserveStack(calleeBase + callee->numRegs);
+                memcpy(bcStack + calleeBase, bcStack + base + pc->b, pc->c * sizeof(dinteger_t));
+                dinteger_t value;
+                if (!run(callee, calleeBase, &value))
+                    goto Lfail;
+                bcStack[base + pc->a] = value;
+                break;
+            }
+
+            case BCret:
+                *result = r[pc->a];
+                --bcCallDepth;
+                return 1;
+            case BCretvoid:
+                if (!cc->returnsVoid)
+                    goto Lfail;
+                *result = 0;
+                --bcCallDepth;
+                return 1;
+
+            default:
+                assert(0);
+        }
+        pc++;
+    }
+
+Lfail:
+    --bcCallDepth;
+    return 0;
+}
+
+/*************************************
+ * Attempt to interpret a call of fd with the bytecode interpreter. The
+ * values of the parameters have been set up on the CTFE stack already,
+ * callDepth is the number of active calls of the AST interpreter.
+ * Returns:
+ *      NULL                    fd has to be interpreted by walking the AST
+ *      EXP_VOID_INTERPRET      fd returned void
+ *      IntegerExp              the result of the call
+ */
+
+Expression *interpretBytecode(FuncDeclaration *fd, int callDepth)
+{
+    CtfeCode *cc = getCtfeCode(fd);
+    if (cc == &ctfeCodeRejected || cc == &ctfeCodeCompiling)
+        return NULL;
+
+    reserveStack(cc->numRegs);
+    for (size_t i = 0; i < cc->numParams; i++)
+    {
+        Expression *e = fd->parameters->tdata()[i]->getValue();
+        if (!e || e->op != TOKint64)
+            return NULL;
+        bcStack[i] = e->toInteger();
+    }
+
+    CtfeCode::numCalls++;
+    // the recursion limit counts the calls of the AST interpreter too
+    bcCallDepth = callDepth;
+    dinteger_t result;
+    int ok = run(cc, 0, &result);
+    bcCallDepth = 0;
+    if (!ok)
+        return NULL;
+
+    if (cc->returnsVoid)
+        return EXP_VOID_INTERPRET;
+    TypeFunction *tf = (TypeFunction *)fd->type->toBasetype();
+    return new IntegerExp(fd->loc, result, tf->next);
+}
+
+void printBytecodeStats()
+{
+    printf("bytecode: compiled = %u\trejected = %u\tcalls = %u\n",
+        CtfeCode::numCompiled, CtfeCode::numRejected, CtfeCode::numCalls);
+}
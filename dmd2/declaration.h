@@ -41,6 +41,7 @@ struct ExpInitializer;
 struct StructDeclaration;
 struct TupleType;
 struct InterState;
+struct CtfeCode;
 struct IRState;
 #if IN_LLVM
 struct AnonDeclaration;
@@ -783,6 +784,8 @@ struct FuncDeclaration : Declaration
     #define FUNCFLAGpurityInprocess 1   // working on determining purity
     #define FUNCFLAGsafetyInprocess 2   // working on determining safety
     #define FUNCFLAGnothrowInprocess 4  // working on determining nothrow
+
+    CtfeCode *ctfeCode;                 // bytecode for CTFE, see ctfebc.c
 #else
     int nestedFrameRef;                 // !=0 if nested variables referenced
 #endif
@@ -891,6 +894,16 @@ struct FuncDeclaration : Declaration
     
     // true if has inline assembler
     bool inlineAsm;
+
+    // for array operations generated by the frontend (isArrayOp == 1): the
+    // expression the function was created for, used to emit a vectorized body
+    Expression *arrayOpExp;
+
+    // Imported functions with a body that have not been analyzed yet, in the
+    // order calls to them were found. These are the candidates for inlining
+    // (see analyzeImportedFunctions()).
+    static FuncDeclarations importedCallees;
+    static void addImportedCallee(FuncDeclaration *f);
 #endif
 };
 
@@ -4432,6 +4432,9 @@ Lagain:
             checkDeprecated(sc, f);
             member = f->isCtorDeclaration();
             assert(member);
+#if IN_LLVM
+            FuncDeclaration::addImportedCallee(member);
+#endif
 
             cd->accessCheck(loc, sc, member);
 
@@ -4498,6 +4501,9 @@ Lagain:
             checkDeprecated(sc, f);
             member = f->isCtorDeclaration();
             assert(member);
+#if IN_LLVM
+            FuncDeclaration::addImportedCallee(member);
+#endif
 
             sd->accessCheck(loc, sc, member);
 
@@ -6272,6 +6278,9 @@ Expression *FileExp::semantic(Scope *sc)
         {
             f.ref = 1;
             se = new StringExp(loc, f.buffer, f.len);
+#if IN_LLVM
+            sc->module->stringImports.push(name);
+#endif
         }
     }
     return se->semantic(sc);
@@ -8012,6 +8021,10 @@ Lcheckargs:
         error("forward reference to inferred return type of function call %s", toChars());
         return new ErrorExp();
     }
+#if IN_LLVM
+    if (f)
+        FuncDeclaration::addImportedCallee(f);
+#endif
 
     if (f && f->tintro)
     {
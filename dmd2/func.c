@@ -93,12 +93,14 @@ FuncDeclaration::FuncDeclaration(Loc loc, Loc endloc, Identifier *id, StorageCla
     builtin = BUILTINunknown;
     tookAddressOf = 0;
     flags = 0;
+    ctfeCode = NULL;
 #endif
 #if IN_LLVM
     // LDC
     isArrayOp = false;
     allowInlining = false;
     availableExternally = true; // assume this unless proven otherwise
+    arrayOpExp = NULL;
 
     // function types in ldc don't merge if the context parameter differs
     // so we actually don't care about the function declaration, but only
@@ -3097,6 +3099,21 @@ FuncDeclaration *FuncDeclaration::genCfunc(Parameters *args, Type *treturn, Iden
     return fd;
 }
 
+#if IN_LLVM
+FuncDeclarations FuncDeclaration::importedCallees;
+
+/**********************************
+ * Record a call to f. If f is an imported function whose body has not
+ * been analyzed, it is a candidate for inlining.
+ */
+
+void FuncDeclaration::addImportedCallee(FuncDeclaration *f)
+{
+    if (f->availableExternally && f->fbody && f->semanticRun < PASSsemantic3)
+        importedCallees.push(f);
+}
+#endif
+
 const char *FuncDeclaration::kind()
 {
     return "function";
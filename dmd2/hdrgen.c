@@ -70,6 +70,9 @@ void Module::genhdrfile()
         FileName::ensurePathExists(pt);
     mem.free(pt);
     hdrfile->writev();
+#if IN_LLVM
+    fileWritten(hdrfile->toChars());
+#endif
 }
 
 
@@ -27,6 +27,8 @@
 #include "attrib.h" // for AttribDeclaration
 
 #include "template.h"
+#include "aav.h"
+#include "stringtable.h"
 TemplateInstance *isSpeculativeFunction(FuncDeclaration *fd);
 
 
@@ -183,6 +185,8 @@ struct CtfeStatus
     static int maxCallDepth; // highest number of recursive calls
     static int numArrayAllocs; // Number of allocated arrays
     static int numAssignments; // total number of assignments executed
+    static int numMemoCalls; // calls of functions whose results are memoized
+    static int numMemoHits; // calls answered from the memo table
 };
 
 int CtfeStatus::callDepth = 0;
@@ -190,6 +194,11 @@ int CtfeStatus::stackTraceCallsToSuppress = 0;
 int CtfeStatus::maxCallDepth = 0;
 int CtfeStatus::numArrayAllocs = 0;
 int CtfeStatus::numAssignments = 0;
+int CtfeStatus::numMemoCalls = 0;
+int CtfeStatus::numMemoHits = 0;
+
+Expression *interpretBytecode(FuncDeclaration *fd, int callDepth);
+void printBytecodeStats();
 
 // CTFE diagnostic information
 void printCtfePerformanceStats()
@@ -197,7 +206,11 @@ void printCtfePerformanceStats()
 #if SHOWPERFORMANCE
     printf("        ---- CTFE Performance ----\n");
     printf("max call depth = %d\tmax stack = %d\n", CtfeStatus::maxCallDepth, ctfeStack.maxStackUsage());
-    printf("array allocs = %d\tassignments = %d\n\n", CtfeStatus::numArrayAllocs, CtfeStatus::numAssignments);
+    printf("array allocs = %d\tassignments = %d\n", CtfeStatus::numArrayAllocs, CtfeStatus::numAssignments);
+    printf("memoized calls = %d\thits = %d (%d%%)\n", CtfeStatus::numMemoCalls, CtfeStatus::numMemoHits,
+        CtfeStatus::numMemoCalls ? CtfeStatus::numMemoHits * 100 / CtfeStatus::numMemoCalls : 0);
+    printBytecodeStats();
+    printf("\n");
 #endif
 }
 
@@ -207,6 +220,7 @@ Expression *getVarExp(Loc loc, InterState *istate, Declaration *d, CtfeGoal goal
 VarDeclaration *findParentVar(Expression *e, Expression *thisval);
 bool needToCopyLiteral(Expression *expr);
 Expression *copyLiteral(Expression *e);
+Expression *resolveSlice(Expression *e);
 Expression *paintTypeOntoLiteral(Type *type, Expression *lit);
 Expression *findKeyInAA(AssocArrayLiteralExp *ae, Expression *e2);
 Expression *evaluateIfBuiltin(InterState *istate, Loc loc,
@@ -449,6 +463,122 @@ void showCtfeExpr(Expression *e, int level = 0)
     }
 }
 
+/******************************* Memoization ***************************/
+
+/* The results of strongly pure functions only depend on their arguments,
+ * so they are remembered for each list of argument values. Only plain
+ * literal values (integers, floating point numbers, strings, and arrays
+ * and structs of those) are used, for both the arguments and the result.
+ */
+
+static StringTable ctfeMemoTable;   // function and arguments => result
+static bool ctfeMemoTableInit;
+
+/* Append a canonical encoding of the CTFE value e to buf.
+ * Returns false if e is not a plain literal value.
+ */
+static bool memoEncode(OutBuffer *buf, Expression *e)
+{
+    if (!e)
+    {   buf->writeByte('v');   // void initialized struct field
+        return true;
+    }
+    if (e->op == TOKslice)
+        e = resolveSlice(e);
+    switch (e->op)
+    {
+        case TOKint64:
+            buf->printf("i%llx,", (ulonglong)e->toInteger());
+            return true;
+
+        case TOKfloat64:
+            e->toMangleBuffer(buf);
+            buf->writeByte(',');
+            return true;
+
+        case TOKnull:
+            buf->writeByte('n');
+            return true;
+
+        case TOKstring:
+        {   StringExp *se = (StringExp *)e;
+            buf->printf("s%u:%u:", se->sz, (unsigned)se->len);
+            buf->write(se->string, se->len * se->sz);
+            return true;
+        }
+
+        case TOKarrayliteral:
+        case TOKstructliteral:
+        {   Expressions *elements = e->op == TOKarrayliteral
+                ? ((ArrayLiteralExp *)e)->elements
+                : ((StructLiteralExp *)e)->elements;
+            size_t dim = elements ? elements->dim : 0;
+            buf->printf("%c%u:", e->op == TOKarrayliteral ? 'a' : 'S', (unsigned)dim);
+            for (size_t i = 0; i < dim; i++)
+            {
+                if (!memoEncode(buf, elements->tdata()[i]))
+                    return false;
+            }
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+/* Make a copy of the plain literal value e which shares nothing with it,
+ * so that neither the memo table nor the caller see changes by the other.
+ */
+static Expression *memoCopy(Expression *e)
+{
+    if (!e)
+        return NULL;
+    if (e->op == TOKslice)
+        e = resolveSlice(e);
+    if (e->op == TOKarrayliteral || e->op == TOKstructliteral)
+    {
+        Expressions *elements = e->op == TOKarrayliteral
+            ? ((ArrayLiteralExp *)e)->elements
+            : ((StructLiteralExp *)e)->elements;
+        Expressions *newelems = NULL;
+        if (elements)
+        {   newelems = new Expressions();
+            newelems->setDim(elements->dim);
+            for (size_t i = 0; i < elements->dim; i++)
+                newelems->tdata()[i] = memoCopy(elements->tdata()[i]);
+        }
+        if (e->op == TOKarrayliteral)
+        {   ArrayLiteralExp *r = new ArrayLiteralExp(e->loc, newelems);
+            r->type = e->type;
+            r->ownedByCtfe = true;
+            return r;
+        }
+        StructLiteralExp *se = (StructLiteralExp *)e;
+#if DMDV2
+        StructLiteralExp *r = new StructLiteralExp(e->loc, se->sd, newelems, se->stype);
+#else
+        StructLiteralExp *r = new StructLiteralExp(e->loc, se->sd, newelems);
+#endif
+        r->type = e->type;
+        r->ownedByCtfe = true;
+        return r;
+    }
+    return copyLiteral(e);
+}
+
+/* Remember e as the result of the call described by key, if it is a plain
+ * literal value.
+ */
+static void memoStore(OutBuffer *key, Expression *e)
+{
+    OutBuffer check;
+    if (!e || e == EXP_VOID_INTERPRET || !memoEncode(&check, e))
+        return;
+    StringValue *sv = ctfeMemoTable.update((char *)key->data, key->offset);
+    sv->ptrvalue = memoCopy(e);
+}
+
 /*************************************
  * Attempt to interpret a function given the arguments.
  * Input:
@@ -530,6 +660,19 @@ Expression *FuncDeclaration::interpret(InterState *istate, Expressions *argument
             return EXP_CANT_INTERPRET;
     }
     static int evaluatingArgs = 0;
+
+    /* Calls of strongly pure functions are looked up in the memo table,
+     * keyed by the function and the values of the arguments.
+     */
+    OutBuffer memoBuf;
+    OutBuffer *memoKey = NULL;
+    if (!thisarg && !isNested() && !tf->isref && tret->ty != Tvoid &&
+        isPure() == PUREstrong)
+    {
+        memoKey = &memoBuf;
+        memoKey->printf("%p:", this);
+    }
+
     if (arguments)
     {
         dim = arguments->dim;
@@ -587,6 +730,8 @@ Expression *FuncDeclaration::interpret(InterState *istate, Expressions *argument
                 return EXP_CANT_INTERPRET;
             }
             eargs.tdata()[i] = earg;
+            if (memoKey && !memoEncode(memoKey, earg))
+                memoKey = NULL;
         }
 
         for (size_t i = 0; i < dim; i++)
@@ -627,6 +772,40 @@ Expression *FuncDeclaration::interpret(InterState *istate, Expressions *argument
         }
     }
 
+    if (memoKey)
+    {
+        if (!ctfeMemoTableInit)
+        {   ctfeMemoTable.init();
+            ctfeMemoTableInit = true;
+        }
+        CtfeStatus::numMemoCalls++;
+        StringValue *sv = ctfeMemoTable.lookup((char *)memoKey->data, memoKey->offset);
+        if (sv)
+        {
+            CtfeStatus::numMemoHits++;
+            ctfeStack.endFrame(istatex.framepointer);
+            Expression *e = memoCopy((Expression *)sv->ptrvalue);
+            if (!istate && !evaluatingArgs)
+                e = scrubReturnValue(loc, e);
+            return e;
+        }
+    }
+
+    /* Functions computing only with integral values are run by the
+     * bytecode interpreter, see ctfebc.c.
+     */
+    if (!thisarg)
+    {
+        Expression *eb = interpretBytecode(this, CtfeStatus::callDepth);
+        if (eb)
+        {
+            ctfeStack.endFrame(istatex.framepointer);
+            if (memoKey)
+                memoStore(memoKey, eb);
+            return eb;
+        }
+    }
+
     if (vresult)
         ctfeStack.push(vresult);
 
@@ -685,6 +864,8 @@ Expression *FuncDeclaration::interpret(InterState *istate, Expressions *argument
         ((ThrownExceptionExp *)e)->generateUncaughtError();
         return EXP_CANT_INTERPRET;
     }
+    if (memoKey)
+        memoStore(memoKey, e);
     if (!istate && !evaluatingArgs)
     {
         e = scrubReturnValue(loc, e);
@@ -907,6 +1088,261 @@ Expression *ctfeEqual(enum TOK op, Type *type, Expression *e1, Expression *e2)
     return Equal(op, type, e1, e2);
 }
 
+/******************************* AA index ***************************/
+
+/* CTFE associative arrays are AssocArrayLiteralExps, so that they can be
+ * handed to codegen as they are. To avoid searching their keys linearly,
+ * a hash index of the key positions is kept on the side for each keys
+ * array which is searched. During CTFE keys are only ever appended, so
+ * the index is extended lazily. RemoveExp takes keys out of the index
+ * in place, and the index is reset if the keys were changed otherwise.
+ */
+
+#define CTFE_AA_INDEX_MIN 8     // AAs smaller than this are searched linearly
+
+struct CtfeAAIndex
+{
+    size_t count;               // keys[0 .. count] have been indexed
+    Expression *lastKey;        // keys[count - 1], to detect reuse of the array
+    bool unhashable;            // some key cannot be hashed, search linearly
+    size_t numSlots;            // a power of 2
+    size_t *slots;              // position of a key + 1, or 0 if empty
+    hash_t *hashes;             // hash of the key in each slot
+};
+
+static AA *ctfeAAIndexes;       // Expressions *keys => CtfeAAIndex *
+
+static hash_t hashInteger(dinteger_t v)
+{
+    v ^= v >> 33;
+    v *= 0xFF51AFD7ED558CCDULL;
+    v ^= v >> 33;
+    return (hash_t)v;
+}
+
+#define HASH_ARRAY_SEED 0x9E3779B9
+#define HASH_COMBINE(h, x) ((h) * 31 + (x))
+
+/* Compute a hash of the CTFE value e, such that values which are equal
+ * according to ctfeEqual() have equal hashes.
+ * Returns false if e cannot be hashed.
+ */
+static bool ctfeHash(Expression *e, hash_t *phash)
+{
+    if (e->op == TOKslice)
+        e = resolveSlice(e);
+    switch (e->op)
+    {
+        case TOKint64:
+            *phash = hashInteger(e->toInteger());
+            return true;
+
+        case TOKnull:   // equal to empty arrays
+            *phash = HASH_ARRAY_SEED;
+            return true;
+
+        case TOKstring:
+        {   StringExp *se = (StringExp *)e;
+            hash_t h = HASH_ARRAY_SEED;
+            for (size_t i = 0; i < se->len; i++)
+                h = HASH_COMBINE(h, hashInteger(se->charAt(i)));
+            *phash = h;
+            return true;
+        }
+
+        case TOKarrayliteral:
+        case TOKstructliteral:
+        {   Expressions *elements = e->op == TOKarrayliteral
+                ? ((ArrayLiteralExp *)e)->elements
+                : ((StructLiteralExp *)e)->elements;
+            hash_t h = HASH_ARRAY_SEED;
+            for (size_t i = 0; elements && i < elements->dim; i++)
+            {   Expression *el = elements->tdata()[i];
+                hash_t hel;
+                if (!el || !ctfeHash(el, &hel))
+                    return false;
+                h = HASH_COMBINE(h, hel);
+            }
+            *phash = h;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+static void insertAAIndex(CtfeAAIndex *idx, hash_t h, size_t pos)
+{
+    if ((idx->count + 1) * 2 > idx->numSlots)
+    {   // Grow the table and reinsert the keys
+        size_t oldNumSlots = idx->numSlots;
+        size_t *oldSlots = idx->slots;
+        hash_t *oldHashes = idx->hashes;
+        idx->numSlots = oldNumSlots ? oldNumSlots * 2 : 2 * CTFE_AA_INDEX_MIN;
+        idx->slots = (size_t *)mem.calloc(idx->numSlots, sizeof(size_t));
+        idx->hashes = (hash_t *)mem.malloc(idx->numSlots * sizeof(hash_t));
+        for (size_t i = 0; i < oldNumSlots; i++)
+        {
+            if (oldSlots[i])
+                insertAAIndex(idx, oldHashes[i], oldSlots[i] - 1);
+        }
+        mem.free(oldSlots);
+        mem.free(oldHashes);
+    }
+    size_t mask = idx->numSlots - 1;
+    size_t i = h & mask;
+    while (idx->slots[i])
+        i = (i + 1) & mask;
+    idx->slots[i] = pos + 1;
+    idx->hashes[i] = h;
+}
+
+/* Get the index of the keys of ae, bringing it up to date.
+ * Returns NULL if the keys have to be searched linearly.
+ */
+static CtfeAAIndex *getAAIndex(AssocArrayLiteralExp *ae)
+{
+    Expressions *keys = ae->keys;
+    if (keys->dim < CTFE_AA_INDEX_MIN)
+        return NULL;
+
+    CtfeAAIndex **pidx = (CtfeAAIndex **)_aaGet(&ctfeAAIndexes, keys);
+    CtfeAAIndex *idx = *pidx;
+    if (!idx)
+    {
+        idx = new CtfeAAIndex();
+        memset(idx, 0, sizeof(CtfeAAIndex));
+        *pidx = idx;
+    }
+    else if (idx->count > keys->dim ||
+             (idx->count && keys->tdata()[idx->count - 1] != idx->lastKey))
+    {   // The keys have been changed other than by appending, start over
+        mem.free(idx->slots);
+        mem.free(idx->hashes);
+        memset(idx, 0, sizeof(CtfeAAIndex));
+    }
+    for (; idx->count < keys->dim; idx->count++)
+    {
+        hash_t h;
+        if (!idx->unhashable && ctfeHash(keys->tdata()[idx->count], &h))
+            insertAAIndex(idx, h, idx->count);
+        else
+            idx->unhashable = true;
+        idx->lastKey = keys->tdata()[idx->count];
+    }
+    return idx->unhashable ? NULL : idx;
+}
+
+/* Free the index of keys after keys have been removed from it.
+ */
+static void dropAAIndex(Expressions *keys)
+{
+    CtfeAAIndex *idx = (CtfeAAIndex *)_aaGetRvalue(ctfeAAIndexes, keys);
+    if (idx)
+    {
+        mem.free(idx->slots);
+        mem.free(idx->hashes);
+        delete idx;
+        *(CtfeAAIndex **)_aaGet(&ctfeAAIndexes, keys) = NULL;
+    }
+}
+
+/* Find the slot holding position pos, whose key has hash h.
+ */
+static size_t findAAIndexSlot(CtfeAAIndex *idx, hash_t h, size_t pos)
+{
+    size_t mask = idx->numSlots - 1;
+    size_t i = h & mask;
+    while (idx->slots[i] != pos + 1)
+    {   assert(idx->slots[i]);
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Remove the key at pos from ae and from the index idx of its keys.
+ * The last key is moved into its place, so this does not depend on the
+ * number of keys.
+ */
+static void removeAAKey(AssocArrayLiteralExp *ae, CtfeAAIndex *idx, size_t pos)
+{
+    Expressions *keys = ae->keys;
+    Expressions *values = ae->values;
+    size_t last = keys->dim - 1;
+    assert(idx->count == keys->dim);
+
+    // Empty the slot, and shift the following entries of its cluster back
+    // over it if that brings them closer to their home slot
+    hash_t h;
+    if (!ctfeHash(keys->tdata()[pos], &h))
+        assert(0);
+    size_t mask = idx->numSlots - 1;
+    size_t i = findAAIndexSlot(idx, h, pos);
+    for (size_t j = (i + 1) & mask; idx->slots[j]; j = (j + 1) & mask)
+    {
+        size_t home = idx->hashes[j] & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {   idx->slots[i] = idx->slots[j];
+            idx->hashes[i] = idx->hashes[j];
+            i = j;
+        }
+    }
+    idx->slots[i] = 0;
+
+    if (pos != last)
+    {   hash_t hlast;
+        if (!ctfeHash(keys->tdata()[last], &hlast))
+            assert(0);
+        idx->slots[findAAIndexSlot(idx, hlast, last)] = pos + 1;
+        keys->tdata()[pos] = keys->tdata()[last];
+        values->tdata()[pos] = values->tdata()[last];
+    }
+    keys->dim = last;
+    values->dim = last;
+    idx->count = last;
+    idx->lastKey = last ? keys->tdata()[last - 1] : NULL;
+}
+
+/* Find the last key in ae equal to e2 using the index of ae.
+ * Returns:
+ *      1       if found, *ppos is set to its position
+ *      0       if not found
+ *      -1      if the index cannot be used
+ *      If the keys cannot be compared, the result of the comparison is
+ *      returned in *pex and the position of the key in *ppos.
+ */
+static int findKeyInAAIndex(AssocArrayLiteralExp *ae, Expression *e2, size_t *ppos, Expression **pex)
+{
+    *pex = NULL;
+    CtfeAAIndex *idx = getAAIndex(ae);
+    hash_t h;
+    if (!idx || !ctfeHash(e2, &h))
+        return -1;
+
+    size_t found = 0;
+    size_t mask = idx->numSlots - 1;
+    for (size_t i = h & mask; idx->slots[i]; i = (i + 1) & mask)
+    {
+        size_t pos = idx->slots[i] - 1;
+        if (idx->hashes[i] != h || pos + 1 <= found)
+            continue;
+        Expression *ekey = ae->keys->tdata()[pos];
+        Expression *ex = ctfeEqual(TOKequal, Type::tbool, ekey, e2);
+        if (exceptionOrCantInterpret(ex))
+        {   *ppos = pos;
+            *pex = ex;
+            return 0;
+        }
+        if (ex->isBool(TRUE))
+            found = pos + 1;
+    }
+    if (!found)
+        return 0;
+    *ppos = found - 1;
+    return 1;
+}
+
 Expression *ctfeCat(Type *type, Expression *e1, Expression *e2)
 {
     Loc loc = e1->loc;
@@ -3033,6 +3469,21 @@ Expression *assignAssocArrayElement(Loc loc, AssocArrayLiteralExp *aae, Expressi
      */
     Expressions *keysx = aae->keys;
     Expressions *valuesx = aae->values;
+    size_t pos;
+    Expression *ex;
+    int found = findKeyInAAIndex(aae, index, &pos, &ex);
+    if (ex)
+        return ex;
+    if (found >= 0)
+    {   // CTFE owned AAs have no duplicate keys
+        if (found)
+            valuesx->tdata()[pos] = newval;
+        else
+        {   valuesx->push(newval);
+            keysx->push(index);
+        }
+        return newval;
+    }
     int updated = 0;
     for (size_t j = valuesx->dim; j; )
     {   j--;
@@ -5017,6 +5468,18 @@ Expression *ArrayLengthExp::interpret(InterState *istate, CtfeGoal goal)
  */
 Expression *findKeyInAA(AssocArrayLiteralExp *ae, Expression *e2)
 {
+    size_t pos;
+    Expression *ex;
+    int found = findKeyInAAIndex(ae, e2, &pos, &ex);
+    if (ex)
+    {
+        error("cannot evaluate %s==%s at compile time",
+            ae->keys->tdata()[pos]->toChars(), e2->toChars());
+        return EXP_CANT_INTERPRET;
+    }
+    if (found >= 0)
+        return found ? ae->values->tdata()[pos] : NULL;
+
     /* Search the keys backwards, in case there are duplicate keys
      */
     for (size_t i = ae->keys->dim; i;)
@@ -5906,21 +6369,43 @@ Expression *RemoveExp::interpret(InterState *istate, CtfeGoal goal)
     AssocArrayLiteralExp *aae = (AssocArrayLiteralExp *)agg;
     Expressions *keysx = aae->keys;
     Expressions *valuesx = aae->values;
+    size_t pos;
+    Expression *ex;
+    int found = findKeyInAAIndex(aae, index, &pos, &ex);
+    if (ex)
+        return ex;
+    if (found == 0)
+        return new IntegerExp(loc, 0, Type::tbool);
     size_t removed = 0;
+    while (found == 1)
+    {   // Remove every key equal to index, using the index
+        removeAAKey(aae, getAAIndex(aae), pos);
+        ++removed;
+        found = findKeyInAAIndex(aae, index, &pos, &ex);
+        if (ex)
+            return ex;
+    }
+    if (found == 0)
+        return new IntegerExp(loc, removed?1:0, Type::tbool);
+    // Search the rest linearly, e.g. if there are too few keys for an index
+    size_t removedLinear = 0;
     for (size_t j = 0; j < valuesx->dim; ++j)
     {   Expression *ekey = keysx->tdata()[j];
         Expression *ex = ctfeEqual(TOKequal, Type::tbool, ekey, index);
         if (exceptionOrCantInterpret(ex))
             return ex;
         if (ex->isBool(TRUE))
-            ++removed;
-        else if (removed != 0)
-        {   keysx->tdata()[j - removed] = ekey;
-            valuesx->tdata()[j - removed] = valuesx->tdata()[j];
+            ++removedLinear;
+        else if (removedLinear != 0)
+        {   keysx->tdata()[j - removedLinear] = ekey;
+            valuesx->tdata()[j - removedLinear] = valuesx->tdata()[j];
         }
     }
-    valuesx->dim = valuesx->dim - removed;
-    keysx->dim = keysx->dim - removed;
+    valuesx->dim = valuesx->dim - removedLinear;
+    keysx->dim = keysx->dim - removedLinear;
+    if (removedLinear)
+        dropAAIndex(keysx);
+    removed += removedLinear;
     return new IntegerExp(loc, removed?1:0, Type::tbool);
 }
 
@@ -276,7 +276,11 @@ struct Param
     // Codegen cl options
     bool singleObj;
     bool disableRedZone;
+    bool useClassDisplay;   // ancestor display behind class vtbls (-class-display)
     bool noVerify;
+
+    char *cacheDir;     // object file cache directory (-cache)
+    char *moduleMapFile; // where imports were found last time (-module-map)
 #endif
 };
 
@@ -36,6 +36,9 @@
 #include "dsymbol.h"
 #include "hdrgen.h"
 #include "lexer.h"
+#include "attrib.h"
+#include "async.h"
+#include "stringtable.h"
 
 #define MARS 1
 #include "html.h"
@@ -49,7 +52,12 @@
 #include "llvm/LLVMContext.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/Support/CommandLine.h"
+#include "gen/hash.h"
 #include <map>
+#if !_WIN32
+#include <ctype.h>
+#include <dirent.h>
+#endif
 
 static llvm::cl::opt<bool> preservePaths("op",
     llvm::cl::desc("Do not strip paths from source file"),
@@ -218,6 +226,7 @@ Module::Module(char *filename, Identifier *ident, int doDocComment, int doHdrGen
     this->doHdrGen = doHdrGen;
     this->isRoot = false;
     this->arrayfuncs = 0;
+    this->srcDigest = NULL;
 #endif
 }
 #if IN_LLVM
@@ -423,17 +432,16 @@ const char *Module::kind()
     return "module";
 }
 
-Module *Module::load(Loc loc, Identifiers *packages, Identifier *ident)
-{   Module *m;
-    char *filename;
-
-    //printf("Module::load(ident = '%s')\n", ident->toChars());
+/********************************************
+ * Build module filename by turning:
+ *  foo.bar.baz
+ * into:
+ *  foo\bar\baz
+ */
 
-    // Build module filename by turning:
-    //  foo.bar.baz
-    // into:
-    //  foo\bar\baz
-    filename = ident->toChars();
+static char *moduleFileName(Identifiers *packages, Identifier *ident)
+{
+    char *filename = ident->toChars();
     if (packages && packages->dim)
     {
         OutBuffer buf;
@@ -452,21 +460,137 @@ Module *Module::load(Loc loc, Identifiers *packages, Identifier *ident)
         buf.writeByte(0);
         filename = (char *)buf.extractData();
     }
+    return filename;
+}
 
-    m = new Module(filename, ident, 0, 0);
-    m->loc = loc;
+#if IN_LLVM
+/********************************************
+ * Searching the import path takes two stat() calls per import path
+ * entry for every import. Instead, list each directory once and
+ * remember the names of its entries, so that a file that exists is
+ * found without a stat() call.
+ *
+ * A name that is not listed may still exist: on a case-insensitive file
+ * system under a different case, or created after the directory was
+ * listed (e.g. a .di file written with -Hd). Such names are stat()ed.
+ * A file found that way which does not differ from a listed one only by
+ * case makes the directory be listed again on the next lookup.
+ */
 
-    /* Search along global.path for .di file, then .d file.
-     */
+struct DirContents
+{
+    StringTable names;          // entries of the directory
+    StringTable folded;         // the same in lower case
+};
+
+static StringTable dirContents;         // directory => DirContents
+static bool dirContentsInit;
+
+static StringValue *dirContentsEntry(char *name, size_t dirlen)
+{
+    if (!dirContentsInit)
+    {   dirContents.init();
+        dirContentsInit = true;
+    }
+    return dirContents.update(name, dirlen);
+}
+
+static char *foldCase(const char *s, size_t len)
+{
+    char *p = (char *)mem.malloc(len + 1);
+    for (size_t i = 0; i < len; i++)
+        p[i] = tolower((unsigned char)s[i]);
+    p[len] = 0;
+    return p;
+}
+
+static int sourceFileExists(char *name)
+{
+#if _WIN32
+    return FileName::exists(name);
+#else
+    char *base = FileName::name(name);
+    size_t dirlen = base - name;
+    size_t baselen = strlen(base);
+    StringValue *sv = dirContentsEntry(name, dirlen);
+    DirContents *dc = (DirContents *)sv->ptrvalue;
+    if (!dc)
+    {
+        dc = new DirContents();
+        dc->names.init();
+        dc->folded.init();
+        char *dir = dirlen ? (char *)mem.malloc(dirlen + 1) : (char *)".";
+        if (dirlen)
+        {   memcpy(dir, name, dirlen);
+            dir[dirlen] = 0;
+        }
+        DIR *d = opendir(dir);
+        if (d)
+        {
+            struct dirent *e;
+            while ((e = readdir(d)) != NULL)
+            {   size_t len = strlen(e->d_name);
+                dc->names.insert(e->d_name, len);
+                char *f = foldCase(e->d_name, len);
+                dc->folded.update(f, len);
+                mem.free(f);
+            }
+            closedir(d);
+        }
+        if (dirlen)
+            mem.free(dir);
+        sv->ptrvalue = dc;
+    }
+    if (dc->names.lookup(base, baselen))
+        return 1;
+
+    if (FileName::exists(name) != 1)
+        return 0;
+    char *f = foldCase(base, baselen);
+    if (!dc->folded.lookup(f, baselen))
+    {   // created since the directory was listed
+        delete dc;
+        sv->ptrvalue = NULL;
+    }
+    mem.free(f);
+    return 1;
+#endif
+}
+
+/********************************************
+ * Forget the cached listing of the directory of file name, after
+ * the compiler has written name.
+ */
+
+void Module::fileWritten(char *name)
+{
+#if !_WIN32
+    char *base = FileName::name(name);
+    StringValue *sv = dirContentsEntry(name, base - name);
+    delete (DirContents *)sv->ptrvalue;
+    sv->ptrvalue = NULL;
+#endif
+}
+#else
+#define sourceFileExists FileName::exists
+#endif
+
+/********************************************
+ * Search along global.path for .di file, then .d file.
+ * Returns NULL if neither exists.
+ */
+
+static char *lookForSourceFile(char *filename)
+{
     char *result = NULL;
     FileName *fdi = FileName::forceExt(filename, global.hdr_ext);
     FileName *fd  = FileName::forceExt(filename, global.mars_ext);
     char *sdi = fdi->toChars();
     char *sd  = fd->toChars();
 
-    if (FileName::exists(sdi))
+    if (sourceFileExists(sdi))
         result = sdi;
-    else if (FileName::exists(sd))
+    else if (sourceFileExists(sd))
         result = sd;
     else if (FileName::absolute(filename))
         ;
@@ -478,21 +602,312 @@ Module *Module::load(Loc loc, Identifiers *packages, Identifier *ident)
         {
             char *p = (*global.path)[i];
             char *n = FileName::combine(p, sdi);
-            if (FileName::exists(n))
+            if (sourceFileExists(n))
             {   result = n;
                 break;
             }
             mem.free(n);
             n = FileName::combine(p, sd);
-            if (FileName::exists(n))
+            if (sourceFileExists(n))
             {   result = n;
                 break;
             }
             mem.free(n);
         }
     }
+    return result;
+}
+
+#if IN_LLVM
+/********************************************
+ * The module map (-module-map) remembers the file each imported module
+ * was found in, so that the next build does not have to search the
+ * import path again. Its first line is the import path it was made with;
+ * if that changed, the map is rebuilt from scratch. After that, each line
+ * is "package.module<tab>file".
+ */
+
+static StringTable moduleMap;           // package.module => file name
+static Array moduleMapEntries;          // StringValue's of moduleMap, in order
+static bool moduleMapDirty;
+
+static void importPathLine(OutBuffer *buf)
+{
+    buf->writestring("path");
+    for (size_t i = 0; global.path && i < global.path->dim; i++)
+    {   buf->writeByte('\t');
+        buf->writestring((*global.path)[i]);
+    }
+    buf->writeByte('\n');
+}
+
+void Module::readModuleMap()
+{
+    moduleMap.init();
+    moduleMapDirty = true;
+
+    File f(global.params.moduleMapFile);
+    if (f.read())
+        return;         // first build
+
+    OutBuffer path;
+    importPathLine(&path);
+    char *p = (char *)f.buffer;
+    if (f.len < path.offset || memcmp(p, path.data, path.offset))
+        return;         // import path changed
+    p += path.offset;
+
+    while (*p)
+    {
+        char *tab = strchr(p, '\t');
+        char *end = strchr(p, '\n');
+        if (!end)
+            end = p + strlen(p);
+        if (tab && tab < end)
+        {
+            StringValue *sv = moduleMap.update(p, tab - p);
+            if (!sv->ptrvalue)
+                moduleMapEntries.push(sv);
+            size_t len = end - tab - 1;
+            char *file = (char *)mem.malloc(len + 1);
+            memcpy(file, tab + 1, len);
+            file[len] = 0;
+            sv->ptrvalue = file;
+        }
+        p = *end ? end + 1 : end;
+    }
+    moduleMapDirty = false;
+}
+
+void Module::writeModuleMap()
+{
+    if (!moduleMapDirty)
+        return;
+
+    OutBuffer buf;
+    importPathLine(&buf);
+    for (size_t i = 0; i < moduleMapEntries.dim; i++)
+    {   StringValue *sv = (StringValue *)moduleMapEntries.data[i];
+        buf.writestring(sv->lstring.toDchars());
+        buf.writeByte('\t');
+        buf.writestring((char *)sv->ptrvalue);
+        buf.writeByte('\n');
+    }
+
+    File f(global.params.moduleMapFile);
+    f.setbuffer(buf.data, buf.offset);
+    f.ref = 1;
+    f.writev();
+}
+#endif
+
+/********************************************
+ * Find the source file of module packages.ident, filename being
+ * the relative file name without extension.
+ * Returns NULL if there is none.
+ */
+
+static char *findModuleFile(Identifiers *packages, Identifier *ident, char *filename)
+{
+#if IN_LLVM
+    StringValue *sv = NULL;
+    if (global.params.moduleMapFile)
+    {
+        OutBuffer buf;
+        for (size_t i = 0; packages && i < packages->dim; i++)
+        {   buf.writestring(packages->tdata()[i]->toChars());
+            buf.writeByte('.');
+        }
+        buf.writestring(ident->toChars());
+
+        sv = moduleMap.update((char *)buf.data, buf.offset);
+        char *mapped = (char *)sv->ptrvalue;
+        if (mapped && FileName::exists(mapped))
+            return mapped;
+    }
+#endif
+
+    char *result = lookForSourceFile(filename);
+
+#if IN_LLVM
+    if (sv && result)
+    {
+        if (!sv->ptrvalue)
+            moduleMapEntries.push(sv);
+        sv->ptrvalue = result;
+        moduleMapDirty = true;
+    }
+#endif
+    return result;
+}
+
+#if IN_LLVM
+/********************************************
+ * The imports of a module are handed to the AsyncRead reader pool as
+ * soon as the module has been parsed, so they are usually in memory by
+ * the time importAll() gets to them. Parsing itself stays on the main
+ * thread, the lexer and the error reporting share too much global state.
+ *
+ * readAheadTable maps the file names of all imports seen so far to their
+ * ReadAhead, whose file is reset to NULL once it has been taken. The
+ * AsyncRead of a module's imports is disposed of once all of them have
+ * been taken.
+ */
+
+struct ReadAheadBatch
+{
+    AsyncRead *aw;
+    size_t untaken;     // number of files not taken yet
+};
+
+struct ReadAhead
+{
+    File *file;
+    ReadAheadBatch *batch;
+    size_t index;
+};
+
+static StringTable readAheadTable;
+static bool readAheadTableInit;
+
+static StringValue *readAheadEntry(char *name, bool create)
+{
+    if (!readAheadTableInit)
+    {   readAheadTable.init();
+        readAheadTableInit = true;
+    }
+    size_t len = strlen(name);
+    return create ? readAheadTable.update(name, len) : readAheadTable.lookup(name, len);
+}
+
+/********************************************
+ * Return the File for name with its contents already read if it
+ * has been read ahead, NULL otherwise.
+ */
+
+static File *takeReadAhead(char *name)
+{
+    StringValue *sv = readAheadEntry(name, true);
+    ReadAhead *ra = (ReadAhead *)sv->ptrvalue;
+    if (!ra)
+    {   // Don't read it ahead anymore either
+        ra = new ReadAhead();
+        ra->file = NULL;
+        sv->ptrvalue = ra;
+        return NULL;
+    }
+    File *f = ra->file;
+    if (!f)
+        return NULL;
+    ra->file = NULL;
+
+    ReadAheadBatch *batch = ra->batch;
+    int failed = batch->aw->read(ra->index);
+    if (--batch->untaken == 0)
+    {   AsyncRead::dispose(batch->aw);
+        delete batch;
+    }
+    ra->batch = NULL;
+    if (failed)
+        return NULL;    // let Module::read() report the error
+    return f;
+}
+
+/********************************************
+ * Is module packages.ident already loaded?
+ * Unlike Package::resolve(), this does not create any packages.
+ */
+
+static bool isLoaded(Identifiers *packages, Identifier *ident)
+{
+    DsymbolTable *dst = Module::modules;
+    for (size_t i = 0; packages && i < packages->dim; i++)
+    {
+        Dsymbol *s = dst->lookup(packages->tdata()[i]);
+        Package *pkg = s ? s->isPackage() : NULL;
+        if (!pkg || !pkg->symtab)
+            return false;
+        dst = pkg->symtab;
+    }
+    return dst->lookup(ident) != NULL;
+}
+
+/********************************************
+ * Collect the files of all imports in members which have not been
+ * loaded or read ahead yet. Conditional declarations are not
+ * evaluated, both branches are just looked at; reading a file that
+ * turns out not to be needed is harmless.
+ */
+
+static void collectImports(Dsymbols *members, Array *files)
+{
+    for (size_t i = 0; i < members->dim; i++)
+    {   Dsymbol *s = members->tdata()[i];
+
+        AttribDeclaration *ad = s->isAttribDeclaration();
+        if (ad)
+        {
+            if (ad->decl)
+                collectImports(ad->decl, files);
+            continue;
+        }
+
+        Import *imp = s->isImport();
+        if (!imp || isLoaded(imp->packages, imp->id))
+            continue;
+        char *name = findModuleFile(imp->packages, imp->id,
+                moduleFileName(imp->packages, imp->id));
+        if (!name || readAheadEntry(name, false))
+            continue;
+
+        ReadAhead *ra = new ReadAhead();
+        ra->file = new File(name);
+        readAheadEntry(name, true)->ptrvalue = ra;
+        files->push(ra);
+    }
+}
+
+void Module::readAheadImports()
+{
+    if (!members)
+        return;
+
+    Array files;
+    collectImports(members, &files);
+    if (!files.dim)
+        return;
+
+    ReadAheadBatch *batch = new ReadAheadBatch();
+    batch->aw = AsyncRead::create(files.dim);
+    batch->untaken = files.dim;
+    for (size_t i = 0; i < files.dim; i++)
+    {   ReadAhead *ra = (ReadAhead *)files.data[i];
+        ra->batch = batch;
+        ra->index = i;
+        batch->aw->addFile(ra->file);
+    }
+    batch->aw->start();
+}
+#endif
+
+Module *Module::load(Loc loc, Identifiers *packages, Identifier *ident)
+{   Module *m;
+
+    //printf("Module::load(ident = '%s')\n", ident->toChars());
+
+    char *filename = moduleFileName(packages, ident);
+    m = new Module(filename, ident, 0, 0);
+    m->loc = loc;
+
+    char *result = findModuleFile(packages, ident, filename);
     if (result)
+    {
+#if IN_LLVM
+        m->srcfile = takeReadAhead(result);
+        if (!m->srcfile)
+#endif
         m->srcfile = new File(result);
+    }
 
     if (global.params.verbose)
     {
@@ -507,8 +922,14 @@ Module *Module::load(Loc loc, Identifiers *packages, Identifier *ident)
         printf("%s\t(%s)\n", ident->toChars(), m->srcfile->toChars());
     }
 
+#if IN_LLVM
+    if (!m->srcfile->buffer)
+#endif
     m->read(loc);
     m->parse();
+#if IN_LLVM
+    m->readAheadImports();
+#endif
 
 #ifdef IN_GCC
     d_gcc_magic_module(m);
@@ -797,6 +1218,16 @@ void Module::parse()
     p.nextToken();
     members = p.parseModule();
 
+#if IN_LLVM
+    // the source is gone after this, remember its hash for the cache
+    if (global.params.cacheDir)
+    {
+        ContentHash hash;
+        hash.update(srcfile->buffer, srcfile->len);
+        srcDigest = mem.strdup(hash.hexDigest().c_str());
+    }
+#endif
+
     ::free(srcfile->buffer);
     srcfile->buffer = NULL;
     srcfile->len = 0;
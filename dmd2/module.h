@@ -139,6 +139,11 @@ struct Module : Package
     void setDocfile();  // set docfile member
 #endif
     void read(Loc loc); // read file
+#if IN_LLVM
+    void readAheadImports();    // start reading imported files in the background
+    static void readModuleMap();
+    static void writeModuleMap();
+#endif
 #if IN_LLVM
     void parse(bool gen_docs = false);       // syntactic parse
 #elif IN_GCC
@@ -155,6 +160,9 @@ struct Module : Package
     void setHdrfile();  // set hdrfile member
 #endif
     void genhdrfile();  // generate D import file
+#if IN_LLVM
+    static void fileWritten(char *name);   // name was written by the compiler
+#endif
 //    void gensymfile();
     void gendocfile();
     int needModuleInfo();
@@ -214,6 +222,10 @@ struct Module : Package
     AA *arrayfuncs;
 
     bool isRoot;
+
+    // for the object file cache (-cache)
+    char *srcDigest;                // hash of the source code
+    Strings stringImports;          // files read by import("...")
 #endif
 };
 
@@ -981,8 +981,7 @@ Expression *BinAssignExp::op_overload(Scope *sc)
             {
                 Expressions *a = new Expressions();
                 a->push(e2);
-                for (size_t i = 0; i < ae->arguments->dim; i++)
-                    a->push(ae->arguments->tdata()[i]);
+                a->append(ae->arguments);
 
                 Objects *targsi = opToArg(sc, op);
                 Expression *e = new DotTemplateInstanceExp(loc, ae->e1, fd->ident, targsi);
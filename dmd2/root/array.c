@@ -46,6 +46,9 @@
 
 /********************************* Array ****************************/
 
+unsigned Array::numReallocs;
+size_t Array::reallocBytes;
+
 Array::Array()
 {
     data = SMALLARRAYCAP ? &smallarray[0] : NULL;
@@ -67,6 +70,12 @@ void Array::mark()
         mem.mark(data[u]);      // BUG: what if arrays of Object's?
 }
 
+/***********************************
+ * Make room for nentries more elements. The capacity grows by half of
+ * the current size at least, so that repeated pushes take amortized
+ * constant time.
+ */
+
 void Array::reserve(unsigned nentries)
 {
     //printf("Array::reserve: dim = %d, allocdim = %d, nentries = %d\n", dim, allocdim, nentries);
@@ -82,15 +91,21 @@ void Array::reserve(unsigned nentries)
             {   allocdim = nentries;
                 data = (void **)mem.malloc(allocdim * sizeof(*data));
             }
+            return;
         }
-        else if (allocdim == SMALLARRAYCAP)
+
+        unsigned increment = dim / 2;
+        if (increment < nentries)
+            increment = nentries;
+        allocdim = dim + increment;
+        if (data == &smallarray[0])
         {
-            allocdim = dim + nentries;
             data = (void **)mem.malloc(allocdim * sizeof(*data));
             memcpy(data, &smallarray[0], dim * sizeof(*data));
         }
         else
-        {   allocdim = dim + nentries;
+        {   numReallocs++;
+            reallocBytes += dim * sizeof(*data);
             data = (void **)mem.realloc(data, allocdim * sizeof(*data));
         }
     }
@@ -107,19 +122,19 @@ void Array::setDim(unsigned newdim)
 
 void Array::fixDim()
 {
-    if (dim != allocdim)
+    if (dim != allocdim && data != &smallarray[0])
     {
-        if (allocdim >= SMALLARRAYCAP)
+        if (dim <= SMALLARRAYCAP)
         {
-            if (dim <= SMALLARRAYCAP)
-            {
-                memcpy(&smallarray[0], data, dim * sizeof(*data));
-                mem.free(data);
-            }
-            else
-                data = (void **)mem.realloc(data, dim * sizeof(*data));
+            memcpy(&smallarray[0], data, dim * sizeof(*data));
+            mem.free(data);
+            data = SMALLARRAYCAP ? &smallarray[0] : NULL;
+            allocdim = SMALLARRAYCAP;
+        }
+        else
+        {   data = (void **)mem.realloc(data, dim * sizeof(*data));
+            allocdim = dim;
         }
-        allocdim = dim;
     }
 }
 
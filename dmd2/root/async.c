@@ -74,16 +74,15 @@ void AsyncRead::start()
         {
             SetThreadPriority(hThread, THREAD_PRIORITY_HIGHEST);
         }
-        else
-        {
-            assert(0);
-        }
+        // else read the files synchronously in read()
     }
 }
 
 int AsyncRead::read(size_t i)
 {
     FileData *f = &files[i];
+    if (!hThread)
+        return f->result = f->file->read();
     WaitForSingleObject(f->event, INFINITE);
     Sleep(0);                   // give up time slice
     return f->result;
@@ -91,6 +90,12 @@ int AsyncRead::read(size_t i)
 
 void AsyncRead::dispose(AsyncRead *aw)
 {
+    if (aw->hThread)
+    {   WaitForSingleObject(aw->hThread, INFINITE);
+        CloseHandle(aw->hThread);
+    }
+    for (size_t i = 0; i < aw->filesdim; i++)
+        CloseHandle(aw->files[i].event);
     free(aw);
 }
 
@@ -119,6 +124,14 @@ unsigned __stdcall startthread(void *p)
 
 #include "root.h"
 
+/* All AsyncReads share one pool of ASYNC_THREADS reader threads, which
+ * take the files to read from a single queue. A file that nobody has
+ * started reading yet is read by AsyncRead::read() itself, so if no
+ * thread can be started at all, everything is read synchronously.
+ */
+
+#define ASYNC_THREADS 4
+
 void *startthread(void *arg);
 
 void err_abort(int status, const char *msg)
@@ -127,14 +140,21 @@ void err_abort(int status, const char *msg)
     exit(EXIT_FAILURE);
 }
 
+enum FileState
+{
+    FSqueued,           // in the queue, or not started yet
+    FSreading,
+    FSdone,
+};
+
 struct FileData
 {
     File *file;
     int result;
+    FileState state;
 
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    int value;
+    FileData *prev;     // queue links
+    FileData *next;
 };
 
 struct AsyncRead
@@ -150,6 +170,56 @@ struct AsyncRead
     FileData files[1];
 };
 
+// Protects the queue and the state of every FileData
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;  // a file was queued
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;    // a file was read
+static FileData *queueHead;
+static FileData *queueTail;
+static int nthreads;
+
+static void lock()
+{
+    int status = pthread_mutex_lock(&mutex);
+    if (status != 0)
+        err_abort(status, "lock mutex");
+}
+
+static void unlock()
+{
+    int status = pthread_mutex_unlock(&mutex);
+    if (status != 0)
+        err_abort(status, "unlock mutex");
+}
+
+static void unqueue(FileData *f)
+{
+    if (f->prev)
+        f->prev->next = f->next;
+    else
+        queueHead = f->next;
+    if (f->next)
+        f->next->prev = f->prev;
+    else
+        queueTail = f->prev;
+    f->prev = f->next = NULL;
+}
+
+/* Start the reader threads if that has not been done yet.
+ * Must be called with the mutex locked.
+ */
+static void startPool()
+{
+    while (nthreads < ASYNC_THREADS)
+    {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, &startthread, NULL) != 0)
+            break;      // read synchronously in AsyncRead::read()
+        pthread_detach(thread_id);
+        nthreads++;
+    }
+}
+
 
 AsyncRead *AsyncRead::create(size_t nfiles)
 {
@@ -166,49 +236,58 @@ void AsyncRead::addFile(File *file)
     assert(filesdim < filesmax);
     FileData *f = &files[filesdim];
     f->file = file;
-
-    int status = pthread_mutex_init(&f->mutex, NULL);
-    if (status != 0)
-        err_abort(status, "init mutex");
-    status = pthread_cond_init(&f->cond, NULL);
-    if (status != 0)
-        err_abort(status, "init cond");
-
+    f->state = FSqueued;
     filesdim++;
 }
 
 void AsyncRead::start()
 {
     //printf("aw->filesdim = %p %d\n", this, filesdim);
-    if (filesdim)
+    if (!filesdim)
+        return;
+
+    lock();
+    startPool();
+    if (nthreads)
     {
-        pthread_t thread_id;
-        int status = pthread_create(&thread_id,
-            NULL,
-            &startthread,
-            this);
+        for (size_t i = 0; i < filesdim; i++)
+        {   FileData *f = &files[i];
+            f->prev = queueTail;
+            if (queueTail)
+                queueTail->next = f;
+            else
+                queueHead = f;
+            queueTail = f;
+        }
+        int status = pthread_cond_broadcast(&queued);
         if (status != 0)
-            err_abort(status, "create thread");
+            err_abort(status, "signal condition");
     }
+    unlock();
 }
 
 int AsyncRead::read(size_t i)
 {
     FileData *f = &files[i];
 
-    // Wait for the event
-    int status = pthread_mutex_lock(&f->mutex);
-    if (status != 0)
-        err_abort(status, "lock mutex");
-    while (f->value == 0)
+    lock();
+    if (f->state == FSqueued)
+    {   // Nobody got to it yet, read it right here
+        if (f->prev || queueHead == f)
+            unqueue(f);
+        f->state = FSreading;
+        unlock();
+        f->result = f->file->read();
+        lock();
+        f->state = FSdone;
+    }
+    while (f->state != FSdone)
     {
-        status = pthread_cond_wait(&f->cond, &f->mutex);
+        int status = pthread_cond_wait(&done, &mutex);
         if (status != 0)
             err_abort(status, "wait on condition");
     }
-    status = pthread_mutex_unlock(&f->mutex);
-    if (status != 0)
-        err_abort(status, "unlock mutex");
+    unlock();
 
     return f->result;
 }
@@ -216,45 +295,56 @@ int AsyncRead::read(size_t i)
 void AsyncRead::dispose(AsyncRead *aw)
 {
     //printf("AsyncRead::dispose()\n");
-    for (int i = 0; i < aw->filesdim; i++)
+    // Files still queued are dropped, the ones being read waited for
+    lock();
+    for (size_t i = 0; i < aw->filesdim; i++)
     {
         FileData *f = &aw->files[i];
-        int status = pthread_cond_destroy(&f->cond);
-        if (status != 0)
-            err_abort(status, "cond destroy");
-        status = pthread_mutex_destroy(&f->mutex);
-        if (status != 0)
-            err_abort(status, "mutex destroy");
+        if (f->state == FSqueued)
+        {
+            if (f->prev || queueHead == f)
+                unqueue(f);
+            f->state = FSdone;
+        }
+        while (f->state != FSdone)
+        {
+            int status = pthread_cond_wait(&done, &mutex);
+            if (status != 0)
+                err_abort(status, "wait on condition");
+        }
     }
+    unlock();
     free(aw);
 }
 
 
 void *startthread(void *p)
 {
-    AsyncRead *aw = (AsyncRead *)p;
+    lock();
+    while (1)
+    {
+        while (!queueHead)
+        {
+            int status = pthread_cond_wait(&queued, &mutex);
+            if (status != 0)
+                err_abort(status, "wait on condition");
+        }
 
-    //printf("startthread: aw->filesdim = %p %d\n", aw, aw->filesdim);
-    size_t dim = aw->filesdim;
-    for (size_t i = 0; i < dim; i++)
-    {   FileData *f = &aw->files[i];
+        FileData *f = queueHead;
+        unqueue(f);
+        f->state = FSreading;
+        unlock();
 
-        f->result = f->file->read();
+        int result = f->file->read();
 
-        // Set event
-        int status = pthread_mutex_lock(&f->mutex);
-        if (status != 0)
-            err_abort(status, "lock mutex");
-        f->value = 1;
-        status = pthread_cond_signal(&f->cond);
+        lock();
+        f->result = result;
+        f->state = FSdone;
+        int status = pthread_cond_broadcast(&done);
         if (status != 0)
             err_abort(status, "signal condition");
-        status = pthread_mutex_unlock(&f->mutex);
-        if (status != 0)
-            err_abort(status, "unlock mutex");
     }
-
-    return NULL;                        // end thread
+    return NULL;                        // not reached
 }
 
 #else
@@ -134,6 +134,118 @@ void Mem::addroots(char* pStart, char* pEnd)
 {
 }
 
+/* =================================================== */
+
+/* Object's (the AST, types, symbols, ...) are allocated in large numbers,
+ * but hardly ever freed. Instead of going through malloc for each of them,
+ * they are carved out of big slabs with a bump pointer. Every thread has
+ * its own slabs, so no locking is needed. Freed objects are put on a free
+ * list for their size class and handed out again first.
+ *
+ * With the Boehm GC (REDIRECT_MALLOC), objects are allocated individually
+ * so that the collector can still free them.
+ */
+
+#ifndef REDIRECT_MALLOC
+
+#if _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#define ARENA_ALIGN     16
+#define ARENA_SLAB      (1024 * 1024)
+#define ARENA_CLASSES   32              // free lists for sizes up to 512 bytes
+#define ARENA_LARGE     (ARENA_SLAB / 4) // larger blocks are malloc'ed
+
+struct ArenaFree
+{
+    ArenaFree *next;
+};
+
+static THREAD_LOCAL char *arenaNext;
+static THREAD_LOCAL char *arenaEnd;
+static THREAD_LOCAL size_t arenaTotal;
+static THREAD_LOCAL ArenaFree *arenaFreelist[ARENA_CLASSES + 1];
+
+void *Mem::arenaMalloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    size_t c = size / ARENA_ALIGN;
+    if (c <= ARENA_CLASSES && arenaFreelist[c])
+    {   ArenaFree *f = arenaFreelist[c];
+        arenaFreelist[c] = f->next;
+        return f;
+    }
+
+    if (size > ARENA_LARGE)
+    {   // Large blocks are allocated individually, so that arenaFree()
+        // can give them back
+        void *p = ::malloc(size);
+        if (!p)
+            error();
+        arenaTotal += size;
+        return p;
+    }
+
+    if (size > (size_t)(arenaEnd - arenaNext))
+    {
+        arenaNext = (char *)::malloc(ARENA_SLAB);
+        if (!arenaNext)
+            error();
+        arenaEnd = arenaNext + ARENA_SLAB;
+        arenaTotal += ARENA_SLAB;
+    }
+    void *p = arenaNext;
+    arenaNext += size;
+    return p;
+}
+
+void Mem::arenaFree(void *p, size_t size)
+{
+    if (!p)
+        return;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    size_t c = size / ARENA_ALIGN;
+    if (size > ARENA_LARGE)
+        ::free(p);
+    else if (c <= ARENA_CLASSES)
+    {   ArenaFree *f = (ArenaFree *)p;
+        f->next = arenaFreelist[c];
+        arenaFreelist[c] = f;
+    }
+}
+
+size_t Mem::arenaReserved()
+{
+    return arenaTotal;
+}
+
+#else
+
+void *Mem::arenaMalloc(size_t size)
+{
+    void *p = ::malloc(size ? size : 1);
+    if (!p)
+        error();
+    return p;
+}
+
+void Mem::arenaFree(void *p, size_t size)
+{
+    free(p);
+}
+
+size_t Mem::arenaReserved()
+{
+    return 0;
+}
+
+#endif
+
 
 /* =================================================== */
 
@@ -44,6 +44,11 @@ struct Mem
     void setFinalizer(void* pObj, FINALIZERPROC pFn, void* pClientData);
     void setStackBottom(void *bottom);
     GC *getThreadGC();          // get apartment allocator for this thread
+
+    // Allocator for Object's, which mostly live until the compiler exits
+    void *arenaMalloc(size_t size);
+    void arenaFree(void *p, size_t size);
+    size_t arenaReserved();     // bytes reserved by the calling thread
 };
 
 extern Mem mem;
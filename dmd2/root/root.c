@@ -181,6 +181,16 @@ void warning(const char *format, ...)
 
 /****************************** Object ********************************/
 
+void *Object::operator new(size_t size)
+{
+    return mem.arenaMalloc(size);
+}
+
+void Object::operator delete(void *p, size_t size)
+{
+    mem.arenaFree(p, size);
+}
+
 int Object::equals(Object *o)
 {
     return o == this;
@@ -75,6 +75,10 @@ struct Object
     Object() { }
     virtual ~Object() { }
 
+    // Allocated with mem.arenaMalloc()
+    void *operator new(size_t size);
+    void operator delete(void *p, size_t size);
+
     virtual int equals(Object *o);
 
     /**
@@ -326,6 +330,9 @@ struct Array : Object
     void *smallarray[SMALLARRAYCAP];    // inline storage for small arrays
 
   public:
+    static unsigned numReallocs;        // statistics, see reserve()
+    static size_t reallocBytes;
+
     Array();
     ~Array();
     //Array(const Array&);
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "root.h"
 #include "rmem.h"
@@ -18,32 +19,46 @@
 #include "lstring.h"
 #include "stringtable.h"
 
-void StringTable::init(unsigned size)
+/* MurmurHash2, by Austin Appleby (public domain).
+ * Dchar::calcHash mixes the input far too little for large power of 2
+ * tables and long, similar strings like type decos.
+ */
+static hash_t calcHash(const dchar *str, unsigned len)
 {
-    table = (void **)mem.calloc(size, sizeof(void *));
-    tabledim = size;
-    count = 0;
-}
+    const uint32_t m = 0x5bd1e995;
+    const unsigned char *data = (const unsigned char *)str;
+    size_t nbytes = len * sizeof(dchar);
+    uint32_t h = 0x9747b28c ^ (uint32_t)nbytes;
 
-StringTable::~StringTable()
-{
-    unsigned i;
+    while (nbytes >= 4)
+    {
+        uint32_t k;
+        memcpy(&k, data, 4);    // may be unaligned
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+        h *= m;
+        h ^= k;
+        data += 4;
+        nbytes -= 4;
+    }
 
-    // Zero out dangling pointers to help garbage collector.
-    // Should zero out StringEntry's too.
-    for (i = 0; i < count; i++)
-        table[i] = NULL;
+    switch (nbytes)
+    {
+        case 3: h ^= data[2] << 16;
+        case 2: h ^= data[1] << 8;
+        case 1: h ^= data[0];
+                h *= m;
+    }
 
-    mem.free(table);
-    table = NULL;
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
 }
 
 struct StringEntry
 {
-    StringEntry *left;
-    StringEntry *right;
-    hash_t hash;
-
     StringValue value;
 
     static StringEntry *alloc(const dchar *s, unsigned len);
@@ -55,85 +70,117 @@ StringEntry *StringEntry::alloc(const dchar *s, unsigned len)
 
     se = (StringEntry *) mem.calloc(1,sizeof(StringEntry) - sizeof(Lstring) + Lstring::size(len));
     se->value.lstring.length = len;
-    se->hash = Dchar::calcHash(s,len);
     memcpy(se->value.lstring.string, s, len * sizeof(dchar));
     return se;
 }
 
-void **StringTable::search(const dchar *s, unsigned len)
+void StringTable::init(unsigned size)
+{
+    tabledim = 4;
+    while (tabledim < size)
+        tabledim <<= 1;
+    table = (Slot *)mem.calloc(tabledim, sizeof(Slot));
+    count = 0;
+}
+
+StringTable::~StringTable()
+{
+    // Zero out dangling pointers to help garbage collector.
+    // Should zero out StringEntry's too.
+    memset(table, 0, tabledim * sizeof(Slot));
+
+    mem.free(table);
+    table = NULL;
+}
+
+/* Return the slot containing s, or the empty slot where it would go.
+ */
+StringTable::Slot *StringTable::search(const dchar *s, unsigned len, hash_t hash)
 {
-    hash_t hash;
-    unsigned u;
-    int cmp;
-    StringEntry **se;
-
-    //printf("StringTable::search(%p,%d)\n",s,len);
-    hash = Dchar::calcHash(s,len);
-    u = hash % tabledim;
-    se = (StringEntry **)&table[u];
-    //printf("\thash = %d, u = %d\n",hash,u);
-    while (*se)
+    unsigned mask = tabledim - 1;
+    unsigned u = hash & mask;
+
+    // Triangular probing visits every slot of a power of 2 sized table.
+    for (unsigned step = 1; ; step++)
     {
-        cmp = (*se)->hash - hash;
-        if (cmp == 0)
+        Slot *slot = &table[u];
+        if (!slot->entry)
+            return slot;
+        if (slot->hash == hash)
         {
-            cmp = (*se)->value.lstring.len() - len;
-            if (cmp == 0)
-            {
-                cmp = Dchar::memcmp(s,(*se)->value.lstring.toDchars(),len);
-                if (cmp == 0)
-                    break;
-            }
+            Lstring *ls = &slot->entry->value.lstring;
+            if (ls->length == len &&
+                Dchar::memcmp(s, ls->string, len) == 0)
+                return slot;
         }
-        if (cmp < 0)
-            se = &(*se)->left;
-        else
-            se = &(*se)->right;
+        u = (u + step) & mask;
     }
-    //printf("\treturn %p, %p\n",se, (*se));
-    return (void **)se;
 }
 
-StringValue *StringTable::lookup(const dchar *s, unsigned len)
-{   StringEntry *se;
+void StringTable::grow()
+{
+    Slot *oldtable = table;
+    unsigned olddim = tabledim;
+
+    tabledim = olddim * 2;
+    table = (Slot *)mem.calloc(tabledim, sizeof(Slot));
+
+    unsigned mask = tabledim - 1;
+    for (unsigned i = 0; i < olddim; i++)
+    {
+        if (!oldtable[i].entry)
+            continue;
 
-    se = *(StringEntry **)search(s,len);
-    if (se)
-        return &se->value;
+        unsigned u = oldtable[i].hash & mask;
+        for (unsigned step = 1; table[u].entry; step++)
+            u = (u + step) & mask;
+        table[u] = oldtable[i];
+    }
+
+    mem.free(oldtable);
+}
+
+StringValue *StringTable::lookup(const dchar *s, unsigned len)
+{
+    Slot *slot = search(s, len, calcHash(s, len));
+    if (slot->entry)
+        return &slot->entry->value;
     else
         return NULL;
 }
 
 StringValue *StringTable::update(const dchar *s, unsigned len)
-{   StringEntry **pse;
-    StringEntry *se;
-
-    pse = (StringEntry **)search(s,len);
-    se = *pse;
-    if (!se)                    // not in table: so create new entry
+{
+    hash_t hash = calcHash(s, len);
+    Slot *slot = search(s, len, hash);
+    if (!slot->entry)           // not in table: so create new entry
     {
-        se = StringEntry::alloc(s, len);
-        *pse = se;
+        if ((count + 1) * 4 > tabledim * 3)
+        {
+            grow();
+            slot = search(s, len, hash);
+        }
+        slot->hash = hash;
+        slot->entry = StringEntry::alloc(s, len);
+        count++;
     }
-    return &se->value;
+    return &slot->entry->value;
 }
 
 StringValue *StringTable::insert(const dchar *s, unsigned len)
-{   StringEntry **pse;
-    StringEntry *se;
-
-    pse = (StringEntry **)search(s,len);
-    se = *pse;
-    if (se)
+{
+    hash_t hash = calcHash(s, len);
+    Slot *slot = search(s, len, hash);
+    if (slot->entry)
         return NULL;            // error: already in table
-    else
+
+    if ((count + 1) * 4 > tabledim * 3)
     {
-        se = StringEntry::alloc(s, len);
-        *pse = se;
+        grow();
+        slot = search(s, len, hash);
     }
-    return &se->value;
+    slot->hash = hash;
+    slot->entry = StringEntry::alloc(s, len);
+    count++;
+    return &slot->entry->value;
 }
-
-
-
-
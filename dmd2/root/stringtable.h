@@ -28,13 +28,26 @@ struct StringValue
     Lstring lstring;
 };
 
+struct StringEntry;
+
+/* Open addressing hash table of power of 2 size, which is doubled whenever
+ * it gets 3/4 full. The hash of each entry is kept in the slot, so probing
+ * only has to touch the entry itself on a likely match. Entries are never
+ * moved, so StringValue pointers stay valid across rehashes.
+ */
 struct StringTable
 {
-    void **table;
+    struct Slot
+    {
+        hash_t hash;
+        StringEntry *entry;     // NULL if slot is empty
+    };
+
+    Slot *table;
     unsigned count;
-    unsigned tabledim;
+    unsigned tabledim;          // always a power of 2
 
-    void init(unsigned size = 37);
+    void init(unsigned size = 16);
     ~StringTable();
 
     StringValue *lookup(const dchar *s, unsigned len);
@@ -42,7 +55,8 @@ struct StringTable
     StringValue *update(const dchar *s, unsigned len);
 
 private:
-    void **search(const dchar *s, unsigned len);
+    Slot *search(const dchar *s, unsigned len, hash_t hash);
+    void grow();
 };
 
 #endif
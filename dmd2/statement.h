@@ -51,6 +51,10 @@ struct TryFinallyStatement;
 struct CaseStatement;
 struct DefaultStatement;
 struct LabelStatement;
+struct DoStatement;
+struct ForStatement;
+struct BreakStatement;
+struct ContinueStatement;
 struct HdrGenState;
 struct InterState;
 #if IN_LLVM
@@ -150,6 +154,10 @@ struct Statement : Object
     virtual CaseStatement *isCaseStatement() { return NULL; }
     virtual DefaultStatement *isDefaultStatement() { return NULL; }
     virtual LabelStatement *isLabelStatement() { return NULL; }
+    virtual DoStatement *isDoStatement() { return NULL; }
+    virtual ForStatement *isForStatement() { return NULL; }
+    virtual BreakStatement *isBreakStatement() { return NULL; }
+    virtual ContinueStatement *isContinueStatement() { return NULL; }
 
 #if IN_LLVM
     virtual void toNakedIR(IRState *irs);
@@ -348,6 +356,8 @@ struct DoStatement : Statement
     Statement *inlineScan(InlineScanState *iss);
 
     void toIR(IRState *irs);
+
+    DoStatement *isDoStatement() { return this; }
 };
 
 struct ForStatement : Statement
@@ -374,6 +384,8 @@ struct ForStatement : Statement
     Statement *doInlineStatement(InlineDoState *ids);
 
     void toIR(IRState *irs);
+
+    ForStatement *isForStatement() { return this; }
 };
 
 struct ForeachStatement : Statement
@@ -693,6 +705,8 @@ struct BreakStatement : Statement
 
     void toIR(IRState *irs);
 
+    BreakStatement *isBreakStatement() { return this; }
+
 #if IN_LLVM
     // LDC: only set if ident is set: label statement to jump to
     LabelStatement *target;
@@ -712,6 +726,8 @@ struct ContinueStatement : Statement
 
     void toIR(IRState *irs);
 
+    ContinueStatement *isContinueStatement() { return this; }
+
 #if IN_LLVM
     // LDC: only set if ident is set: label statement to jump to
     LabelStatement *target;
@@ -150,6 +150,28 @@ Dsymbol *getDsymbol(Object *oarg)
  * Else, return 0.
  */
 
+/******************************
+ * If t is an instance of tempdecl that is currently being expanded
+ * in sc, return that instance.
+ */
+
+static TemplateInstance *recursiveExpansion(Type *t, TemplateDeclaration *tempdecl, Scope *sc)
+{
+    Dsymbol *s = t->toDsymbol(sc);
+    if (s && s->parent)
+    {   TemplateInstance *ti = s->parent->isTemplateInstance();
+        if (ti && ti->tempdecl == tempdecl)
+        {
+            for (Scope *sc1 = sc; sc1; sc1 = sc1->enclosing)
+            {
+                if (sc1->scopesym == ti)
+                    return ti;
+            }
+        }
+    }
+    return NULL;
+}
+
 int match(Object *o1, Object *o2, TemplateDeclaration *tempdecl, Scope *sc)
 {
     Type *t1 = isType(o1);
@@ -192,20 +214,10 @@ int match(Object *o1, Object *o2, TemplateDeclaration *tempdecl, Scope *sc)
         /* if t1 is an instance of ti, then give error
          * about recursive expansions.
          */
-        Dsymbol *s = t1->toDsymbol(sc);
-        if (s && s->parent)
-        {   TemplateInstance *ti1 = s->parent->isTemplateInstance();
-            if (ti1 && ti1->tempdecl == tempdecl)
-            {
-                for (Scope *sc1 = sc; sc1; sc1 = sc1->enclosing)
-                {
-                    if (sc1->scopesym == ti1)
-                    {
-                        error("recursive template expansion for template argument %s", t1->toChars());
-                        return 1;       // fake a match
-                    }
-                }
-            }
+        if (recursiveExpansion(t1, tempdecl, sc))
+        {
+            error("recursive template expansion for template argument %s", t1->toChars());
+            return 1;       // fake a match
         }
 
         //printf("t1 = %s\n", t1->toChars());
@@ -278,6 +290,88 @@ int arrayObjectMatch(Objects *oa1, Objects *oa2, TemplateDeclaration *tempdecl,
     return 1;
 }
 
+/************************************
+ * Compute a hash of a template argument, such that arguments for which
+ * match() succeeds have the same hash.
+ * Returns 0 if o cannot be hashed.
+ */
+static hash_t objectHash(Object *o, TemplateDeclaration *tempdecl, Scope *sc)
+{
+    Type *t = isType(o);
+    Expression *e = isExpression(o);
+    Dsymbol *s = isDsymbol(o);
+    Tuple *u = isTuple(o);
+
+    // Manifest constants match by value, see match()
+    if (s)
+    {
+        VarDeclaration *v = s->isVarDeclaration();
+        if (v && v->storage_class & STCmanifest)
+        {   ExpInitializer *ei = v->init->isExpInitializer();
+            if (ei)
+                e = ei->exp, s = NULL;
+        }
+    }
+
+    hash_t h = 0;
+    if (t)
+    {
+        /* Types are compared by their deco, which is unique after
+         * semantic(). Tuple types and recursive expansions (for which
+         * match() issues an error) are left to match().
+         */
+        if (!t->deco || t->ty == Ttuple || recursiveExpansion(t, tempdecl, sc))
+            return 0;
+        h = (hash_t)t->deco;
+    }
+    else if (e)
+    {
+        h = e->op;
+        if (e->op == TOKint64)
+        {   dinteger_t value = ((IntegerExp *)e)->value;
+            h = h * 37 + (hash_t)(value ^ (value >> 32));
+        }
+        else if (e->op == TOKstring)
+        {   // StringExp::compare() compares len code units of sz bytes
+            // each, so strings it finds equal agree at least in their
+            // first len bytes, whatever their sz. Only hash those.
+            StringExp *se = (StringExp *)e;
+            h = h * 37 + String::calcHash((char *)se->string, se->len);
+        }
+    }
+    else if (s)
+    {
+        // Overload sets don't have an ident, and only match themselves
+        if (!s->ident)
+            h = (hash_t)s;
+        else
+            h = s->ident->hashCode() * 37 + (hash_t)s->parent;
+    }
+    else if (u)
+    {
+        h = u->objects.dim;
+        for (size_t i = 0; i < u->objects.dim; i++)
+        {   hash_t h1 = objectHash(u->objects.tdata()[i], tempdecl, sc);
+            if (!h1)
+                return 0;
+            h = h * 37 + h1;
+        }
+    }
+    return h;
+}
+
+static hash_t arrayObjectHash(Objects *oa, TemplateDeclaration *tempdecl, Scope *sc)
+{
+    hash_t h = oa->dim;
+    for (size_t j = 0; j < oa->dim; j++)
+    {   hash_t h1 = objectHash(oa->tdata()[j], tempdecl, sc);
+        if (!h1)
+            return 0;
+        h = h * 37 + h1;
+    }
+    return h ? h : 1;
+}
+
 /****************************************
  * This makes a 'pretty' version of the template arguments.
  * It's analogous to genIdent() which makes a mangled version.
@@ -384,6 +478,7 @@ TemplateDeclaration::TemplateDeclaration(Loc loc, Identifier *id,
     this->literal = 0;
     this->ismixin = ismixin;
     this->previous = NULL;
+    this->instanceTable = NULL;
 
     // Compute in advance for Ddoc's use
     if (members)
@@ -1843,6 +1938,50 @@ int TemplateDeclaration::isOverloadable()
     return 1;
 }
 
+/***********************************
+ * Instances are indexed by the hash of their tdtypes[], so
+ * TemplateInstance::semantic() only has to compare the ones that
+ * can possibly match. Instances that cannot be hashed are kept
+ * under hash 0.
+ */
+
+unsigned TemplateDeclaration::instanceLookups;
+unsigned TemplateDeclaration::instanceCompares;
+
+TemplateInstances *TemplateDeclaration::instancesWithHash(hash_t hash)
+{
+    return (TemplateInstances *)_aaGetRvalue(instanceTable, (void *)hash);
+}
+
+void TemplateDeclaration::addInstance(TemplateInstance *ti)
+{
+    instances.push(ti);
+
+    TemplateInstances **pinsts = (TemplateInstances **)_aaGet(&instanceTable, (void *)ti->hash);
+    if (!*pinsts)
+        *pinsts = new TemplateInstances();
+    (*pinsts)->push(ti);
+}
+
+void TemplateDeclaration::removeInstance(TemplateInstance *ti)
+{
+    TemplateInstances *insts = instancesWithHash(ti->hash);
+    for (size_t i = insts->dim; i-- > 0; )
+    {
+        if (insts->tdata()[i] == ti)
+        {   insts->remove(i);
+            break;
+        }
+    }
+    for (size_t i = instances.dim; i-- > 0; )
+    {
+        if (instances.tdata()[i] == ti)
+        {   instances.remove(i);
+            break;
+        }
+    }
+}
+
 /*************************************************
  * Given function arguments, figure out which template function
  * to expand, and return that function.
@@ -4208,6 +4347,7 @@ TemplateInstance::TemplateInstance(Loc loc, Identifier *ident)
     this->errors = 0;
     this->speculative = 0;
     this->ignore = true;
+    this->hash = 0;
 
 #if IN_LLVM
     this->emittedInModule = NULL;
@@ -4243,6 +4383,7 @@ TemplateInstance::TemplateInstance(Loc loc, TemplateDeclaration *td, Objects *ti
     this->errors = 0;
     this->speculative = 0;
     this->ignore = true;
+    this->hash = 0;
 
 #if IN_LLVM
     this->tinst = NULL;
@@ -4387,11 +4528,21 @@ void TemplateInstance::semantic(Scope *sc, Expressions *fargs)
 
     /* See if there is an existing TemplateInstantiation that already
      * implements the typeargs. If so, just refer to that one instead.
+     * Only the instances with the same hash, and those that could not
+     * be hashed, need to be looked at. If our own arguments cannot be
+     * hashed, all of them have to be.
      */
+    hash = arrayObjectHash(&tdtypes, tempdecl, sc);
+    TemplateInstances *candidates = hash ? tempdecl->instancesWithHash(hash) : &tempdecl->instances;
+    TemplateInstances *unhashed = hash ? tempdecl->instancesWithHash(0) : NULL;
+    size_t ncandidates = candidates ? candidates->dim : 0;
+    TemplateDeclaration::instanceLookups++;
 
-    for (size_t i = 0; i < tempdecl->instances.dim; i++)
+    for (size_t i = 0; i < ncandidates + (unhashed ? unhashed->dim : 0); i++)
     {
-        TemplateInstance *ti = tempdecl->instances.tdata()[i];
+        TemplateInstance *ti = i < ncandidates ? candidates->tdata()[i]
+                                               : unhashed->tdata()[i - ncandidates];
+        TemplateDeclaration::instanceCompares++;
 #if LOG
         printf("\t%s: checking for match with instance %d (%p): '%s'\n", toChars(), i, ti, ti->toChars());
 #endif
@@ -4483,8 +4634,7 @@ void TemplateInstance::semantic(Scope *sc, Expressions *fargs)
     if (global.gag && sc->intypeof)
         speculative = 1;
 
-    int tempdecl_instance_idx = tempdecl->instances.dim;
-    tempdecl->instances.push(this);
+    tempdecl->addInstance(this);
     parent = tempdecl->parent;
     //printf("parent = '%s'\n", parent->kind());
 
@@ -4787,7 +4937,7 @@ void TemplateInstance::semantic(Scope *sc, Expressions *fargs)
             // instance/symbol lists we added it to and reset our state to
             // finish clean and so we can try to instantiate it again later
             // (see bugzilla 4302 and 6602).
-            tempdecl->instances.remove(tempdecl_instance_idx);
+            tempdecl->removeInstance(this);
             if (target_symbol_list)
             {
                 // Because we added 'this' in the last position above, we
@@ -40,6 +40,7 @@ struct Expression;
 struct AliasDeclaration;
 struct FuncDeclaration;
 struct HdrGenState;
+struct AA;
 enum MATCH;
 
 struct Tuple : Object
@@ -57,6 +58,7 @@ struct TemplateDeclaration : ScopeDsymbol
     TemplateParameters *origParameters; // originals for Ddoc
     Expression *constraint;
     TemplateInstances instances;        // array of TemplateInstance's
+    AA *instanceTable;                  // hash of tdtypes => TemplateInstances*
 
     TemplateDeclaration *overnext;      // next overloaded TemplateDeclaration
     TemplateDeclaration *overroot;      // first in overnext list
@@ -103,6 +105,12 @@ struct TemplateDeclaration : ScopeDsymbol
     int isOverloadable();
 
     void makeParamNamesVisibleInConstraint(Scope *paramscope, Expressions *fargs);
+
+    TemplateInstances *instancesWithHash(hash_t hash);
+    void addInstance(TemplateInstance *ti);
+    void removeInstance(TemplateInstance *ti);
+    static unsigned instanceLookups;    // statistics for -v
+    static unsigned instanceCompares;
 #if IN_LLVM
     // LDC
     std::string intrinsicName;
@@ -291,6 +299,7 @@ struct TemplateInstance : ScopeDsymbol
     Objects tdtypes;            // Array of Types/Expressions corresponding
                                 // to TemplateDeclaration.parameters
                                 // [int, char, 100]
+    hash_t hash;                // hash of tdtypes, 0 if it cannot be hashed
 
     TemplateDeclaration *tempdecl;      // referenced by foo.bar.abc
     TemplateInstance *inst;             // refer to existing instance
@@ -0,0 +1,182 @@
+#include "driver/cache.h"
+
+#include "llvm/Module.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "root.h"
+#include "rmem.h"
+#include "mars.h"
+#include "module.h"
+
+#include "gen/hash.h"
+#include "gen/logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#if POSIX
+#include <unistd.h>
+#endif
+#include <set>
+
+namespace ObjCache
+{
+
+// bump this whenever the layout of the cache changes
+static const char* cacheVersion = "ldc-objcache-1";
+
+static std::string flagsDigest;
+static unsigned hits, misses;
+
+// Options which have no influence on the generated object file.
+static bool isIrrelevantArg(const char* arg)
+{
+    return strncmp(arg, "-cache", 6) == 0
+        || strncmp(arg, "-j", 2) == 0
+        || strcmp(arg, "-v") == 0
+        || strcmp(arg, "-vv") == 0
+        || strcmp(arg, "-v-cg") == 0;
+}
+
+void init(const std::vector<const char*>& args)
+{
+    ContentHash hash;
+    hash.update(cacheVersion);
+    hash.update(global.ldc_version);
+    hash.update(global.version);
+    hash.update(global.llvm_version);
+
+    // skip argv[0], the compiler might have been invoked through a symlink
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (!isIrrelevantArg(args[i]))
+            hash.update(args[i]);
+    }
+
+    flagsDigest = hash.hexDigest();
+    Logger::println("Object cache flags digest: %s", flagsDigest.c_str());
+}
+
+std::string sourceKey(Module* m)
+{
+    ContentHash hash;
+    hash.update(flagsDigest.c_str());
+
+    std::vector<Module*> todo(1, m);
+    std::set<Module*> seen;
+    while (!todo.empty())
+    {
+        Module* mi = todo.back();
+        todo.pop_back();
+        if (!seen.insert(mi).second)
+            continue;
+
+        if (!mi->srcDigest)
+            return std::string();
+        hash.update(mi->srcfile->toChars());
+        hash.update(mi->srcDigest);
+
+        for (size_t i = 0; i < mi->stringImports.dim; i++)
+        {
+            File f(mi->stringImports.tdata()[i]);
+            if (f.read())
+                return std::string();
+            hash.update(f.name->toChars());
+            hash.update(f.buffer, f.len);
+        }
+
+        for (size_t i = 0; i < mi->aimports.dim; i++)
+            todo.push_back((Module*)mi->aimports.data[i]);
+    }
+
+    return hash.hexDigest();
+}
+
+std::string irKey(llvm::Module* m)
+{
+    std::string bitcode;
+    {
+        llvm::raw_string_ostream os(bitcode);
+        llvm::WriteBitcodeToFile(m, os);
+    }
+
+    ContentHash hash;
+    hash.update(flagsDigest.c_str());
+    hash.update(bitcode.data(), bitcode.size());
+    return hash.hexDigest();
+}
+
+static std::string cachePath(const std::string& key)
+{
+    std::string path = global.params.cacheDir;
+    path += '/';
+    path += key;
+    path += '.';
+    path += global.obj_ext;
+    return path;
+}
+
+// Copies src to dst, returns true on success.
+static bool copyFile(const char* src, const char* dst)
+{
+    File in((char*)src);
+    if (in.read())
+        return false;
+
+    File out((char*)dst);
+    out.setbuffer(in.buffer, in.len);
+    out.ref = 1;    // owned by in
+    return out.write() == 0;
+}
+
+bool fetch(const std::string& key, const char* objfile)
+{
+    std::string path = cachePath(key);
+    if (!FileName::exists(path.c_str()) || !copyFile(path.c_str(), objfile))
+    {
+        Logger::println("Object cache miss: %s", key.c_str());
+        ++misses;
+        return false;
+    }
+
+    Logger::println("Object cache hit: %s -> %s", key.c_str(), objfile);
+    if (global.params.verbose)
+        printf("cached    %s\n", objfile);
+    ++hits;
+    return true;
+}
+
+void store(const std::string& key, const char* objfile)
+{
+    FileName::ensurePathExists(global.params.cacheDir);
+
+    // Write to a temporary file first so that concurrent builds sharing the
+    // cache never see a partially written object.
+    std::string path = cachePath(key);
+    char tmpsuffix[32];
+#if POSIX
+    sprintf(tmpsuffix, ".tmp%d", (int)getpid());
+#else
+    sprintf(tmpsuffix, ".tmp");
+#endif
+    std::string tmppath = path + tmpsuffix;
+
+    if (!copyFile(objfile, tmppath.c_str()))
+    {
+        remove(tmppath.c_str());
+        return;
+    }
+#if !POSIX
+    remove(path.c_str());
+#endif
+    if (rename(tmppath.c_str(), path.c_str()) != 0)
+        remove(tmppath.c_str());
+}
+
+void printStatistics()
+{
+    if (global.params.verbose)
+        printf("cache     %u hits, %u misses\n", hits, misses);
+}
+
+} // namespace ObjCache
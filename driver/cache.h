@@ -0,0 +1,61 @@
+#ifndef LDC_DRIVER_CACHE_H
+#define LDC_DRIVER_CACHE_H
+
+#include <string>
+#include <vector>
+
+struct Module;
+
+namespace llvm
+{
+    class Module;
+}
+
+/**
+ * Object file cache, enabled by -cache=<dir>.
+ *
+ * Objects are stored under a key built from the compiler version and
+ * command line, plus either the source code of a module and everything it
+ * (transitively) imports, or the LLVM IR generated for it.
+ */
+namespace ObjCache
+{
+    /**
+     * Sets up the command line dependent part of all keys.
+     * @param args the full command line, including config file switches
+     */
+    void init(const std::vector<const char*>& args);
+
+    /**
+     * Builds a key from the source of m, its transitive imports and the
+     * files they string-import. Only safe to use if m is the only root
+     * module, as template instances triggered by one root module may
+     * otherwise end up in the object file of another.
+     * @return the key, or an empty string if m cannot be cached this way
+     */
+    std::string sourceKey(Module* m);
+
+    /**
+     * Builds a key from the IR generated for a module. Codegen still has to
+     * run, but optimization and object emission can be skipped on a hit.
+     */
+    std::string irKey(llvm::Module* m);
+
+    /**
+     * Copies the object file cached under key to objfile.
+     * @return true on a cache hit
+     */
+    bool fetch(const std::string& key, const char* objfile);
+
+    /**
+     * Adds objfile to the cache under key.
+     */
+    void store(const std::string& key, const char* objfile);
+
+    /**
+     * Prints the hit/miss counts if -v is given.
+     */
+    void printStatistics();
+}
+
+#endif
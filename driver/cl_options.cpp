@@ -383,10 +383,33 @@ cl::opt<bool, true> singleObj("singleobj",
     cl::desc("Create only a single output object file"),
     cl::location(global.params.singleObj));
 
+// Changes the layout of every class vtbl, so all D code linked into the
+// program has to be compiled with it, the runtime libraries included.
+static cl::opt<bool, true> classDisplay("class-display",
+    cl::desc("Append an ancestor display to class vtbls and do dynamic casts to\n"
+             "classes inline with it. Every linked D library, druntime\n"
+             "included, must be compiled with it as well"),
+    cl::location(global.params.useClassDisplay),
+    cl::init(false));
+
 cl::opt<bool> linkonceTemplates("linkonce-templates",
     cl::desc("Use linkonce_odr linkage for template symbols instead of weak_odr"),
     cl::ZeroOrMore);
 
+cl::opt<unsigned> codegenThreads("j",
+    cl::desc("Optimize and emit object files on <N> threads"),
+    cl::value_desc("N"),
+    cl::Prefix,
+    cl::init(1));
+
+cl::opt<std::string> cacheDir("cache",
+    cl::desc("Reuse object files cached in <dir> if their inputs did not change"),
+    cl::value_desc("dir"));
+
+cl::opt<std::string> moduleMapFile("module-map",
+    cl::desc("Remember in <file> where imported modules were found, instead of searching the import path again in the next build"),
+    cl::value_desc("file"));
+
 static cl::extrahelp footer("\n"
 "-d-debug can also be specified without options, in which case it enables all\n"
 "debug checks (i.e. (asserts, boundchecks, contracts and invariants) as well\n"
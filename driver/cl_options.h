@@ -52,6 +52,9 @@ namespace opts {
     extern cl::opt<llvm::CodeModel::Model> mCodeModel;
     extern cl::opt<bool, true> singleObj;
     extern cl::opt<bool> linkonceTemplates;
+    extern cl::opt<unsigned> codegenThreads;
+    extern cl::opt<std::string> cacheDir;
+    extern cl::opt<std::string> moduleMapFile;
 
     // Arguments to -d-debug
     extern std::vector<std::string> debugArgs;
@@ -1,5 +1,6 @@
 #include "gen/llvm.h"
 #include "llvm/Linker.h"
+#include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Program.h"
 #if _WIN32
@@ -11,12 +12,17 @@
 #include "module.h"
 
 #define NO_COUT_LOGGER
+#include "gen/irstate.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 #include "gen/programs.h"
 
 #include "driver/linker.h"
 #include "driver/cl_options.h"
+#include "driver/toobj.h"
+
+#include <cstdio>
+#include <set>
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -27,6 +33,12 @@ llvm::cl::opt<bool> quiet("quiet",
     llvm::cl::ZeroOrMore,
     llvm::cl::init(true));
 
+static llvm::cl::opt<bool> ltoInternalize("lto-internalize",
+    llvm::cl::desc("With -O4/-O5, internalize the D symbols of the program if no native objects\n"
+                   "or libraries are linked. Disable it if a native D library passed with -L-l\n"
+                   "uses symbols of the program"),
+    llvm::cl::init(true));
+
 //////////////////////////////////////////////////////////////////////////////
 
 bool endsWith(const std::string &str, const std::string &end)
@@ -219,6 +231,127 @@ int linkExecutable(const char* argv0)
 
 //////////////////////////////////////////////////////////////////////////////
 
+static bool isBitcodeFile(const char* path)
+{
+    unsigned char magic[4];
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return n == sizeof(magic) && llvm::isBitcode(magic, magic + n);
+}
+
+// Looks for the bitcode version lib<name>-bc.a of each library linked with
+// -l<name>, in the directories given with -L.
+static std::vector<llvm::sys::Path> findBitcodeLibraries()
+{
+    std::vector<std::string> dirs;
+    for (unsigned i = 0; i < global.params.linkswitches->dim; i++)
+    {
+        char *p = (char *)global.params.linkswitches->data[i];
+        if (p[0] == '-' && p[1] == 'L' && p[2])
+            dirs.push_back(p + 2);
+    }
+
+    std::vector<llvm::sys::Path> libs;
+    for (unsigned i = 0; i < global.params.linkswitches->dim; i++)
+    {
+        char *p = (char *)global.params.linkswitches->data[i];
+        if (p[0] != '-' || p[1] != 'l' || !p[2])
+            continue;
+        for (size_t j = 0; j < dirs.size(); j++)
+        {
+            llvm::sys::Path lib(dirs[j]);
+            lib.appendComponent(std::string("lib") + (p + 2) + "-bc.a");
+            if (llvm::sys::fs::exists(lib.str()))
+            {
+                libs.push_back(lib);
+                break;
+            }
+        }
+    }
+    return libs;
+}
+
+// Merges the bitcode object files with the bitcode runtime libraries, runs
+// the link-time optimizations on the whole program and writes it to the
+// native object file objfile. If internalize is set, the D symbols defined by
+// the bitcode files are made internal, see below.
+static void linkBitcodeProgram(const std::vector<const char*>& files, bool internalize,
+                               const std::string& objfile)
+{
+    Logger::println("*** Link-time optimization ***");
+    LOG_SCOPE;
+
+    llvm::Linker linker("ldc", "ldc-lto", llvm::getGlobalContext(),
+                        llvm::Linker::QuietWarnings | llvm::Linker::QuietErrors);
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        Logger::println("Linking in %s", files[i]);
+        bool isNative;
+        if (linker.LinkInFile(llvm::sys::Path(files[i]), isNative))
+        {
+            error("cannot link in bitcode file %s: %s", files[i], linker.getLastError().c_str());
+            fatal();
+        }
+    }
+
+    // Everything defined so far is our own code.
+    llvm::Module* program = linker.getModule();
+    std::set<std::string> ownSymbols;
+    for (llvm::Module::iterator I = program->begin(), E = program->end(); I != E; ++I)
+        if (!I->isDeclaration())
+            ownSymbols.insert(I->getName());
+    for (llvm::Module::global_iterator I = program->global_begin(), E = program->global_end(); I != E; ++I)
+        if (!I->isDeclaration())
+            ownSymbols.insert(I->getName());
+
+    // Only the members of the runtime archives that are actually needed
+    // are pulled in.
+    std::vector<llvm::sys::Path> libs = findBitcodeLibraries();
+    for (size_t i = 0; i < libs.size(); i++)
+    {
+        Logger::println("Linking in %s", libs[i].c_str());
+        bool isNative;
+        if (linker.LinkInArchive(libs[i], isNative))
+        {
+            error("cannot link in bitcode library %s: %s", libs[i].c_str(), linker.getLastError().c_str());
+            fatal();
+        }
+    }
+    program = linker.releaseModule();
+
+    // Internalize the D symbols of our own code, except for _Dmain. C
+    // symbols might be referenced from native code we do not know about,
+    // and the definitions taken from the runtime libraries must stay
+    // visible, as the native versions of the same archive members could
+    // get linked in as well.
+    std::vector<std::string> exports;
+    for (llvm::Module::iterator I = program->begin(), E = program->end(); I != E; ++I)
+    {
+        llvm::StringRef name = I->getName();
+        if (name == "_Dmain" || !name.startswith("_D") || !ownSymbols.count(name))
+            exports.push_back(name);
+    }
+    for (llvm::Module::global_iterator I = program->global_begin(), E = program->global_end(); I != E; ++I)
+    {
+        llvm::StringRef name = I->getName();
+        if (!name.startswith("_D") || !ownSymbols.count(name))
+            exports.push_back(name);
+    }
+    std::vector<const char*> exportList;
+    for (size_t i = 0; i < exports.size(); i++)
+        exportList.push_back(exports[i].c_str());
+
+    ldc_optimize_program(program, internalize ? &exportList : NULL);
+    emitNativeObjectFile(program, objfile, *gTargetMachine);
+    delete program;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 int linkObjToBinary(bool sharedLib)
 {
     Logger::println("*** Linking executable ***");
@@ -237,11 +370,16 @@ int linkObjToBinary(bool sharedLib)
     // first the program name ??
     args.push_back(gccStr);
 
-    // object files
+    // object files, the ones containing bitcode (-O4/-O5) are compiled
+    // to a single native object file first
+    std::vector<const char*> bitcodeFiles;
     for (unsigned i = 0; i < global.params.objfiles->dim; i++)
     {
         char *p = (char *)global.params.objfiles->data[i];
-        args.push_back(p);
+        if (isBitcodeFile(p))
+            bitcodeFiles.push_back(p);
+        else
+            args.push_back(p);
     }
 
     // output filename
@@ -300,6 +438,26 @@ int linkObjToBinary(bool sharedLib)
         }
     }
 
+    std::string ltoObj;
+    if (!bitcodeFiles.empty())
+    {
+        // Native D objects and libraries may refer to any D symbol of the
+        // program, e.g. a module compiled without -O4, or a library that
+        // instantiates templates with types of the program. Nothing can be
+        // internalized then, nor in a shared library. Native D libraries
+        // given with -L-l cannot be told apart from C libraries, they need
+        // -lto-internalize=false.
+        size_t nativeInputs = global.params.objfiles->dim - bitcodeFiles.size() +
+                              global.params.libfiles->dim;
+        bool internalize = ltoInternalize && !sharedLib && nativeInputs == 0;
+        if (!internalize)
+            Logger::println("Not internalizing, %u native inputs", (unsigned)nativeInputs);
+
+        ltoObj = output + "-lto." + global.obj_ext;
+        linkBitcodeProgram(bitcodeFiles, internalize, ltoObj);
+        args.push_back(ltoObj.c_str());
+    }
+
     // additional linker switches
     for (unsigned i = 0; i < global.params.linkswitches->dim; i++)
     {
@@ -382,7 +540,12 @@ int linkObjToBinary(bool sharedLib)
     args.push_back(NULL);
 
     // try to call linker
-    if (int status = llvm::sys::Program::ExecuteAndWait(gcc, &args[0], NULL, NULL, 0,0, &errstr))
+    int status = llvm::sys::Program::ExecuteAndWait(gcc, &args[0], NULL, NULL, 0,0, &errstr);
+
+    if (!ltoObj.empty())
+        llvm::sys::Path(ltoObj).eraseFromDisk();
+
+    if (status)
     {
         error("linking failed:\nstatus: %d", status);
         if (!errstr.empty())
@@ -7,6 +7,7 @@
 #include "llvm/LinkAllVMCore.h"
 #include "llvm/Linker.h"
 #include "llvm/LLVMContext.h"
+#include "llvm/Pass.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Support/TargetSelect.h"
@@ -20,6 +21,7 @@
 
 #include "rmem.h"
 #include "root.h"
+#include "async.h"
 
 #include "mars.h"
 #include "module.h"
@@ -27,9 +29,11 @@
 #include "id.h"
 #include "cond.h"
 #include "json.h"
+#include "template.h"
 
 #include "gen/logger.h"
 #include "gen/linkage.h"
+#include "gen/llvmhelpers.h"
 #include "gen/irstate.h"
 #include "gen/optimizer.h"
 #include "gen/metadata.h"
@@ -40,11 +44,13 @@
 #include "gen/cl_helpers.h"
 using namespace opts;
 
+#include "driver/cache.h"
 #include "driver/configfile.h"
 #include "driver/toobj.h"
 
 #if POSIX
 #include <errno.h>
+#include <sys/resource.h>
 #elif _WIN32
 #include <windows.h>
 #endif
@@ -242,6 +248,11 @@ int main(int argc, char** argv)
     global.params.doHdrGeneration |=
         global.params.hdrdir || global.params.hdrname;
 
+    initFromString(global.params.cacheDir, cacheDir);
+    initFromString(global.params.moduleMapFile, moduleMapFile);
+    if (global.params.cacheDir)
+        ObjCache::init(final_args);
+
     initFromString(global.params.moduleDepsFile, moduleDepsFile);
     if (global.params.moduleDepsFile != NULL)
     {
@@ -591,6 +602,10 @@ LDC_TARGETS
         VersionCondition::addPredefinedGlobalIdent("D_LP64");
     }
 
+    // the vtbl layout differs, see -class-display
+    if (global.params.useClassDisplay)
+        VersionCondition::addPredefinedGlobalIdent("LDC_ClassDisplay");
+
     // parse the OS out of the target triple
     // see http://gcc.gnu.org/install/specific.html for details
     // also llvm's different SubTargets have useful information
@@ -828,8 +843,18 @@ LDC_TARGETS
         modules.push(m);
     }
 
-    // Read files, parse them
+    if (global.params.moduleMapFile)
+        Module::readModuleMap();
+
+    // Read files on a background thread, parse them as they come in.
+    // Once a module is parsed, its imports are read ahead as well.
+    AsyncRead *aw = AsyncRead::create(modules.dim);
     for (unsigned i = 0; i < modules.dim; i++)
+        aw->addFile(((Module *)modules.data[i])->srcfile);
+    aw->start();
+
+    unsigned filecount = modules.dim;
+    for (unsigned filei = 0, i = 0; filei < filecount; filei++, i++)
     {
         m = (Module *)modules.data[i];
         if (global.params.verbose)
@@ -837,8 +862,10 @@ LDC_TARGETS
         if (!Module::rootModule)
             Module::rootModule = m;
         m->importedFrom = m;
-        m->read(0);
+        if (aw->read(filei))
+            m->read(0);     // try again to report the error
         m->parse(global.params.doDocComments);
+        m->readAheadImports();
         m->buildTargetFiles(singleObj);
         m->deleteObjFile();
         if (m->isDocFile)
@@ -850,6 +877,7 @@ LDC_TARGETS
             i--;
         }
     }
+    AsyncRead::dispose(aw);
     if (global.errors)
         fatal();
 
@@ -932,9 +960,12 @@ LDC_TARGETS
     // This doesn't play nice with debug info at the moment
     if (!global.params.symdebug && willInline())
     {
+        // Only the bodies of small imported functions that are called are
+        // analyzed.
         global.params.useAvailableExternally = true;
-        Logger::println("Running some extra semantic3's for inlining purposes");
+        analyzeImportedFunctions();
 #endif
+#if !IN_LLVM
         {
             // Do pass 3 semantic analysis on all imported modules,
             // since otherwise functions in them cannot be inlined
@@ -950,7 +981,6 @@ LDC_TARGETS
                 fatal();
         }
 
-#if !IN_LLVM
         for (int i = 0; i < modules.dim; i++)
         {
             m = (Module *)modules.data[i];
@@ -963,6 +993,13 @@ LDC_TARGETS
     if (global.errors || global.warnings)
         fatal();
 
+    if (global.params.moduleMapFile)
+        Module::writeModuleMap();
+
+    if (global.params.verbose)
+        printf("templates %u instance lookups, %u instances compared\n",
+            TemplateDeclaration::instanceLookups, TemplateDeclaration::instanceCompares);
+
     // write module dependencies to file if requested
     if (global.params.moduleDepsFile != NULL)
     {
@@ -978,6 +1015,34 @@ LDC_TARGETS
     std::vector<llvm::Module*> llvmModules;
     llvm::LLVMContext& context = llvm::getGlobalContext();
 
+    // The frontend and the IR generator share lots of global state, so
+    // genLLVMModule always runs on this thread. With -j, the optimizer and
+    // object emission are handed off to worker threads instead. The logger
+    // and the pass timers are not thread-safe, so -vv and -time-passes imply
+    // a serial build.
+    // With -singleobj, the program is still optimized as a whole, only the
+    // machine code generation is split up. This produces several object
+    // files, so it is only done if we are going to link them anyway, and
+    // pointless if they are bitcode to be merged again at link time.
+    bool splitSingleObj = singleObj && global.params.output_o &&
+        (global.params.link || createStaticLib) && (!doLTO() || createStaticLib);
+    ObjectWriterPool* writerPool = NULL;
+    if (codegenThreads > 1 && global.params.obj && (!singleObj || splitSingleObj) &&
+        !Logger::enabled() && !llvm::TimePassesIsEnabled)
+    {
+        writerPool = new ObjectWriterPool(codegenThreads, theTarget,
+                                          triple, mCPU, FeaturesStr);
+    }
+
+    // Only plain object files are cached. If this is the only root module,
+    // the key can be computed from the sources and codegen is skipped on a
+    // hit. Otherwise, template instances might be emitted into a different
+    // root module in the next build, so the generated IR is used as key.
+    bool useCache = global.params.cacheDir && !singleObj &&
+        global.params.output_o && !global.params.output_bc &&
+        !global.params.output_ll && !global.params.output_s;
+    std::vector<std::pair<std::string, char*> > cacheMisses;
+
     // Generate output files
     for (unsigned i = 0; i < modules.dim; i++)
     {
@@ -986,16 +1051,43 @@ LDC_TARGETS
             printf("code      %s\n", m->toChars());
         if (global.params.obj)
         {
-            llvm::Module* lm = m->genLLVMModule(context, &ir);
-            if (!singleObj)
+            char* objfile = m->objfile->name->str;
+            std::string cacheKey;
+            if (useCache && modules.dim == 1)
+                cacheKey = ObjCache::sourceKey(m);
+
+            if (!cacheKey.empty() && ObjCache::fetch(cacheKey, objfile))
             {
-                m->deleteObjFile();
-                writeModule(lm, m->objfile->name->str);
-                global.params.objfiles->push(m->objfile->name->str);
-                delete lm;
+                global.params.objfiles->push(objfile);
             }
             else
-                llvmModules.push_back(lm);
+            {
+                llvm::Module* lm = m->genLLVMModule(context, &ir);
+                if (!singleObj)
+                {
+                    bool cached = false;
+                    if (useCache && cacheKey.empty())
+                    {
+                        cacheKey = ObjCache::irKey(lm);
+                        cached = ObjCache::fetch(cacheKey, objfile);
+                    }
+
+                    if (!cached)
+                    {
+                        m->deleteObjFile();
+                        if (writerPool)
+                            writerPool->add(lm, objfile);
+                        else
+                            writeModule(lm, objfile);
+                        if (useCache)
+                            cacheMisses.push_back(std::make_pair(cacheKey, objfile));
+                    }
+                    global.params.objfiles->push(objfile);
+                    delete lm;
+                }
+                else
+                    llvmModules.push_back(lm);
+            }
         }
         if (global.errors)
             m->deleteObjFile();
@@ -1006,6 +1098,13 @@ LDC_TARGETS
         }
     }
 
+    if (global.params.verbose && global.params.useAvailableExternally)
+        printf("inlining  %u imported functions analyzed, %u skipped\n",
+            lazySemantic3Analyzed, lazySemantic3Skipped);
+    if (global.params.verbose)
+        printf("arrays    %u reallocs, %lu bytes moved\n",
+            Array::numReallocs, (unsigned long)Array::reallocBytes);
+
     // internal linking for singleobj
     if (singleObj && llvmModules.size() > 0)
     {
@@ -1024,10 +1123,40 @@ LDC_TARGETS
         }
 
         m->deleteObjFile();
-        writeModule(linker.getModule(), filename);
-        global.params.objfiles->push(filename);
+        llvm::Module* linked = linker.getModule();
+        if (writerPool)
+        {
+            optimizeModule(linked);
+            writeModuleFiles(linked, filename, *gTargetMachine, false);
+            if (!writePartitionedModule(linked, filename, codegenThreads,
+                                        *writerPool, global.params.objfiles))
+            {
+                writeObjectFile(linked, filename, *gTargetMachine);
+                global.params.objfiles->push(filename);
+            }
+        }
+        else
+        {
+            writeModule(linked, filename);
+            global.params.objfiles->push(filename);
+        }
     }
 
+    if (writerPool)
+    {
+        writerPool->finish();
+        delete writerPool;
+    }
+
+    // the objects are complete now, add them to the cache
+    if (!global.errors)
+    {
+        for (size_t i = 0; i < cacheMisses.size(); i++)
+            ObjCache::store(cacheMisses[i].first, cacheMisses[i].second);
+    }
+    if (useCache)
+        ObjCache::printStatistics();
+
     // output json file
     if (global.params.doXGeneration)
         json_generate(&modules);
@@ -1036,6 +1165,22 @@ LDC_TARGETS
     if (global.errors)
         fatal();
 
+    if (global.params.verbose)
+    {
+        printf("memory    %lu KB object arena", (unsigned long)(mem.arenaReserved() / 1024));
+#if POSIX
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+#if __APPLE__
+            usage.ru_maxrss /= 1024;    // bytes, not KB
+#endif
+            printf(", %lu KB peak RSS", (unsigned long)usage.ru_maxrss);
+        }
+#endif
+        printf("\n");
+    }
+
     if (!global.params.objfiles->dim)
     {
         if (global.params.link)
@@ -0,0 +1,208 @@
+#include "driver/partition.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include "gen/logger.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace llvm;
+
+typedef DenseMap<const GlobalValue*, unsigned> OwnerMap;
+
+//////////////////////////////////////////////////////////////////////////////
+
+static unsigned functionSize(const Function& f)
+{
+    unsigned size = 0;
+    for (Function::const_iterator bb = f.begin(), e = f.end(); bb != e; ++bb)
+        size += bb->size();
+    return size;
+}
+
+// Definitions that need to be emitted in exactly one partition.
+static bool isPartitioned(const GlobalValue* gv)
+{
+    return !gv->isDeclaration()
+        && !gv->hasAvailableExternallyLinkage()
+        && !gv->hasAppendingLinkage();
+}
+
+// Adds the partitions referencing v to users. Uses from constant expressions
+// and aggregate initializers are followed to the global they end up in.
+static void collectUserPartitions(const Value* v, const OwnerMap& owners,
+    SmallVectorImpl<unsigned>& users, SmallPtrSet<const Value*, 8>& visited)
+{
+    for (Value::const_use_iterator I = v->use_begin(), E = v->use_end(); I != E; ++I)
+    {
+        const User* u = *I;
+        const GlobalValue* gv = 0;
+
+        if (const Instruction* inst = dyn_cast<Instruction>(u))
+            gv = inst->getParent()->getParent();
+        else if (const GlobalValue* ugv = dyn_cast<GlobalValue>(u))
+            gv = ugv;
+        else if (isa<Constant>(u) && visited.insert(u))
+            collectUserPartitions(u, owners, users, visited);
+
+        if (gv)
+        {
+            OwnerMap::const_iterator it = owners.find(gv);
+            if (it != owners.end())
+                users.push_back(it->second);
+        }
+    }
+}
+
+namespace {
+    struct LargerFirst {
+        bool operator()(const std::pair<unsigned, Function*>& a,
+                        const std::pair<unsigned, Function*>& b) const {
+            return a.first > b.first;
+        }
+    };
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool splitModule(Module* m, unsigned nparts, const std::string& symbolSuffix,
+                 std::vector<Module*>& parts)
+{
+    // Aliases would have to be kept together with their aliasee, which is
+    // not worth the trouble as we never emit them ourselves.
+    if (nparts < 2 || !m->alias_empty())
+        return false;
+
+    // Hand out the functions, largest first, always to the partition with
+    // the least amount of code so far.
+    std::vector<std::pair<unsigned, Function*> > funcs;
+    for (Module::iterator I = m->begin(), E = m->end(); I != E; ++I)
+    {
+        if (isPartitioned(I))
+            funcs.push_back(std::make_pair(functionSize(*I), &*I));
+    }
+    if (funcs.size() < nparts)
+        return false;
+    std::stable_sort(funcs.begin(), funcs.end(), LargerFirst());
+
+    Logger::println("Splitting module '%s' into %u partitions",
+        m->getModuleIdentifier().c_str(), nparts);
+    LOG_SCOPE;
+
+    OwnerMap owners;
+    std::vector<unsigned> load(nparts, 0);
+    for (size_t i = 0; i < funcs.size(); i++)
+    {
+        unsigned p = std::min_element(load.begin(), load.end()) - load.begin();
+        owners[funcs[i].second] = p;
+        load[p] += funcs[i].first;
+    }
+
+    // Global variables go to the partition of the first function referencing
+    // them, so that e.g. string literals end up next to their users. The
+    // magic appending arrays (llvm.global_ctors) stay in the first one.
+    for (Module::global_iterator I = m->global_begin(), E = m->global_end(); I != E; ++I)
+    {
+        if (I->hasAppendingLinkage())
+        {
+            owners[I] = 0;
+            continue;
+        }
+        if (!isPartitioned(I))
+            continue;
+
+        SmallVector<unsigned, 4> users;
+        SmallPtrSet<const Value*, 8> visited;
+        collectUserPartitions(I, owners, users, visited);
+        owners[I] = users.empty() ? 0 : users[0];
+    }
+
+    // Internal symbols used from another partition need to become visible
+    // to the linker. Keep them hidden and give them a name unique to this
+    // output file, so they cannot clash with anything else.
+    unsigned npromoted = 0;
+    for (OwnerMap::iterator I = owners.begin(), E = owners.end(); I != E; ++I)
+    {
+        GlobalValue* gv = const_cast<GlobalValue*>(I->first);
+        if (!gv->hasLocalLinkage())
+            continue;
+
+        SmallVector<unsigned, 4> users;
+        SmallPtrSet<const Value*, 8> visited;
+        collectUserPartitions(gv, owners, users, visited);
+
+        bool shared = false;
+        for (size_t i = 0; i < users.size(); i++)
+            shared |= users[i] != I->second;
+        if (!shared)
+            continue;
+
+        std::string name = gv->getName().str() + symbolSuffix;
+        gv->setName(name);
+        gv->setLinkage(GlobalValue::ExternalLinkage);
+        gv->setVisibility(GlobalValue::HiddenVisibility);
+        ++npromoted;
+    }
+    Logger::println("Promoted %u internal symbols", npromoted);
+
+    for (unsigned p = 0; p < nparts; p++)
+    {
+        ValueToValueMapTy vmap;
+        Module* part = CloneModule(m, vmap);
+
+        for (OwnerMap::iterator I = owners.begin(), E = owners.end(); I != E; ++I)
+        {
+            Value* v = vmap[I->first];
+            GlobalValue* gv = cast<GlobalValue>(v);
+
+            if (gv->hasAppendingLinkage())
+            {
+                if (p != 0)
+                    gv->eraseFromParent();
+                continue;
+            }
+
+            if (I->second == p)
+            {
+                // The other partitions rely on this definition being emitted.
+                if (gv->getLinkage() == GlobalValue::LinkOnceODRLinkage)
+                    gv->setLinkage(GlobalValue::WeakODRLinkage);
+                else if (gv->getLinkage() == GlobalValue::LinkOnceAnyLinkage)
+                    gv->setLinkage(GlobalValue::WeakAnyLinkage);
+                continue;
+            }
+
+            if (Function* f = dyn_cast<Function>(gv))
+                f->deleteBody();
+            else
+                cast<GlobalVariable>(gv)->setInitializer(0);
+            gv->setLinkage(GlobalValue::ExternalLinkage);
+        }
+
+        if (p != 0)
+            part->setModuleInlineAsm("");
+
+        // Get rid of everything the partition does not reference anymore,
+        // most notably the declarations of unpromoted internal symbols.
+        PassManager pm;
+        pm.add(createGlobalDCEPass());
+        pm.run(*part);
+
+        Logger::println("Partition %u: %u instructions", p, load[p]);
+        parts.push_back(part);
+    }
+
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef LDC_DRIVER_PARTITION_H
+#define LDC_DRIVER_PARTITION_H
+
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+    class Module;
+}
+
+/**
+ * Splits a whole-program module into code generation partitions.
+ *
+ * Every function and global variable definition in m is assigned to exactly
+ * one partition; the other partitions only get a declaration. Internal
+ * symbols that end up being referenced across partitions are promoted to
+ * hidden external symbols, with symbolSuffix appended to their name.
+ *
+ * m is modified (symbol promotion) but not consumed, the partitions are
+ * returned as new modules in parts.
+ *
+ * @return false if m cannot be or is not worth being split, in which case
+ * neither m nor parts are touched.
+ */
+bool splitModule(llvm::Module* m, unsigned nparts, const std::string& symbolSuffix,
+                 std::vector<llvm::Module*>& parts);
+
+#endif
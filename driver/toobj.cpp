@@ -7,30 +7,93 @@
 // in artistic.txt, or the GNU General Public License in gnu.txt.
 // See the included readme.txt for details.
 
+#include <cassert>
+#include <cstdarg>
 #include <cstddef>
+#include <cstdio>
 #include <fstream>
+#include <vector>
 
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/PassManager.h"
 #include "llvm/Support/Program.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Target/TargetMachine.h"
 
+#if POSIX
+#include <pthread.h>
+#endif
+
+#include "rmem.h"
+
 #include "gen/irstate.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
+#include "driver/cl_options.h"
+#include "driver/partition.h"
+#include "driver/toobj.h"
 
 
 // fwd decl
 void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_fd_ostream& Out,
                llvm::TargetMachine::CodeGenFileType fileType);
 
+#if POSIX
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+// Set while an ObjectWriterPool worker writes its modules. error() and
+// fatal() update global state and exit the process, so the workers only
+// record their errors, and ObjectWriterPool::finish() reports them.
+static THREAD_LOCAL std::vector<std::string>* workerErrors;
+
+// Reports an error while writing a module. This is fatal, except on
+// ObjectWriterPool workers, where it returns false.
+static bool writeError(const char* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+    std::vector<char> msg(len > 0 ? len + 1 : 1);
+    va_start(ap, format);
+    vsnprintf(&msg[0], msg.size(), format, ap);
+    va_end(ap);
+
+    if (!workerErrors)
+    {
+        error("%s", &msg[0]);
+        fatal();
+    }
+    workerErrors->push_back(&msg[0]);
+    return false;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 
-void writeModule(llvm::Module* m, std::string filename)
+bool writeModule(llvm::Module* m, std::string filename)
+{
+    return writeModule(m, filename, *gTargetMachine);
+}
+
+bool writeModule(llvm::Module* m, std::string filename, llvm::TargetMachine& target)
+{
+    return optimizeModule(m) && writeModuleFiles(m, filename, target, true);
+}
+
+bool optimizeModule(llvm::Module* m)
 {
     // run optimizer
     bool reverify = ldc_optimize_module(m);
@@ -42,14 +105,18 @@ void writeModule(llvm::Module* m, std::string filename)
         LOG_SCOPE;
         if (llvm::verifyModule(*m,llvm::ReturnStatusAction,&verifyErr))
         {
-            error("%s", verifyErr.c_str());
-            fatal();
+            return writeError("%s", verifyErr.c_str());
         }
         else {
             Logger::println("Verification passed!");
         }
     }
+    return true;
+}
 
+bool writeModuleFiles(llvm::Module* m, std::string filename, llvm::TargetMachine& target,
+                      bool writeObj)
+{
     // eventually do our own path stuff, dmd's is a bit strange.
     typedef llvm::sys::Path LLPath;
 
@@ -62,10 +129,7 @@ void writeModule(llvm::Module* m, std::string filename)
         std::string errinfo;
         llvm::raw_fd_ostream bos(bcpath.c_str(), errinfo, llvm::raw_fd_ostream::F_Binary);
         if (bos.has_error())
-        {
-            error("cannot write LLVM bitcode file '%s': %s", bcpath.c_str(), errinfo.c_str());
-            fatal();
-        }
+            return writeError("cannot write LLVM bitcode file '%s': %s", bcpath.c_str(), errinfo.c_str());
         llvm::WriteBitcodeToFile(m, bos);
     }
 
@@ -78,10 +142,7 @@ void writeModule(llvm::Module* m, std::string filename)
         std::string errinfo;
         llvm::raw_fd_ostream aos(llpath.c_str(), errinfo);
         if (aos.has_error())
-        {
-            error("cannot write LLVM asm file '%s': %s", llpath.c_str(), errinfo.c_str());
-            fatal();
-        }
+            return writeError("cannot write LLVM asm file '%s': %s", llpath.c_str(), errinfo.c_str());
         m->print(aos, NULL);
     }
 
@@ -96,33 +157,52 @@ void writeModule(llvm::Module* m, std::string filename)
             llvm::raw_fd_ostream out(spath.c_str(), err);
             if (err.empty())
             {
-                emit_file(*gTargetMachine, *m, out, llvm::TargetMachine::CGFT_AssemblyFile);
+                emit_file(target, *m, out, llvm::TargetMachine::CGFT_AssemblyFile);
             }
             else
             {
-                error("cannot write native asm: %s", err.c_str());
-                fatal();
+                return writeError("cannot write native asm: %s", err.c_str());
             }
         }
     }
 
-    if (global.params.output_o) {
-        LLPath objpath = LLPath(filename);
-        Logger::println("Writing object file to: %s\n", objpath.c_str());
-        std::string err;
+    if (global.params.output_o && writeObj)
+        return writeObjectFile(m, filename, target);
+    return true;
+}
+
+bool writeObjectFile(llvm::Module* m, std::string filename, llvm::TargetMachine& target)
+{
+    // Static libraries are handed to the system linker as they are, so they
+    // always get native code.
+    if (!doLTO() || opts::createStaticLib)
+        return emitNativeObjectFile(m, filename, target);
+
+    Logger::println("Writing bitcode object file to: %s\n", filename.c_str());
+    std::string err;
+    llvm::raw_fd_ostream out(filename.c_str(), err, llvm::raw_fd_ostream::F_Binary);
+    if (!err.empty())
+        return writeError("cannot write object file: %s", err.c_str());
+    llvm::WriteBitcodeToFile(m, out);
+    return true;
+}
+
+bool emitNativeObjectFile(llvm::Module* m, std::string filename, llvm::TargetMachine& target)
+{
+    Logger::println("Writing object file to: %s\n", filename.c_str());
+    std::string err;
+    {
+        llvm::raw_fd_ostream out(filename.c_str(), err, llvm::raw_fd_ostream::F_Binary);
+        if (err.empty())
         {
-            llvm::raw_fd_ostream out(objpath.c_str(), err, llvm::raw_fd_ostream::F_Binary);
-            if (err.empty())
-            {
-                emit_file(*gTargetMachine, *m, out, llvm::TargetMachine::CGFT_ObjectFile);
-            }
-            else
-            {
-                error("cannot write object file: %s", err.c_str());
-                fatal();
-            }
+            emit_file(target, *m, out, llvm::TargetMachine::CGFT_ObjectFile);
+        }
+        else
+        {
+            return writeError("cannot write object file: %s", err.c_str());
         }
     }
+    return true;
 }
 
 /* ================================================================== */
@@ -162,8 +242,270 @@ void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_fd_ostrea
 
     Passes.doFinalization();
 
+    // See ldc_optimize_module().
+    if (TimePassesIsEnabled)
+    {
+        errs() << "Code generation of module '" << m.getModuleIdentifier() << "':\n";
+        TimerGroup::printAll(errs());
+    }
+
     // release module from module provider so we can delete it ourselves
     //std::string Err;
     //llvm::Module* rmod = Provider.releaseModule(&Err);
     //assert(rmod);
 }
+
+/* ================================================================== */
+
+struct ObjectWriterPool::Job
+{
+    std::string bitcode;
+    std::string filename;
+    bool optimize;
+};
+
+#if POSIX
+
+struct ObjectWriterPool::Impl
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::vector<pthread_t> threads;
+};
+
+ObjectWriterPool::ObjectWriterPool(unsigned nthreads, const llvm::Target* target,
+                                   const std::string& triple, const std::string& cpu,
+                                   const std::string& features)
+:   target(target), triple(triple), cpu(cpu), features(features),
+    closing(false), impl(new Impl)
+{
+    assert(nthreads > 0);
+
+    // LLVM only guards its global state (pass registry, managed statics)
+    // once it has been told that there are several threads around.
+    if (!llvm::llvm_start_multithreaded())
+    {
+        error("LLVM was built without thread support, cannot use -j");
+        fatal();
+    }
+
+    pthread_mutex_init(&impl->mutex, NULL);
+    pthread_cond_init(&impl->cond, NULL);
+
+    impl->threads.resize(nthreads);
+    for (unsigned i = 0; i < nthreads; i++)
+    {
+        int status = pthread_create(&impl->threads[i], NULL, &workerMain, this);
+        if (status != 0)
+        {
+            error("could not create code generation thread (%d)", status);
+            fatal();
+        }
+    }
+}
+
+ObjectWriterPool::~ObjectWriterPool()
+{
+    finish();
+    pthread_cond_destroy(&impl->cond);
+    pthread_mutex_destroy(&impl->mutex);
+    delete impl;
+}
+
+void ObjectWriterPool::add(llvm::Module* m, const std::string& filename, bool optimize)
+{
+    Job* job = new Job;
+    job->filename = filename;
+    job->optimize = optimize;
+    {
+        llvm::raw_string_ostream os(job->bitcode);
+        llvm::WriteBitcodeToFile(m, os);
+    }
+
+    pthread_mutex_lock(&impl->mutex);
+    jobs.push_back(job);
+    pthread_cond_signal(&impl->cond);
+    pthread_mutex_unlock(&impl->mutex);
+}
+
+void ObjectWriterPool::finish()
+{
+    pthread_mutex_lock(&impl->mutex);
+    closing = true;
+    pthread_cond_broadcast(&impl->cond);
+    pthread_mutex_unlock(&impl->mutex);
+
+    for (size_t i = 0; i < impl->threads.size(); i++)
+        pthread_join(impl->threads[i], NULL);
+    impl->threads.clear();
+
+    reportErrors();
+}
+
+void ObjectWriterPool::addErrors(const std::vector<std::string>& errs)
+{
+    pthread_mutex_lock(&impl->mutex);
+    errors.insert(errors.end(), errs.begin(), errs.end());
+    pthread_mutex_unlock(&impl->mutex);
+}
+
+ObjectWriterPool::Job* ObjectWriterPool::nextJob()
+{
+    pthread_mutex_lock(&impl->mutex);
+    while (jobs.empty() && !closing)
+        pthread_cond_wait(&impl->cond, &impl->mutex);
+
+    Job* job = NULL;
+    if (!jobs.empty())
+    {
+        job = jobs.front();
+        jobs.pop_front();
+    }
+    pthread_mutex_unlock(&impl->mutex);
+    return job;
+}
+
+#else // !POSIX
+
+// No thread support on this host, just write the modules one after another.
+
+struct ObjectWriterPool::Impl {};
+
+ObjectWriterPool::ObjectWriterPool(unsigned nthreads, const llvm::Target* target,
+                                   const std::string& triple, const std::string& cpu,
+                                   const std::string& features)
+:   target(target), triple(triple), cpu(cpu), features(features),
+    closing(false), impl(NULL)
+{
+}
+
+ObjectWriterPool::~ObjectWriterPool()
+{
+    finish();
+}
+
+void ObjectWriterPool::add(llvm::Module* m, const std::string& filename, bool optimize)
+{
+    Job* job = new Job;
+    job->filename = filename;
+    job->optimize = optimize;
+    {
+        llvm::raw_string_ostream os(job->bitcode);
+        llvm::WriteBitcodeToFile(m, os);
+    }
+    jobs.push_back(job);
+}
+
+void ObjectWriterPool::finish()
+{
+    if (closing)
+        return;
+    closing = true;
+    workerMain(this);
+    reportErrors();
+}
+
+void ObjectWriterPool::addErrors(const std::vector<std::string>& errs)
+{
+    errors.insert(errors.end(), errs.begin(), errs.end());
+}
+
+ObjectWriterPool::Job* ObjectWriterPool::nextJob()
+{
+    if (jobs.empty())
+        return NULL;
+    Job* job = jobs.front();
+    jobs.pop_front();
+    return job;
+}
+
+#endif // POSIX
+
+void ObjectWriterPool::reportErrors()
+{
+    if (errors.empty())
+        return;
+    for (size_t i = 0; i < errors.size(); i++)
+        error(Loc(), "%s", errors[i].c_str());
+    fatal();
+}
+
+llvm::TargetMachine* ObjectWriterPool::createTargetMachine()
+{
+    // Must match the target machine set up in main().
+    return target->createTargetMachine(triple, cpu, features,
+                                       opts::mRelocModel, opts::mCodeModel);
+}
+
+void* ObjectWriterPool::workerMain(void* p)
+{
+    ObjectWriterPool* pool = static_cast<ObjectWriterPool*>(p);
+
+    llvm::LLVMContext context;
+    llvm::TargetMachine* target = pool->createTargetMachine();
+
+    std::vector<std::string> errors;
+    workerErrors = &errors;
+
+    while (Job* job = pool->nextJob())
+    {
+        llvm::MemoryBuffer* buffer = llvm::MemoryBuffer::getMemBuffer(
+            job->bitcode, job->filename, false);
+        std::string errinfo;
+        llvm::Module* m = llvm::ParseBitcodeFile(buffer, context, &errinfo);
+        delete buffer;
+        if (!m)
+        {
+            writeError("cannot read back module for '%s': %s",
+                job->filename.c_str(), errinfo.c_str());
+        }
+        else
+        {
+            if (job->optimize)
+                writeModule(m, job->filename, *target);
+            else
+                writeObjectFile(m, job->filename, *target);
+            delete m;
+        }
+        delete job;
+    }
+
+    workerErrors = NULL;
+    if (!errors.empty())
+        pool->addErrors(errors);
+
+    delete target;
+    return NULL;
+}
+
+/* ================================================================== */
+
+bool writePartitionedModule(llvm::Module* m, std::string filename, unsigned nparts,
+                            ObjectWriterPool& pool, Strings* objfiles)
+{
+    // promoted symbols must not clash with those of another -singleobj
+    // object linked into the same binary
+    std::string suffix = ".part" + llvm::utohexstr(llvm::HashString(filename));
+
+    std::vector<llvm::Module*> parts;
+    if (!splitModule(m, nparts, suffix, parts))
+        return false;
+
+    typedef llvm::sys::Path LLPath;
+    for (unsigned i = 0; i < parts.size(); i++)
+    {
+        // the first partition keeps the requested file name
+        std::string partname = filename;
+        if (i != 0)
+        {
+            LLPath path(filename);
+            path.eraseSuffix();
+            partname = path.str() + "-part" + llvm::utostr(i) + "." + global.obj_ext;
+        }
+
+        pool.add(parts[i], partname, false);
+        objfiles->push(mem.strdup(partname.c_str()));
+        delete parts[i];
+    }
+    return true;
+}
@@ -1,6 +1,80 @@
 #ifndef LDC_GEN_TOOBJ_H
 #define LDC_GEN_TOOBJ_H
 
-void writeModule(llvm::Module* m, std::string filename);
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "root.h"
+
+namespace llvm {
+    class Module;
+    class Target;
+    class TargetMachine;
+}
+
+// Errors in these functions are fatal, except on ObjectWriterPool workers,
+// where they are recorded for the pool and false is returned.
+bool writeModule(llvm::Module* m, std::string filename);
+bool writeModule(llvm::Module* m, std::string filename, llvm::TargetMachine& target);
+
+// The two halves of writeModule(): running the optimizer (and verifier) on m,
+// and writing out all requested output files. The object file is only
+// written if writeObj is set. With -O4/-O5, object files contain bitcode
+// (see doLTO()), use emitNativeObjectFile() to force native code.
+bool optimizeModule(llvm::Module* m);
+bool writeModuleFiles(llvm::Module* m, std::string filename, llvm::TargetMachine& target,
+                      bool writeObj);
+bool writeObjectFile(llvm::Module* m, std::string filename, llvm::TargetMachine& target);
+bool emitNativeObjectFile(llvm::Module* m, std::string filename, llvm::TargetMachine& target);
+
+// Runs writeModule() (optimization and object emission) on a pool of worker
+// threads. LLVM contexts are not thread-safe, so each module is handed over
+// as in-memory bitcode and re-materialized in a context private to the worker,
+// which also owns its own TargetMachine.
+class ObjectWriterPool
+{
+public:
+    ObjectWriterPool(unsigned nthreads, const llvm::Target* target,
+                     const std::string& triple, const std::string& cpu,
+                     const std::string& features);
+    ~ObjectWriterPool();
+
+    // Queues m to be written to filename. m is serialized immediately and
+    // may be deleted by the caller once this returns. If optimize is false,
+    // m is assumed to be optimized already and only an object file is
+    // emitted.
+    void add(llvm::Module* m, const std::string& filename, bool optimize = true);
+
+    // Blocks until all queued modules have been written. Errors of the
+    // workers are reported then, and are fatal.
+    void finish();
+
+private:
+    struct Job;
+
+    static void* workerMain(void* pool);
+    Job* nextJob();
+    void addErrors(const std::vector<std::string>& errs);
+    void reportErrors();
+    llvm::TargetMachine* createTargetMachine();
+
+    const llvm::Target* target;
+    std::string triple, cpu, features;
+
+    std::deque<Job*> jobs;
+    bool closing;
+    std::vector<std::string> errors;    // recorded by the workers
+
+    struct Impl;
+    Impl* impl;
+};
+
+// Splits the already optimized, whole-program module m into nparts
+// partitions and emits one object file per partition on pool. The names of
+// the object files are appended to objfiles. Returns false (without touching
+// anything) if m cannot be partitioned.
+bool writePartitionedModule(llvm::Module* m, std::string filename, unsigned nparts,
+                            ObjectWriterPool& pool, Strings* objfiles);
 
 #endif
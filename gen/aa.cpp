@@ -1,4 +1,6 @@
 #include "gen/llvm.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/IRBuilder.h"
 
 #include "mtype.h"
 #include "module.h"
@@ -35,7 +37,161 @@ static LLValue* to_keyti(DValue* key)
 
 /////////////////////////////////////////////////////////////////////////////////////
 
-DValue* DtoAAIndex(Loc& loc, Type* type, DValue* aa, DValue* key, bool lvalue)
+#if DMDV2
+
+static llvm::cl::opt<bool> disableInlineAALookup("disable-inline-aa-lookup",
+    llvm::cl::desc("Always call the runtime for associative array lookups"),
+    llvm::cl::ZeroOrMore);
+
+// Whether lookups with keys of type t can be open-coded, see gen/aa.h for
+// the runtime data structures and hash functions this relies on.
+static bool isInlineAAKey(Type* t)
+{
+    switch (t->ty)
+    {
+    case Tint8: case Tuns8: case Tchar:
+    case Tint16: case Tuns16: case Twchar:
+    case Tint32: case Tuns32: case Tdchar:
+    case Tint64: case Tuns64:
+        return true;
+    case Tpointer:
+        // void* has its own TypeInfo with a different hash
+        return t->nextOf()->toBasetype()->ty != Tvoid;
+    default:
+        return false;
+    }
+}
+
+// Emits the key hash, matching TypeInfo.getHash() of the key type.
+static LLValue* DtoAAKeyHash(llvm::IRBuilder<>& b, Type* t, LLValue* key)
+{
+    LLType* hashTy = DtoSize_t();
+    switch (t->ty)
+    {
+    case Tint8: case Tint16:
+        return b.CreateSExt(key, hashTy);
+    case Tint64: case Tuns64: {
+        // the sum of both 32 bit halves, as uint
+        LLType* i32 = LLType::getInt32Ty(gIR->context());
+        LLValue* lo = b.CreateTrunc(key, i32);
+        LLValue* hi = b.CreateTrunc(b.CreateLShr(key, 32), i32);
+        return b.CreateZExtOrBitCast(b.CreateAdd(lo, hi), hashTy);
+    }
+    case Tpointer:
+        return b.CreatePtrToInt(key, hashTy);
+    default:
+        return b.CreateZExtOrBitCast(key, hashTy);
+    }
+}
+
+// Returns the function looking up a key of type keytype in an AA, or NULL if
+// lookups with such keys are not open-coded. The function takes the AA and
+// the key by value and returns a pointer to the value, or null, like _aaInX.
+static llvm::Function* getAALookupFunction(Type* keytype)
+{
+    keytype = keytype->toBasetype();
+    if (disableInlineAALookup || !isInlineAAKey(keytype))
+        return NULL;
+
+    std::string name = std::string(".ldc.aa.lookup.") + keytype->deco;
+    if (llvm::Function* fn = gIR->module->getFunction(name))
+        return fn;
+
+    LLType* voidPtrTy = getVoidPtrType();
+    LLType* keyTy = DtoType(keytype);
+    LLType* sizeTy = DtoSize_t();
+    std::vector<LLType*> params;
+    params.push_back(voidPtrTy);
+    params.push_back(keyTy);
+    LLFunctionType* fty = LLFunctionType::get(voidPtrTy, params, false);
+    llvm::Function* fn = llvm::Function::Create(fty, llvm::GlobalValue::InternalLinkage, name, gIR->module);
+    fn->addFnAttr(llvm::Attribute::NoUnwind);
+    fn->addFnAttr(llvm::Attribute::ReadOnly);
+
+    llvm::Function::arg_iterator args = fn->arg_begin();
+    LLValue* aa = args++;
+    LLValue* key = args;
+
+    llvm::LLVMContext& ctx = gIR->context();
+    llvm::BasicBlock* entrybb = llvm::BasicBlock::Create(ctx, "entry", fn);
+    llvm::BasicBlock* probebb = llvm::BasicBlock::Create(ctx, "probe", fn);
+    llvm::BasicBlock* loopbb = llvm::BasicBlock::Create(ctx, "loop", fn);
+    llvm::BasicBlock* hashbb = llvm::BasicBlock::Create(ctx, "hashmatch", fn);
+    llvm::BasicBlock* keybb = llvm::BasicBlock::Create(ctx, "keymatch", fn);
+    llvm::BasicBlock* nextbb = llvm::BasicBlock::Create(ctx, "next", fn);
+    llvm::BasicBlock* missbb = llvm::BasicBlock::Create(ctx, "miss", fn);
+
+    LLValue* null = LLConstant::getNullValue(voidPtrTy);
+    uint64_t sizeSize = getTypeStoreSize(sizeTy);
+    // the value follows the key, aligned like aaA.d's aligntsize() does:
+    // to 16 bytes for 64 bit targets, to size_t otherwise
+    uint64_t keyAlign = sizeSize == 8 ? 16 : sizeSize;
+    uint64_t keySize = (keytype->size() + keyAlign - 1) & ~(keyAlign - 1);
+    LLType* sizePtrTy = getPtrToType(sizeTy);
+    LLType* entryPtrPtrTy = getPtrToType(voidPtrTy);
+
+    // the AA and its bucket array may both be empty
+    llvm::IRBuilder<> b(entrybb);
+    b.CreateCondBr(b.CreateICmpEQ(aa, null), missbb, probebb);
+
+    b.SetInsertPoint(probebb);
+    LLValue* nbuckets = b.CreateLoad(b.CreateBitCast(aa, sizePtrTy), "nbuckets");
+    llvm::BasicBlock* hashingbb = llvm::BasicBlock::Create(ctx, "hash", fn, loopbb);
+    b.CreateCondBr(b.CreateICmpEQ(nbuckets, LLConstant::getNullValue(sizeTy)), missbb, hashingbb);
+
+    b.SetInsertPoint(hashingbb);
+    LLValue* hash = DtoAAKeyHash(b, keytype, key);
+    LLValue* buckets = b.CreateLoad(b.CreateBitCast(
+        b.CreateConstGEP1_64(aa, sizeSize), getPtrToType(entryPtrPtrTy)), "buckets");
+    LLValue* first = b.CreateLoad(b.CreateGEP(buckets, b.CreateURem(hash, nbuckets)), "first");
+    b.CreateBr(loopbb);
+
+    // walk the bucket's list, comparing the hashes first
+    b.SetInsertPoint(loopbb);
+    llvm::PHINode* e = b.CreatePHI(voidPtrTy, 2, "entry");
+    e->addIncoming(first, hashingbb);
+    b.CreateCondBr(b.CreateICmpEQ(e, null), missbb, hashbb);
+
+    b.SetInsertPoint(hashbb);
+    LLValue* ehash = b.CreateLoad(b.CreateConstGEP1_64(b.CreateBitCast(e, sizePtrTy), 1), "hash");
+    b.CreateCondBr(b.CreateICmpEQ(ehash, hash), keybb, nextbb);
+
+    b.SetInsertPoint(keybb);
+    LLValue* pkey = b.CreateConstGEP1_64(e, 2 * sizeSize);
+    LLValue* ekey = b.CreateLoad(b.CreateBitCast(pkey, getPtrToType(keyTy)), "key");
+    llvm::BasicBlock* foundbb = llvm::BasicBlock::Create(ctx, "found", fn, missbb);
+    b.CreateCondBr(b.CreateICmpEQ(ekey, key), foundbb, nextbb);
+
+    b.SetInsertPoint(nextbb);
+    LLValue* next = b.CreateLoad(b.CreateBitCast(e, entryPtrPtrTy), "next");
+    e->addIncoming(next, nextbb);
+    b.CreateBr(loopbb);
+
+    b.SetInsertPoint(foundbb);
+    b.CreateRet(b.CreateConstGEP1_64(pkey, keySize));
+
+    b.SetInsertPoint(missbb);
+    b.CreateRet(null);
+
+    return fn;
+}
+
+// Calls the lookup function returned by getAALookupFunction.
+static LLValue* DtoAALookup(llvm::Function* fn, LLValue* aaval, DValue* key)
+{
+    LLFunctionType* funcTy = fn->getFunctionType();
+    aaval = DtoBitCast(aaval, funcTy->getParamType(0));
+    LLValue* keyval = key->getRVal();
+    if (keyval->getType() != funcTy->getParamType(1))
+        keyval = DtoBitCast(keyval, funcTy->getParamType(1));
+    return gIR->ir->CreateCall2(fn, aaval, keyval, "aa.lookup");
+}
+
+#endif // DMDV2
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static LLValue* DtoAARuntimeIndex(Loc& loc, Type* type, DValue* aa, DValue* key, bool lvalue)
 {
     // D1:
     // call:
@@ -83,6 +239,41 @@ DValue* DtoAAIndex(Loc& loc, Type* type, DValue* aa, DValue* key, bool lvalue)
     } else {
         ret = gIR->CreateCallOrInvoke3(func, aaval, keyti, pkey, "aa.index").getInstruction();
     }
+    return ret;
+}
+
+DValue* DtoAAIndex(Loc& loc, Type* type, DValue* aa, DValue* key, bool lvalue)
+{
+    LLValue* ret;
+#if DMDV2
+    TypeAArray* aatype = (TypeAArray*)aa->type->toBasetype();
+    llvm::Function* lookup = getAALookupFunction(aatype->index);
+    if (lookup && !lvalue) {
+        ret = DtoAALookup(lookup, aa->getRVal(), key);
+    } else if (lookup) {
+        // only call into the runtime to insert the key if it is not there yet
+        LLValue* found = DtoAALookup(lookup, DtoLoad(aa->getLVal()), key);
+        llvm::BasicBlock* oldend = gIR->scopeend();
+        llvm::BasicBlock* lookupbb = gIR->scopebb();
+        llvm::BasicBlock* insertbb = llvm::BasicBlock::Create(gIR->context(), "aainsert", gIR->topfunc(), oldend);
+        llvm::BasicBlock* joinbb = llvm::BasicBlock::Create(gIR->context(), "aaindexend", gIR->topfunc(), oldend);
+
+        LLValue* nullval = LLConstant::getNullValue(found->getType());
+        gIR->ir->CreateCondBr(gIR->ir->CreateICmpNE(found, nullval), joinbb, insertbb);
+
+        gIR->scope() = IRScope(insertbb, joinbb);
+        LLValue* inserted = DtoBitCast(DtoAARuntimeIndex(loc, type, aa, key, true), found->getType());
+        insertbb = gIR->scopebb();
+        gIR->ir->CreateBr(joinbb);
+
+        gIR->scope() = IRScope(joinbb, oldend);
+        llvm::PHINode* phi = gIR->ir->CreatePHI(found->getType(), 2, "aa.index");
+        phi->addIncoming(found, lookupbb);
+        phi->addIncoming(inserted, insertbb);
+        ret = phi;
+    } else
+#endif
+    ret = DtoAARuntimeIndex(loc, type, aa, key, lvalue);
 
     // cast return value
     LLType* targettype = getPtrToType(DtoType(type));
@@ -146,6 +337,14 @@ DValue* DtoAAIn(Loc& loc, Type* type, DValue* aa, DValue* key)
     // call:
     // extern(C) void* _aaInX(AA aa*, TypeInfo keyti, void* pkey)
 
+#if DMDV2
+    TypeAArray* aatype = (TypeAArray*)aa->type->toBasetype();
+    if (llvm::Function* lookup = getAALookupFunction(aatype->index)) {
+        LLValue* ret = DtoAALookup(lookup, aa->getRVal(), key);
+        return new DImValue(type, DtoBitCast(ret, DtoType(type)));
+    }
+#endif
+
     // first get the runtime function
 #if DMDV2
     llvm::Function* func = LLVM_D_GetRuntimeFunction(gIR->module, "_aaInX");
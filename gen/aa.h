@@ -1,6 +1,23 @@
 #ifndef LDC_GEN_AA_H
 #define LDC_GEN_AA_H
 
+// For D2, lookups with integral and (non-void) pointer keys are open-coded
+// instead of calling _aaInX/_aaGetX. This relies on the layout of the
+// druntime (rt/aaA.d) data structures:
+//
+//   AA  = BB*
+//   BB  = { aaA*[] b; size_t nodes; TypeInfo keyti; aaA*[4] binit; }
+//   aaA = { aaA* next; hash_t hash; key; value; }
+//
+// where an entry lives in bucket b[hash % b.length], and the hash is what
+// TypeInfo.getHash() returns for the key type (the sign- or zero-extended
+// value, the sum of both halves for 64 bit integers, the address for
+// pointers).
+// The value follows the key at the offset aligntsize(key.sizeof), which
+// rounds the key size up to 16 bytes on 64 bit targets (D_LP64) and to
+// size_t.sizeof on all others.
+// Pass -disable-inline-aa-lookup to always call the runtime.
+
 DValue* DtoAAIndex(Loc& loc, Type* type, DValue* aa, DValue* key, bool lvalue);
 DValue* DtoAAIn(Loc& loc, Type* type, DValue* aa, DValue* key);
 DValue* DtoAARemove(Loc& loc, DValue* aa, DValue* key);
@@ -0,0 +1,427 @@
+// Vectorized array operations
+
+#include "gen/llvm.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/CommandLine.h"
+
+#include "declaration.h"
+#include "expression.h"
+#include "mtype.h"
+#include "statement.h"
+
+#include "gen/arrayop.h"
+#include "gen/arrays.h"
+#include "gen/dvalue.h"
+#include "gen/irstate.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/tollvm.h"
+#include "ir/irvar.h"
+
+#include <algorithm>
+#include <map>
+
+#if DMDV2
+
+static llvm::cl::opt<bool> disableVectorArrayOps("disable-vector-arrayops",
+    llvm::cl::desc("Use scalar loops for array operations like a[] = b[] + c[]"),
+    llvm::cl::ZeroOrMore);
+
+// The width of the vector registers of the usual targets (SSE, NEON, AltiVec).
+// The code generator splits or widens other vector sizes as needed.
+static const unsigned VectorBytes = 16;
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Emits the body of an array operation function from the expression the
+// frontend created it for. The leaves of the expression (slices and scalars)
+// map to the function parameters in the order established by
+// buildArrayIdent() and buildArrayLoop().
+class ArrayOpEmitter
+{
+public:
+    ArrayOpEmitter(FuncDeclaration* fd) : fd(fd), exp(fd->arrayOpExp) {}
+
+    bool analyze();
+    void emit();
+
+private:
+    bool isElementType(Type* t);
+    bool isArrayOfElements(Type* t);
+    bool analyzeOperand(Expression* e);
+    bool addLeaf(Expression* e);
+
+    LLValue* emitLoad(LLValue* ptr, LLValue* index, unsigned width);
+    void emitStore(LLValue* val, LLValue* ptr, LLValue* index, unsigned width);
+    LLValue* emitBinOp(TOK op, LLValue* l, LLValue* r);
+    LLValue* emitOperand(Expression* e, LLValue* index, unsigned width);
+    void emitLoop(LLValue* start, LLValue* end, unsigned width, const char* name);
+
+    FuncDeclaration* fd;
+    Expression* exp;
+    ReturnStatement* ret;
+    Type* elemtype;
+    LLType* elemTy;
+    unsigned vectorWidth;
+
+    // the leaves of exp, in parameter order
+    std::vector<Expression*> leaves;
+    std::map<Expression*, size_t> leafIndex;
+
+    // per parameter: the element pointer of slices, the value of scalars
+    // (and the value splatted to all vector elements)
+    std::vector<LLValue*> args;
+    std::vector<LLValue*> splats;
+};
+
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+bool ArrayOpEmitter::isElementType(Type* t)
+{
+    return t->toBasetype()->castMod(0)->equals(elemtype);
+}
+
+bool ArrayOpEmitter::isArrayOfElements(Type* t)
+{
+    t = t->toBasetype();
+    return (t->ty == Tarray || t->ty == Tsarray) && isElementType(t->nextOf());
+}
+
+bool ArrayOpEmitter::addLeaf(Expression* e)
+{
+    leaves.push_back(e);
+    return true;
+}
+
+// Must visit the operands in the same order as buildArrayIdent().
+bool ArrayOpEmitter::analyzeOperand(Expression* e)
+{
+    bool isArray = isArrayOfElements(e->type);
+    if (!isArray && !isElementType(e->type))
+        return false;
+
+    switch (e->op)
+    {
+    case TOKslice:
+        return isArray && addLeaf(e);
+
+    case TOKcast:
+        if (!isArray)
+            return addLeaf(e);
+        // a cast between slices of the same element type, e.g. from const
+        return isArrayOfElements(((CastExp*)e)->e1->type) && analyzeOperand(((CastExp*)e)->e1);
+
+    case TOKdiv:
+        if (!elemtype->isfloating())
+            return false;
+        // fall through
+    case TOKadd:
+    case TOKmin:
+    case TOKmul:
+        return analyzeOperand(((BinExp*)e)->e1) && analyzeOperand(((BinExp*)e)->e2);
+
+    case TOKxor:
+    case TOKand:
+    case TOKor:
+        return elemtype->isintegral() &&
+            analyzeOperand(((BinExp*)e)->e1) && analyzeOperand(((BinExp*)e)->e2);
+
+    case TOKneg:
+        return analyzeOperand(((UnaExp*)e)->e1);
+
+    case TOKtilde:
+        return elemtype->isintegral() && analyzeOperand(((UnaExp*)e)->e1);
+
+    case TOKmod:
+    case TOKpow:
+        // part of the array operation, but not vectorizable
+        return false;
+
+    default:
+        return !isArray && addLeaf(e);
+    }
+}
+
+bool ArrayOpEmitter::analyze()
+{
+    if (!exp)
+        return false;
+
+    TypeFunction* tf = (TypeFunction*)fd->type;
+    elemtype = tf->next->toBasetype()->nextOf()->toBasetype()->castMod(0);
+    switch (elemtype->ty)
+    {
+    case Tint8: case Tuns8:
+    case Tint16: case Tuns16:
+    case Tint32: case Tuns32:
+    case Tint64: case Tuns64:
+    case Tfloat32: case Tfloat64:
+        break;
+    default:
+        return false;
+    }
+    elemTy = DtoType(elemtype);
+    vectorWidth = VectorBytes / getTypePaddedSize(elemTy);
+
+    switch (exp->op)
+    {
+    case TOKassign:
+    case TOKaddass:
+    case TOKminass:
+    case TOKmulass:
+        break;
+    case TOKdivass:
+        if (!elemtype->isfloating())
+            return false;
+        break;
+    case TOKxorass:
+    case TOKandass:
+    case TOKorass:
+        if (!elemtype->isintegral())
+            return false;
+        break;
+    default:
+        return false;
+    }
+
+    // Assignments are visited right to left, so the destination ends up as
+    // the first parameter.
+    BinExp* be = (BinExp*)exp;
+    if (be->e1->op != TOKslice || !isArrayOfElements(be->e1->type) ||
+        !analyzeOperand(be->e2) || !addLeaf(be->e1))
+        return false;
+    std::reverse(leaves.begin(), leaves.end());
+
+    if (!fd->parameters || fd->parameters->dim != leaves.size())
+        return false;
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+        VarDeclaration* vd = ((Dsymbol*)fd->parameters->data[i])->isVarDeclaration();
+        bool isSlice = leaves[i]->op == TOKslice;
+        if (!vd || !vd->ir.irParam || isSlice != (vd->type->toBasetype()->ty == Tarray))
+            return false;
+        leafIndex[leaves[i]] = i;
+    }
+
+    // the body ends with 'return p0;'
+    CompoundStatement* cs = fd->fbody ? fd->fbody->isCompoundStatement() : NULL;
+    if (!cs || cs->statements->dim == 0)
+        return false;
+    Statement* last = (Statement*)cs->statements->data[cs->statements->dim - 1];
+    ret = last ? last->isReturnStatement() : NULL;
+    return ret != NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+LLValue* ArrayOpEmitter::emitLoad(LLValue* ptr, LLValue* index, unsigned width)
+{
+    ptr = DtoGEP1(ptr, index);
+    if (width == 1)
+        return DtoLoad(ptr);
+
+    ptr = DtoBitCast(ptr, getPtrToType(llvm::VectorType::get(elemTy, width)));
+    llvm::LoadInst* load = gIR->ir->CreateLoad(ptr);
+    load->setAlignment(getABITypeAlign(elemTy));
+    return load;
+}
+
+void ArrayOpEmitter::emitStore(LLValue* val, LLValue* ptr, LLValue* index, unsigned width)
+{
+    ptr = DtoGEP1(ptr, index);
+    if (width == 1)
+    {
+        DtoStore(val, ptr);
+        return;
+    }
+
+    ptr = DtoBitCast(ptr, getPtrToType(val->getType()));
+    llvm::StoreInst* store = gIR->ir->CreateStore(val, ptr);
+    store->setAlignment(getABITypeAlign(elemTy));
+}
+
+LLValue* ArrayOpEmitter::emitBinOp(TOK op, LLValue* l, LLValue* r)
+{
+    bool fp = elemtype->isfloating();
+    switch (op)
+    {
+    case TOKadd: case TOKaddass:
+        return fp ? gIR->ir->CreateFAdd(l, r, "tmp") : gIR->ir->CreateAdd(l, r, "tmp");
+    case TOKmin: case TOKminass:
+        return fp ? gIR->ir->CreateFSub(l, r, "tmp") : gIR->ir->CreateSub(l, r, "tmp");
+    case TOKmul: case TOKmulass:
+        return fp ? gIR->ir->CreateFMul(l, r, "tmp") : gIR->ir->CreateMul(l, r, "tmp");
+    case TOKdiv: case TOKdivass:
+        return gIR->ir->CreateFDiv(l, r, "tmp");
+    case TOKxor: case TOKxorass:
+        return gIR->ir->CreateXor(l, r, "tmp");
+    case TOKand: case TOKandass:
+        return gIR->ir->CreateAnd(l, r, "tmp");
+    case TOKor: case TOKorass:
+        return gIR->ir->CreateOr(l, r, "tmp");
+    default:
+        llvm_unreachable("unexpected array operation");
+    }
+}
+
+LLValue* ArrayOpEmitter::emitOperand(Expression* e, LLValue* index, unsigned width)
+{
+    std::map<Expression*, size_t>::iterator it = leafIndex.find(e);
+    if (it != leafIndex.end())
+    {
+        size_t i = it->second;
+        if (e->op == TOKslice)
+            return emitLoad(args[i], index, width);
+        return width == 1 ? args[i] : splats[i];
+    }
+
+    switch (e->op)
+    {
+    case TOKcast:
+        return emitOperand(((CastExp*)e)->e1, index, width);
+    case TOKneg: {
+        LLValue* val = emitOperand(((UnaExp*)e)->e1, index, width);
+        if (elemtype->isfloating())
+            return gIR->ir->CreateFNeg(val, "tmp");
+        return gIR->ir->CreateNeg(val, "tmp");
+    }
+    case TOKtilde:
+        return gIR->ir->CreateNot(emitOperand(((UnaExp*)e)->e1, index, width), "tmp");
+    default: {
+        BinExp* be = (BinExp*)e;
+        LLValue* l = emitOperand(be->e1, index, width);
+        LLValue* r = emitOperand(be->e2, index, width);
+        return emitBinOp(e->op, l, r);
+    }
+    }
+}
+
+// Emits 'for (i = start; i < end; i += width)' around the array operation.
+// end - start must be a multiple of width.
+void ArrayOpEmitter::emitLoop(LLValue* start, LLValue* end, unsigned width, const char* name)
+{
+    llvm::BasicBlock* entrybb = gIR->scopebb();
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    std::string prefix(name);
+    llvm::BasicBlock* condbb = llvm::BasicBlock::Create(gIR->context(), prefix + "cond", gIR->topfunc(), oldend);
+    llvm::BasicBlock* bodybb = llvm::BasicBlock::Create(gIR->context(), prefix + "body", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), prefix + "end", gIR->topfunc(), oldend);
+    gIR->ir->CreateBr(condbb);
+
+    gIR->scope() = IRScope(condbb, bodybb);
+    llvm::PHINode* i = gIR->ir->CreatePHI(DtoSize_t(), 2, "i");
+    i->addIncoming(start, entrybb);
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(i, end, "tmp"), bodybb, endbb);
+
+    gIR->scope() = IRScope(bodybb, endbb);
+    BinExp* be = (BinExp*)exp;
+    LLValue* val = emitOperand(be->e2, i, width);
+    if (exp->op != TOKassign)
+        val = emitBinOp(exp->op, emitLoad(args[0], i, width), val);
+    emitStore(val, args[0], i, width);
+    i->addIncoming(gIR->ir->CreateAdd(i, DtoConstSize_t(width), "tmp"), gIR->scopebb());
+    gIR->ir->CreateBr(condbb);
+
+    gIR->scope() = IRScope(endbb, oldend);
+}
+
+void ArrayOpEmitter::emit()
+{
+    Logger::println("emitting vectorized array operation %s", exp->toChars());
+    LOG_SCOPE;
+
+    // load the parameters
+    size_t n = leaves.size();
+    args.resize(n);
+    splats.resize(n);
+    std::vector<LLValue*> lengths;
+    LLType* vectorTy = llvm::VectorType::get(elemTy, vectorWidth);
+    LLValue* zeroMask = LLConstant::getNullValue(
+        llvm::VectorType::get(LLType::getInt32Ty(gIR->context()), vectorWidth));
+    for (size_t i = 0; i < n; i++)
+    {
+        VarDeclaration* vd = ((Dsymbol*)fd->parameters->data[i])->isVarDeclaration();
+        DVarValue* val = new DVarValue(vd->type, vd->ir.irParam->value);
+        if (leaves[i]->op == TOKslice)
+        {
+            lengths.push_back(DtoArrayLen(val));
+            args[i] = DtoArrayPtr(val);
+        }
+        else
+        {
+            args[i] = val->getRVal();
+            LLValue* vec = gIR->ir->CreateInsertElement(llvm::UndefValue::get(vectorTy),
+                args[i], DtoConstUint(0), "tmp");
+            splats[i] = gIR->ir->CreateShuffleVector(vec, llvm::UndefValue::get(vectorTy),
+                zeroMask, "splat");
+        }
+    }
+    LLValue* length = lengths[0];
+
+    // The frontend generated loop checks the bounds of each element access,
+    // keep it around for when the lengths do not match.
+    if (global.params.useArrayBounds && lengths.size() > 1)
+    {
+        LLValue* ok = NULL;
+        for (size_t i = 1; i < lengths.size(); i++)
+        {
+            LLValue* c = gIR->ir->CreateICmpUGE(lengths[i], length, "tmp");
+            ok = ok ? gIR->ir->CreateAnd(ok, c, "tmp") : c;
+        }
+
+        llvm::BasicBlock* oldend = gIR->scopeend();
+        llvm::BasicBlock* scalarbb = llvm::BasicBlock::Create(gIR->context(), "arrayop.scalar", gIR->topfunc(), oldend);
+        llvm::BasicBlock* vectorbb = llvm::BasicBlock::Create(gIR->context(), "arrayop.vector", gIR->topfunc(), oldend);
+        gIR->ir->CreateCondBr(ok, vectorbb, scalarbb);
+
+        gIR->scope() = IRScope(scalarbb, vectorbb);
+        fd->fbody->toIR(gIR);
+        // get rid of the block started after the return
+        llvm::BasicBlock* bb = gIR->scopebb();
+        if (bb->empty() && pred_begin(bb) == pred_end(bb))
+            bb->eraseFromParent();
+
+        gIR->scope() = IRScope(vectorbb, oldend);
+    }
+
+    // Handle single elements until the destination is aligned for vector
+    // stores, then whole vectors, then the remaining elements.
+    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(elemTy));
+    LLValue* addr = gIR->ir->CreatePtrToInt(args[0], DtoSize_t(), "tmp");
+    LLValue* misalign = gIR->ir->CreateAnd(gIR->ir->CreateNeg(addr, "tmp"),
+        DtoConstSize_t(VectorBytes - 1), "tmp");
+    LLValue* peel = gIR->ir->CreateUDiv(misalign, elemSize, "tmp");
+    peel = gIR->ir->CreateSelect(gIR->ir->CreateICmpULT(peel, length, "tmp"), peel, length, "peel");
+    emitLoop(DtoConstSize_t(0), peel, 1, "arrayop.pre");
+
+    LLValue* vectors = gIR->ir->CreateAnd(gIR->ir->CreateSub(length, peel, "tmp"),
+        DtoConstSize_t(~(uint64_t)(vectorWidth - 1)), "tmp");
+    LLValue* vectorEnd = gIR->ir->CreateAdd(peel, vectors, "vectorend");
+    emitLoop(peel, vectorEnd, vectorWidth, "arrayop.vector");
+    emitLoop(vectorEnd, length, 1, "arrayop.post");
+
+    ret->toIR(gIR);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+bool DtoVectorArrayOp(FuncDeclaration* fd)
+{
+    if (disableVectorArrayOps || fd->isArrayOp != 1)
+        return false;
+
+    ArrayOpEmitter emitter(fd);
+    if (!emitter.analyze())
+    {
+        Logger::println("cannot vectorize array operation %s", fd->toChars());
+        return false;
+    }
+    emitter.emit();
+    return true;
+}
+
+#endif // DMDV2
@@ -0,0 +1,15 @@
+#ifndef LDC_GEN_ARRAYOP_H
+#define LDC_GEN_ARRAYOP_H
+
+struct FuncDeclaration;
+
+#if DMDV2
+/// Emits the body of the array operation function fd (as synthesized by the
+/// frontend, see arrayop.c) as a loop over vectors of elements, followed by
+/// a scalar loop for the remaining elements. Returns false without emitting
+/// anything if the operation cannot be vectorized; the frontend generated
+/// body needs to be used instead then.
+bool DtoVectorArrayOp(FuncDeclaration* fd);
+#endif
+
+#endif // LDC_GEN_ARRAYOP_H
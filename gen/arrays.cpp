@@ -944,6 +944,97 @@ DSliceValue* DtoCatArrays(Type* type, Expression* exp1, Expression* exp2)
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+#if DMDV2
+
+// Whether t and elemtype are the same type, ignoring qualifiers, which do not
+// matter when copying the data.
+static bool isSameElementType(Type* t, Type* elemtype)
+{
+    return t->toBasetype()->castMod(0)->equals(elemtype->castMod(0));
+}
+
+// Whether e, an operand of a concatenation resulting in an array of elemtype
+// elements, is an array itself (as opposed to a single element).
+static bool isCatArrayOperand(Expression* e, Type* elemtype)
+{
+    Type* t = e->type->toBasetype();
+    return (t->ty == Tarray || t->ty == Tsarray) && isSameElementType(t->nextOf(), elemtype);
+}
+
+bool collectCatOperands(Type* arrayType, Expression* e, std::vector<Expression*>& ops)
+{
+    Type* elemtype = arrayType->toBasetype()->nextOf()->toBasetype();
+    if (elemtype->ty == Tvoid || arrayNeedsPostblit(arrayType))
+        return false;
+
+    if (e->op == TOKcat && isCatArrayOperand(e, elemtype))
+    {
+        CatExp* ce = (CatExp*)e;
+        return collectCatOperands(arrayType, ce->e1, ops) &&
+               collectCatOperands(arrayType, ce->e2, ops);
+    }
+
+    if (!isCatArrayOperand(e, elemtype) && !isSameElementType(e->type, elemtype))
+        return false;
+    ops.push_back(e);
+    return true;
+}
+
+void DtoCatAssignArrays(Loc& loc, DValue* arr, const std::vector<Expression*>& ops)
+{
+    Logger::println("DtoCatAssignArrays (%u operands)", (unsigned)ops.size());
+    LOG_SCOPE;
+
+    Type* arrayType = arr->getType()->toBasetype();
+    Type* elemtype = arrayType->nextOf()->toBasetype();
+    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(DtoType(elemtype)));
+
+    // Evaluate all operands first. The array operands might be slices of arr,
+    // so their length and pointer need to be loaded before it is grown.
+    std::vector<DValue*> vals;
+    std::vector<LLValue*> ptrs, lens;
+    LLValue* total = DtoConstSize_t(0);
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        DValue* val = ops[i]->toElem(gIR);
+        LLValue* len = DtoConstSize_t(1);
+        LLValue* ptr = NULL;
+        if (isCatArrayOperand(ops[i], elemtype))
+        {
+            len = DtoArrayLen(val);
+            ptr = DtoArrayPtr(val);
+        }
+        vals.push_back(val);
+        ptrs.push_back(ptr);
+        lens.push_back(len);
+        total = gIR->ir->CreateAdd(total, len, "appendLength");
+    }
+
+    // Grow the array just once, reusing its spare capacity if possible.
+    LLValue* oldLength = DtoArrayLen(arr);
+    LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_arrayappendcTX");
+    LLSmallVector<LLValue*,3> args;
+    args.push_back(DtoTypeInfoOf(arrayType));
+    args.push_back(DtoBitCast(arr->getLVal(), fn->getFunctionType()->getParamType(1)));
+    args.push_back(total);
+    gIR->CreateCallOrInvoke(fn, args, ".appendedArray");
+
+    // Copy the operands into place.
+    LLValue* dst = DtoGEP1(DtoArrayPtr(arr), oldLength, "appendDst");
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        if (ptrs[i])
+            DtoMemCpy(dst, ptrs[i], gIR->ir->CreateMul(lens[i], elemSize, "tmp"));
+        else
+            DtoAssign(loc, new DVarValue(arrayType->nextOf(), dst), vals[i]);
+        dst = DtoGEP1(dst, lens[i], "appendDst");
+    }
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
 #if DMDV1
 
 DSliceValue* DtoCatArrayElement(Type* type, Expression* exp1, Expression* exp2)
@@ -1095,11 +1186,175 @@ static LLValue* DtoArrayEqCmp_impl(Loc& loc, const char* func, DValue* l, DValue
     return call.getInstruction();
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+// Whether two elements of type t are equal iff their bits are.
+static bool isBitwiseEqualElement(Type* t)
+{
+    t = t->toBasetype();
+    if (t->ty == Tsarray)
+        return isBitwiseEqualElement(t->nextOf());
+    return t->isintegral() || t->ty == Tpointer;
+}
+
+// Whether arrays of t elements can be ordered without calling TypeInfo.compare.
+static bool isScalarOrderedElement(Type* t)
+{
+    t = t->toBasetype();
+    return t->isintegral() || t->ty == Tpointer;
+}
+
+// Casts l and r to dynamic arrays of the element type of l, and returns their
+// lengths and pointers.
+static void DtoArrayEqCmpOperands(Loc& loc, DValue* l, DValue* r,
+    LLValue*& llen, LLValue*& lptr, LLValue*& rlen, LLValue*& rptr)
+{
+    Type* commonType = l->getType()->toBasetype()->nextOf()->arrayOf();
+    l = DtoCastArray(loc, l, commonType);
+    r = DtoCastArray(loc, r, commonType);
+    llen = DtoArrayLen(l);
+    lptr = DtoArrayPtr(l);
+    rlen = DtoArrayLen(r);
+    rptr = DtoArrayPtr(r);
+}
+
+// Compares two arrays of bitwise comparable elements for equality. Returns
+// an i1.
+static LLValue* DtoArrayEqualsInline(Loc& loc, DValue* l, DValue* r)
+{
+    Logger::println("comparing arrays inline");
+    LOG_SCOPE;
+
+    LLValue *llen, *lptr, *rlen, *rptr;
+    DtoArrayEqCmpOperands(loc, l, r, llen, lptr, rlen, rptr);
+
+    // only compare the memory if the lengths match
+    LLValue* sameLength = gIR->ir->CreateICmpEQ(llen, rlen, "tmp");
+    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(lptr->getType()->getContainedType(0)));
+    LLValue* nbytes = gIR->ir->CreateMul(llen, elemSize, "tmp");
+    nbytes = gIR->ir->CreateSelect(sameLength, nbytes, DtoConstSize_t(0), "tmp");
+    LLValue* cmp = DtoMemCmp(lptr, rptr, nbytes);
+    LLValue* sameData = gIR->ir->CreateICmpEQ(cmp, DtoConstInt(0), "tmp");
+    return gIR->ir->CreateAnd(sameLength, sameData, "tmp");
+}
+
+// Returns a function ordering two arrays of scalars of type t, like _adCmp.
+// It takes the length and pointer of both arrays and returns an int less
+// than, equal to or greater than zero.
+static LLFunction* getArrayCompareFunction(Type* t)
+{
+    std::string name = std::string(".ldc.array.cmp.") + t->deco;
+    if (LLFunction* fn = gIR->module->getFunction(name))
+        return fn;
+
+    LLType* sizeTy = DtoSize_t();
+    LLType* elemTy = DtoType(t);
+    LLType* ptrTy = getPtrToType(elemTy);
+    LLType* intTy = LLType::getInt32Ty(gIR->context());
+    std::vector<LLType*> params;
+    params.push_back(sizeTy);
+    params.push_back(ptrTy);
+    params.push_back(sizeTy);
+    params.push_back(ptrTy);
+    LLFunctionType* fty = LLFunctionType::get(intTy, params, false);
+    LLFunction* fn = LLFunction::Create(fty, LLGlobalValue::InternalLinkage, name, gIR->module);
+    fn->addFnAttr(llvm::Attribute::NoUnwind);
+    fn->addFnAttr(llvm::Attribute::ReadOnly);
+
+    LLFunction::arg_iterator args = fn->arg_begin();
+    LLValue* llen = args++;
+    LLValue* lptr = args++;
+    LLValue* rlen = args++;
+    LLValue* rptr = args;
+
+    llvm::LLVMContext& ctx = gIR->context();
+    llvm::BasicBlock* entrybb = llvm::BasicBlock::Create(ctx, "entry", fn);
+    llvm::BasicBlock* loopbb = llvm::BasicBlock::Create(ctx, "loop", fn);
+    llvm::BasicBlock* bodybb = llvm::BasicBlock::Create(ctx, "body", fn);
+    llvm::BasicBlock* nextbb = llvm::BasicBlock::Create(ctx, "next", fn);
+    llvm::BasicBlock* differbb = llvm::BasicBlock::Create(ctx, "differ", fn);
+    llvm::BasicBlock* lengthsbb = llvm::BasicBlock::Create(ctx, "lengths", fn);
+
+    LLValue* minusOne = LLConstantInt::get(intTy, -1, true);
+    LLValue* one = LLConstantInt::get(intTy, 1);
+    bool isUnsigned = t->ty == Tpointer || t->isunsigned();
+
+    llvm::IRBuilder<> b(entrybb);
+    LLValue* shorter = b.CreateICmpULT(llen, rlen);
+    LLValue* minlen = b.CreateSelect(shorter, llen, rlen);
+    b.CreateBr(loopbb);
+
+    // find the first mismatch
+    b.SetInsertPoint(loopbb);
+    llvm::PHINode* i = b.CreatePHI(sizeTy, 2, "i");
+    i->addIncoming(LLConstant::getNullValue(sizeTy), entrybb);
+    b.CreateCondBr(b.CreateICmpEQ(i, minlen), lengthsbb, bodybb);
+
+    b.SetInsertPoint(bodybb);
+    LLValue* lval = b.CreateLoad(b.CreateGEP(lptr, i));
+    LLValue* rval = b.CreateLoad(b.CreateGEP(rptr, i));
+    b.CreateCondBr(b.CreateICmpEQ(lval, rval), nextbb, differbb);
+
+    b.SetInsertPoint(nextbb);
+    i->addIncoming(b.CreateAdd(i, LLConstantInt::get(sizeTy, 1)), nextbb);
+    b.CreateBr(loopbb);
+
+    b.SetInsertPoint(differbb);
+    LLValue* less = isUnsigned ? b.CreateICmpULT(lval, rval) : b.CreateICmpSLT(lval, rval);
+    b.CreateRet(b.CreateSelect(less, minusOne, one));
+
+    // all common elements are equal, the shorter array is less
+    b.SetInsertPoint(lengthsbb);
+    LLValue* longer = b.CreateICmpUGT(llen, rlen);
+    b.CreateRet(b.CreateSelect(shorter, minusOne,
+        b.CreateSelect(longer, one, LLConstant::getNullValue(intTy))));
+
+    return fn;
+}
+
+// Orders two arrays of scalars without going through TypeInfo. Returns an
+// int, like _adCmp.
+static LLValue* DtoArrayCompareInline(Loc& loc, DValue* l, DValue* r)
+{
+    Logger::println("ordering arrays inline");
+    LOG_SCOPE;
+
+    Type* t = l->getType()->toBasetype()->nextOf()->toBasetype();
+    LLValue *llen, *lptr, *rlen, *rptr;
+    DtoArrayEqCmpOperands(loc, l, r, llen, lptr, rlen, rptr);
+
+    if (getTypePaddedSize(DtoType(t)) != 1 || !t->isunsigned())
+    {
+        LLFunction* fn = getArrayCompareFunction(t);
+        LLType* ptrTy = fn->getFunctionType()->getParamType(1);
+        return gIR->ir->CreateCall4(fn, llen, DtoBitCast(lptr, ptrTy),
+                                    rlen, DtoBitCast(rptr, ptrTy), "tmp");
+    }
+
+    // bytes are ordered like memcmp does, the lengths decide if the common
+    // part is equal
+    LLValue* shorter = gIR->ir->CreateICmpULT(llen, rlen, "tmp");
+    LLValue* minlen = gIR->ir->CreateSelect(shorter, llen, rlen, "tmp");
+    LLValue* cmp = DtoMemCmp(lptr, rptr, minlen);
+    LLValue* lencmp = gIR->ir->CreateSelect(shorter, DtoConstInt(-1),
+        gIR->ir->CreateSelect(gIR->ir->CreateICmpUGT(llen, rlen, "tmp"),
+                              DtoConstInt(1), DtoConstInt(0), "tmp"), "tmp");
+    LLValue* sameData = gIR->ir->CreateICmpEQ(cmp, DtoConstInt(0), "tmp");
+    return gIR->ir->CreateSelect(sameData, lencmp, cmp, "tmp");
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 LLValue* DtoArrayEquals(Loc& loc, TOK op, DValue* l, DValue* r)
 {
-    LLValue* res = DtoArrayEqCmp_impl(loc, _adEq, l, r, true);
-    res = gIR->ir->CreateICmpNE(res, DtoConstInt(0), "tmp");
+    LLValue* res;
+    if (isBitwiseEqualElement(l->getType()->toBasetype()->nextOf()))
+    {
+        res = DtoArrayEqualsInline(loc, l, r);
+    }
+    else
+    {
+        res = DtoArrayEqCmp_impl(loc, _adEq, l, r, true);
+        res = gIR->ir->CreateICmpNE(res, DtoConstInt(0), "tmp");
+    }
     if (op == TOKnotequal)
         res = gIR->ir->CreateNot(res, "tmp");
 
@@ -1154,8 +1409,8 @@ LLValue* DtoArrayCompare(Loc& loc, TOK op, DValue* l, DValue* r)
     if (!skip)
     {
         Type* t = l->getType()->toBasetype()->nextOf()->toBasetype();
-        if (t->ty == Tchar)
-            res = DtoArrayEqCmp_impl(loc, "_adCmpChar", l, r, false);
+        if (isScalarOrderedElement(t))
+            res = DtoArrayCompareInline(loc, l, r);
         else
             res = DtoArrayEqCmp_impl(loc, _adCmp, l, r, true);
         res = gIR->ir->CreateICmp(cmpop, res, DtoConstInt(0), "tmp");
@@ -1401,10 +1656,19 @@ void DtoArrayBoundsCheck(Loc& loc, DValue* arr, DValue* index, DValue* lowerBoun
     // static arrays could get static checks for static indices
     // but shouldn't since it might be generic code that's never executed
 
-    // runtime check
-
     bool lengthUnknown = arrty->ty == Tpointer;
 
+    // no need for a runtime check either if the index is known to be in
+    // range (-dboundscheck removes the ones that become constant later)
+    if (arrty->ty == Tsarray && !lowerBound) {
+        llvm::ConstantInt* constIndex = llvm::dyn_cast<llvm::ConstantInt>(index->getRVal());
+        llvm::ConstantInt* constLength = llvm::dyn_cast<llvm::ConstantInt>(DtoArrayLen(arr));
+        if (constIndex && constLength && constIndex->getValue().ult(constLength->getValue()))
+            return;
+    }
+
+    // runtime check
+
     llvm::BasicBlock* oldend = gIR->scopeend();
     llvm::BasicBlock* failbb = llvm::BasicBlock::Create(gIR->context(), "arrayboundscheckfail", gIR->topfunc(), oldend);
     llvm::BasicBlock* okbb = llvm::BasicBlock::Create(gIR->context(), "arrayboundsok", gIR->topfunc(), oldend);
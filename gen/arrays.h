@@ -33,6 +33,14 @@ DSliceValue* DtoResizeDynArray(Type* arrayType, DValue* array, llvm::Value* newd
 void DtoCatAssignElement(Loc& loc, Type* type, DValue* arr, Expression* exp);
 DSliceValue* DtoCatAssignArray(DValue* arr, Expression* exp);
 DSliceValue* DtoCatArrays(Type* type, Expression* e1, Expression* e2);
+#if DMDV2
+// Appends the operands of the concatenation e, which can be arrays or single
+// elements, to ops. Returns false if the result (of type arrayType) cannot be
+// built by DtoCatAssignArrays.
+bool collectCatOperands(Type* arrayType, Expression* e, std::vector<Expression*>& ops);
+// Appends all of ops to the dynamic array arr, growing it only once.
+void DtoCatAssignArrays(Loc& loc, DValue* arr, const std::vector<Expression*>& ops);
+#endif
 #if DMDV1
 DSliceValue* DtoCatArrayElement(Type* type, Expression* exp1, Expression* exp2);
 #endif
@@ -1,9 +1,13 @@
 #include "gen/llvm.h"
+#include "llvm/Support/CommandLine.h"
 
 #include "mtype.h"
 #include "aggregate.h"
+#include "attrib.h"
 #include "init.h"
 #include "declaration.h"
+#include "module.h"
+#include "template.h"
 
 #include "gen/dvalue.h"
 #include "gen/irstate.h"
@@ -13,6 +17,7 @@
 #include "gen/functions.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/metadata.h"
 #include "gen/nested.h"
 #include "gen/rttibuilder.h"
 #include "gen/runtime.h"
@@ -23,6 +28,10 @@
 #include "ir/irstruct.h"
 #include "ir/irtypeclass.h"
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 //////////////////////////////////////////////////////////////////////////////////////////
 
 // FIXME: this needs to be cleaned up
@@ -353,8 +362,96 @@ DValue* DtoCastClass(DValue* val, Type* _to)
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+// Returns whether the (non-null) object obj is an instance of the class cd or
+// of a class derived from it. cd has to be final, or the program compiled
+// with -class-display.
+//
+// With -class-display every class vtbl is followed by the display built by
+// DtoDefineClassDisplay, which holds the depth of the class in the hierarchy
+// and the ClassInfos of its ancestors, indexed by their depth. Thus cd is a
+// base class of the dynamic type iff that is at least as deep as cd and has
+// cd at cd's depth.
+static LLValue* DtoIsInstanceOf(LLValue* obj, ClassDeclaration* cd)
+{
+    cd->codegen(Type::sir);
+    LLValue* cinfo = DtoBitCast(cd->ir.irStruct->getClassInfoSymbol(), getVoidPtrType());
+
+    LLType* voidPtrPtr = getPtrToType(getVoidPtrType());
+    LLValue* vtbl = DtoLoad(DtoBitCast(obj, getPtrToType(voidPtrPtr)), "vtbl");
+    LLValue* objcinfo = DtoLoad(vtbl, "classinfo");
+
+    // instances of final classes have exactly their ClassInfo
+    if (cd->storage_class & STCfinal)
+        return gIR->ir->CreateICmpEQ(objcinfo, cinfo, "isinstance");
+
+    unsigned depth = 0;
+    for (ClassDeclaration* base = cd->baseClass; base; base = base->baseClass)
+        depth++;
+
+    // the display is found behind the ClassInfo.vtbl entries
+    ClassDeclaration* cinfoDecl = ClassDeclaration::classinfo;
+    VarDeclaration* vtblVar = (VarDeclaration*)cinfoDecl->fields.data[2];
+    LLValue* vtblLen = DtoIndexClass(DtoBitCast(objcinfo, DtoType(cinfoDecl->type)), cinfoDecl, vtblVar);
+    vtblLen = DtoLoad(DtoGEPi(vtblLen, 0, 0), "vtbl.length");
+    LLValue* display = DtoGEP1(vtbl, vtblLen, "display");
+    LLValue* objdepth = DtoLoad(DtoBitCast(display, getPtrToType(DtoSize_t())), "depth");
+
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* depthbb = gIR->scopebb();
+    llvm::BasicBlock* ancestorbb = llvm::BasicBlock::Create(gIR->context(), "dyncastancestor", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "dyncastend", gIR->topfunc(), oldend);
+
+    LLValue* deepEnough = gIR->ir->CreateICmpUGE(objdepth, DtoConstSize_t(depth));
+    gIR->ir->CreateCondBr(deepEnough, ancestorbb, endbb);
+
+    gIR->scope() = IRScope(ancestorbb, endbb);
+    LLValue* ancestor = DtoLoad(DtoGEPi1(display, depth + 1), "ancestor");
+    LLValue* isAncestor = gIR->ir->CreateICmpEQ(ancestor, cinfo);
+    gIR->ir->CreateBr(endbb);
+
+    gIR->scope() = IRScope(endbb, oldend);
+    llvm::PHINode* phi = gIR->ir->CreatePHI(isAncestor->getType(), 2, "isinstance");
+    phi->addIncoming(LLConstantInt::getFalse(gIR->context()), depthbb);
+    phi->addIncoming(isAncestor, ancestorbb);
+    return phi;
+}
+
 DValue* DtoDynamicCastObject(DValue* val, Type* _to)
 {
+    TypeClass* totc = (TypeClass*)_to->toBasetype();
+
+    // casts to classes are done inline, see DtoIsInstanceOf. The check for
+    // final classes only needs the ClassInfo in vtbl[0], the others need
+    // the display, which classes compiled without -class-display lack.
+    ClassDeclaration* tocd = totc->sym;
+    if (!tocd->isInterfaceDeclaration() &&
+        ((tocd->storage_class & STCfinal) || global.params.useClassDisplay))
+    {
+        LLValue* obj = val->getRVal();
+        LLType* tolltype = DtoType(_to);
+        LLValue* nullobj = LLConstant::getNullValue(obj->getType());
+
+        llvm::BasicBlock* oldend = gIR->scopeend();
+        llvm::BasicBlock* nullbb = gIR->scopebb();
+        llvm::BasicBlock* checkbb = llvm::BasicBlock::Create(gIR->context(), "dyncast", gIR->topfunc(), oldend);
+        llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "dyncastresult", gIR->topfunc(), oldend);
+
+        gIR->ir->CreateCondBr(gIR->ir->CreateICmpNE(obj, nullobj), checkbb, endbb);
+
+        gIR->scope() = IRScope(checkbb, endbb);
+        LLValue* isinstance = DtoIsInstanceOf(obj, tocd);
+        LLValue* casted = gIR->ir->CreateSelect(isinstance, DtoBitCast(obj, tolltype),
+            LLConstant::getNullValue(tolltype));
+        checkbb = gIR->scopebb();
+        gIR->ir->CreateBr(endbb);
+
+        gIR->scope() = IRScope(endbb, oldend);
+        llvm::PHINode* phi = gIR->ir->CreatePHI(tolltype, 2, "dyncast");
+        phi->addIncoming(LLConstant::getNullValue(tolltype), nullbb);
+        phi->addIncoming(casted, checkbb);
+        return new DImValue(_to, phi);
+    }
+
     // call:
     // Object _d_dynamic_cast(Object o, ClassInfo c)
 
@@ -505,6 +602,105 @@ LLValue* DtoIndexClass(LLValue* src, ClassDeclaration* cd, VarDeclaration* vd)
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+static llvm::cl::opt<bool> disableDevirtualization("disable-devirtualization",
+    llvm::cl::desc("Always call virtual functions through the vtbl"),
+    llvm::cl::ZeroOrMore);
+
+// Returns the function in the vtbl of cd that implements fdecl, or NULL if
+// there is none (interfaces, abstract functions).
+static FuncDeclaration* getVtblEntry(ClassDeclaration* cd, FuncDeclaration* fdecl)
+{
+    ClassDeclaration* owner = fdecl->toParent()->isClassDeclaration();
+    if (!owner || owner->isInterfaceDeclaration() || cd->isInterfaceDeclaration() ||
+        fdecl->vtblIndex >= (int)cd->vtbl.dim)
+        return NULL;
+    Dsymbol* s = (Dsymbol*)cd->vtbl.data[fdecl->vtblIndex];
+    FuncDeclaration* impl = s ? s->isFuncDeclaration() : NULL;
+    if (!impl || impl->isAbstract())
+        return NULL;
+    return impl;
+}
+
+// Maps every class known to the compilation to the classes directly derived
+// from it.
+typedef std::map<ClassDeclaration*, std::vector<ClassDeclaration*> > SubclassMap;
+
+static void collectSubclasses(Array* members, SubclassMap& subclasses)
+{
+    if (!members)
+        return;
+
+    for (unsigned i = 0; i < members->dim; i++)
+    {
+        Dsymbol* s = (Dsymbol*)members->data[i];
+        if (AttribDeclaration* ad = s->isAttribDeclaration())
+        {
+            collectSubclasses(ad->include(NULL, NULL), subclasses);
+        }
+        else if (TemplateInstance* ti = s->isTemplateInstance())
+        {
+            if (!ti->errors)
+                collectSubclasses(ti->members, subclasses);
+        }
+        else if (AggregateDeclaration* ad = s->isAggregateDeclaration())
+        {
+            ClassDeclaration* cd = ad->isClassDeclaration();
+            if (cd && cd->baseClass)
+                subclasses[cd->baseClass].push_back(cd);
+            collectSubclasses(ad->members, subclasses);
+        }
+    }
+}
+
+// Returns whether a class derived from cd overrides the vtbl entry impl of
+// cd. Classes not known to the compilation (or local to functions) are not
+// considered, so the result can only be used to speculate.
+static bool isOverridden(ClassDeclaration* cd, int index, FuncDeclaration* impl)
+{
+    static SubclassMap subclasses;
+    static bool collected = false;
+    if (!collected)
+    {
+        for (unsigned i = 0; i < Module::amodules.dim; i++)
+            collectSubclasses(((Module*)Module::amodules.data[i])->members, subclasses);
+        collected = true;
+    }
+
+    SubclassMap::iterator it = subclasses.find(cd);
+    if (it == subclasses.end())
+        return false;
+
+    std::vector<ClassDeclaration*>& derived = it->second;
+    for (size_t i = 0; i < derived.size(); i++)
+    {
+        ClassDeclaration* sub = derived[i];
+        if (index >= (int)sub->vtbl.dim || sub->vtbl.data[index] != impl)
+            return true;
+        if (isOverridden(sub, index, impl))
+            return true;
+    }
+    return false;
+}
+
+FuncDeclaration* DtoDevirtualize(Type* type, FuncDeclaration* fdecl)
+{
+    if (disableDevirtualization)
+        return NULL;
+
+    Type* t = type->toBasetype();
+    if (t->ty != Tclass)
+        return NULL;
+    ClassDeclaration* cd = ((TypeClass*)t)->sym;
+
+    // If the object is an instance of a final class, or the function cannot
+    // be overridden below the static type, the vtbl entry of the static type
+    // is the one being called.
+    FuncDeclaration* impl = getVtblEntry(cd, fdecl);
+    if (impl && ((cd->storage_class & STCfinal) || impl->isFinal()))
+        return impl;
+    return NULL;
+}
+
 LLValue* DtoVirtualFunctionPointer(DValue* inst, FuncDeclaration* fdecl, char* name)
 {
     // sanity checks
@@ -513,6 +709,14 @@ LLValue* DtoVirtualFunctionPointer(DValue* inst, FuncDeclaration* fdecl, char* n
     assert(fdecl->vtblIndex > 0); // 0 is always ClassInfo/Interface*
     assert(inst->getType()->toBasetype()->ty == Tclass);
 
+    // call the implementation directly if it is known statically
+    if (FuncDeclaration* impl = DtoDevirtualize(inst->getType(), fdecl))
+    {
+        Logger::println("devirtualized to: %s", impl->toPrettyChars());
+        impl->codegen(Type::sir);
+        return DtoBitCast(impl->ir.irFunc->func, getPtrToType(DtoType(fdecl->type)));
+    }
+
     // get instance
     LLValue* vthis = inst->getRVal();
     if (Logger::enabled())
@@ -530,6 +734,24 @@ LLValue* DtoVirtualFunctionPointer(DValue* inst, FuncDeclaration* fdecl, char* n
     // load funcptr
     funcval = DtoAlignedLoad(funcval);
 
+#if USE_METADATA
+    // With -singleobj, the class hierarchy is (mostly) known: if none of the
+    // classes derived from the static type overrides the function, tag the
+    // load with the implementation for -dspecdevirt to guard a direct call on.
+    ClassDeclaration* cd = ((TypeClass*)inst->getType()->toBasetype())->sym;
+    FuncDeclaration* impl;
+    if (global.params.singleObj && !disableDevirtualization &&
+        (impl = getVtblEntry(cd, fdecl)) && impl->fbody &&
+        !isOverridden(cd, fdecl->vtblIndex, impl))
+    {
+        Logger::println("single implementation: %s", impl->toPrettyChars());
+        impl->codegen(Type::sir);
+        llvm::Value* target = impl->ir.irFunc->func;
+        llvm::cast<llvm::Instruction>(funcval)->setMetadata(DEVIRT_MD_KIND,
+            llvm::MDNode::get(gIR->context(), llvm::ArrayRef<llvm::Value*>(target)));
+    }
+#endif
+
     if (Logger::enabled())
         Logger::cout() << "funcval: " << *funcval << '\n';
 
@@ -658,6 +880,32 @@ L2:
     return flags;
 }
 
+// Builds the ancestor display appended to the vtbl of cd with -class-display:
+//     struct {
+//         size_t depth;                       // number of base classes
+//         ClassInfo[depth + 1] ancestors;     // Object first, cd last
+//     }
+// DtoIsInstanceOf uses it to check for derived classes in constant time.
+LLConstant* DtoDefineClassDisplay(ClassDeclaration* cd)
+{
+    std::vector<LLConstant*> ancestors;
+    for (ClassDeclaration* base = cd; base; base = base->baseClass)
+    {
+        base->codegen(Type::sir);
+        LLConstant* c = base->ir.irStruct->getClassInfoSymbol();
+        ancestors.push_back(llvm::ConstantExpr::getBitCast(c, getVoidPtrType()));
+    }
+    std::reverse(ancestors.begin(), ancestors.end());
+
+    LLConstant* display[] = {
+        DtoConstSize_t(ancestors.size() - 1),
+        LLConstantArray::get(LLArrayType::get(getVoidPtrType(), ancestors.size()), ancestors)
+    };
+    return LLConstantStruct::getAnon(gIR->context(), display);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
 LLConstant* DtoDefineClassInfo(ClassDeclaration* cd)
 {
 //     The layout is:
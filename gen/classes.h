@@ -32,6 +32,11 @@ DValue* DtoDynamicCastInterface(DValue* val, Type* to);
 
 LLValue* DtoIndexClass(LLValue* src, ClassDeclaration* sd, VarDeclaration* vd);
 
+/// Returns the function that is called if the virtual function fdecl is
+/// called on an object of the given static type, if it can be determined at
+/// compile time (final classes and methods). Returns NULL otherwise.
+FuncDeclaration* DtoDevirtualize(Type* type, FuncDeclaration* fdecl);
+
 LLValue* DtoVirtualFunctionPointer(DValue* inst, FuncDeclaration* fdecl, char* name);
 
 #endif
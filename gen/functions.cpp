@@ -16,6 +16,7 @@
 #include "gen/llvmhelpers.h"
 #include "gen/runtime.h"
 #include "gen/arrays.h"
+#include "gen/arrayop.h"
 #include "gen/logger.h"
 #include "gen/functions.h"
 #include "gen/todebug.h"
@@ -829,6 +830,9 @@ void DtoDefineFunction(FuncDeclaration* fd)
     }
 
     // output function body
+#if DMDV2
+    if (!DtoVectorArrayOp(fd))
+#endif
     fd->fbody->toIR(gIR);
     irfunction->gen = 0;
 
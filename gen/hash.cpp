@@ -0,0 +1,116 @@
+#include "gen/hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// MurmurHash3 x64_128, by Austin Appleby (public domain).
+
+static const uint64_t c1 = 0x87c37b91114253d5ULL;
+static const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Reads 8 bytes as little endian, so that the hash is the same on all hosts.
+static inline uint64_t load64(const unsigned char* p)
+{
+    uint64_t k = 0;
+    for (int i = 7; i >= 0; i--)
+        k = (k << 8) | p[i];
+    return k;
+}
+
+static inline uint64_t fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+ContentHash::ContentHash()
+:   h1(0),
+    h2(0),
+    length(0)
+{
+}
+
+void ContentHash::mixBlock(const unsigned char* block)
+{
+    uint64_t k1 = load64(block);
+    uint64_t k2 = load64(block + 8);
+
+    k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+}
+
+void ContentHash::update(const void* data, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    size_t used = length % 16;
+    length += size;
+
+    // complete the block left over from the last call first
+    if (used)
+    {
+        size_t n = 16 - used;
+        if (n > size)
+            n = size;
+        memcpy(tail + used, p, n);
+        p += n;
+        size -= n;
+        if (used + n < 16)
+            return;
+        mixBlock(tail);
+    }
+
+    for (; size >= 16; p += 16, size -= 16)
+        mixBlock(p);
+    memcpy(tail, p, size);
+}
+
+void ContentHash::update(const char* str)
+{
+    update(str, strlen(str) + 1);
+}
+
+std::string ContentHash::hexDigest() const
+{
+    uint64_t a = h1, b = h2;
+    uint64_t k1 = 0, k2 = 0;
+
+    size_t rest = length % 16;
+    for (size_t i = rest; i > 8; i--)
+        k2 = (k2 << 8) | tail[i - 1];
+    for (size_t i = rest < 8 ? rest : 8; i > 0; i--)
+        k1 = (k1 << 8) | tail[i - 1];
+    if (rest > 8)
+    {
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; b ^= k2;
+    }
+    if (rest > 0)
+    {
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; a ^= k1;
+    }
+
+    a ^= length;
+    b ^= length;
+    a += b;
+    b += a;
+    a = fmix(a);
+    b = fmix(b);
+    a += b;
+    b += a;
+
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx",
+        (unsigned long long)a, (unsigned long long)b);
+    return buf;
+}
@@ -0,0 +1,32 @@
+#ifndef LDC_GEN_HASH_H
+#define LDC_GEN_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/// A 128 bit content hash: MurmurHash3 x64_128 (seed 0), fed incrementally.
+/// Not cryptographically secure, but good enough to tell apart files and
+/// command lines.
+class ContentHash
+{
+public:
+    ContentHash();
+
+    void update(const void* data, size_t size);
+    /// Hashes str including its terminator, so that consecutive strings
+    /// cannot run into each other.
+    void update(const char* str);
+
+    /// Returns the hash as a string of 32 hex digits.
+    std::string hexDigest() const;
+
+private:
+    void mixBlock(const unsigned char* block);
+
+    uint64_t h1, h2;
+    uint64_t length;
+    unsigned char tail[16];     // bytes not yet mixed, length % 16 of them
+};
+
+#endif
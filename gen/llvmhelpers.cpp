@@ -6,9 +6,12 @@
 #include "id.h"
 #include "expression.h"
 #include "template.h"
+#include "aggregate.h"
+#include "attrib.h"
 #include "module.h"
 
 #include "llvm/MC/MCAsmInfo.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Target/TargetMachine.h"
 
 #include "gen/tollvm.h"
@@ -25,6 +28,7 @@
 #include "gen/nested.h"
 #include "ir/irmodule.h"
 
+#include <set>
 #include <stack>
 
 /****************************************************************************************/
@@ -1591,10 +1595,80 @@ void DtoOverloadedIntrinsicName(TemplateInstance* ti, TemplateDeclaration* td, s
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+static llvm::cl::opt<unsigned> importInlineMaxLines("import-inline-max-lines",
+    llvm::cl::desc("Maximum number of lines of imported functions to analyze for inlining"),
+    llvm::cl::init(40),
+    llvm::cl::ZeroOrMore);
+
+unsigned lazySemantic3Analyzed = 0;
+unsigned lazySemantic3Skipped = 0;
+
+// Imported functions which were too large or had errors in their bodies.
+static std::set<FuncDeclaration*> lazySemantic3Failed;
+// Set once code generation starts, after which no semantic3 may run.
+static bool lazySemantic3Closed = false;
+
+// Runs semantic3 on the imported function fd if it is small enough to be
+// worth inlining, so its body can be emitted as available_externally.
+// Returns false if the body of fd must not be emitted.
+static bool lazySemantic3(FuncDeclaration* fd)
+{
+    if (lazySemantic3Failed.count(fd))
+        return false;
+    if (fd->semanticRun != PASSsemanticdone || !fd->scope || !fd->fbody)
+        return true;
+    if (lazySemantic3Closed)
+        return false;
+
+    // The body has not been analyzed yet, so just go by its length.
+    unsigned lines = fd->endloc.linnum > fd->loc.linnum ? fd->endloc.linnum - fd->loc.linnum : 0;
+    if (lines > importInlineMaxLines ||
+        fd->isStaticCtorDeclaration() || fd->isStaticDtorDeclaration() ||
+        fd->isUnitTestDeclaration())
+    {
+        lazySemantic3Failed.insert(fd);
+        lazySemantic3Skipped++;
+        return false;
+    }
+
+    Logger::println("Running semantic3 on imported function %s", fd->toPrettyChars());
+    LOG_SCOPE;
+
+    // Errors in the body just prevent inlining, the function is compiled
+    // (and the errors reported) with its own module.
+    unsigned errors = global.startGagging();
+    fd->semantic3(fd->scope);
+    if (global.endGagging(errors))
+    {
+        // semantic3 has marked fd as done anyway, so remember the failure.
+        lazySemantic3Failed.insert(fd);
+        lazySemantic3Skipped++;
+        return false;
+    }
+    lazySemantic3Analyzed++;
+    return true;
+}
+
+void analyzeImportedFunctions()
+{
+    // Only the imported functions called from the compiled code are
+    // analyzed. Analyzing one records the functions it calls in turn, so
+    // this runs until no new callees are found.
+    FuncDeclarations& callees = FuncDeclaration::importedCallees;
+    for (unsigned i = 0; i < callees.dim; i++)
+        lazySemantic3(callees[i]);
+    callees.setDim(0);
+    lazySemantic3Closed = true;
+}
+
 bool mustDefineSymbol(Dsymbol* s)
 {
     if (FuncDeclaration* fd = s->isFuncDeclaration())
     {
+        if (global.params.useAvailableExternally && fd->availableExternally &&
+            !lazySemantic3(fd))
+            return false;
+
         // we can't (and probably shouldn't?) define functions
         // that weren't semantic3'ed
         if (fd->semanticRun < 4)
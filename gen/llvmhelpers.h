@@ -133,6 +133,17 @@ void DtoOverloadedIntrinsicName(TemplateInstance* ti, TemplateDeclaration* td, s
 /// Returns true if the symbol should be defined in the current module, not just declared.
 bool mustDefineSymbol(Dsymbol* s);
 
+/// With useAvailableExternally, runs semantic3 on the small imported
+/// functions called from the compiled code (directly or through other such
+/// functions) so they can be inlined. Must be called before code generation
+/// starts, so template instances created by the analysis are emitted too.
+void analyzeImportedFunctions();
+
+/// Statistics for -v: imported functions analyzed for inlining, and those
+/// skipped because of their size or errors.
+extern unsigned lazySemantic3Analyzed;
+extern unsigned lazySemantic3Skipped;
+
 /// Returns true if the symbol needs template linkage, or just external.
 bool needsTemplateLinkage(Dsymbol* s);
 
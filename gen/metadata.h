@@ -7,13 +7,13 @@
 #include "llvm/Metadata.h"
 typedef llvm::Value MDNodeField;
 
-// Use getNumElements() and getElement() to access elements.
+// Use getNumOperands() and getOperand() to access elements.
 inline unsigned MD_GetNumElements(llvm::MDNode* N) {
-    return N->getNumElements();
+    return N->getNumOperands();
 }
 
 inline MDNodeField* MD_GetElement(llvm::MDNode* N, unsigned i) {
-    return N->getElement(i);
+    return N->getOperand(i);
 }
 
 #define METADATA_LINKAGE_TYPE  llvm::GlobalValue::WeakODRLinkage
@@ -28,6 +28,9 @@ enum TypeDataFields {
     
     TD_Type,        /// A value of the LLVM type corresponding to this D type
     
+    TD_ElemInit,    /// For dynamic arrays of scalars (possibly nested), the
+                    /// initializer of the scalar elements. Null otherwise.
+    
     // Must be kept last:
     TD_NumFields    /// The number of fields in TypeInfo metadata
 };
@@ -47,6 +50,14 @@ enum ClassDataFields {
     CD_NumFields    /// The number of fields in ClassInfo metadata
 };
 
+
+// *** Metadata for virtual calls ***
+/// Attached to the load of a vtbl entry if only a single implementation of
+/// the virtual function is known to the compilation. Its only operand is
+/// that implementation; -dspecdevirt turns calls through the loaded pointer
+/// into guarded direct calls.
+#define DEVIRT_MD_KIND "ldc.devirt"
+
 #endif
 
 #endif // USE_METADATA
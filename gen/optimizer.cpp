@@ -10,9 +10,13 @@
 #include "llvm/Target/TargetData.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/PassNameParser.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
 #include "root.h"       // error()
+#include <algorithm>    // std::min()
 #include <cstring>      // strcmp();
 
 using namespace llvm;
@@ -33,8 +37,8 @@ static cl::opt<unsigned char> optimizeLevel(
         clEnumValN(1, "O1", "Simple optimizations"),
         clEnumValN(2, "O2", "Good optimizations"),
         clEnumValN(3, "O3", "Aggressive optimizations"),
-        clEnumValN(4, "O4", "Link-time optimization"), //  not implemented?
-        clEnumValN(5, "O5", "Link-time optimization"), //  not implemented?
+        clEnumValN(4, "O4", "Link-time optimization"),
+        clEnumValN(5, "O5", "Link-time optimization"),
         clEnumValEnd),
     cl::init(0));
 
@@ -59,6 +63,16 @@ disableGCToStack("disable-gc2stack",
     cl::desc("Disable promotion of GC allocations to stack memory in -O<N>"),
     cl::ZeroOrMore);
 
+static cl::opt<bool>
+disableBoundsCheckElim("disable-boundscheck-elim",
+    cl::desc("Disable removal of redundant array bounds checks in -O<N>"),
+    cl::ZeroOrMore);
+
+static cl::opt<bool>
+disableSpecDevirt("disable-spec-devirt",
+    cl::desc("Disable guarded direct calls of virtual functions in -O<N>"),
+    cl::ZeroOrMore);
+
 static cl::opt<opts::BoolOrDefaultAdapter, false, opts::FlagParser>
 enableInlining("inlining",
     cl::desc("(*) Enable function inlining in -O<N>"),
@@ -66,10 +80,11 @@ enableInlining("inlining",
 
 // Determine whether or not to run the inliner as part of the default list of
 // optimization passes.
-// If not explicitly specified, treat as false for -O0-2, and true for -O3.
+// If not explicitly specified, treat as false for -O0-1, and true for -O2 and
+// up, like opt does.
 bool doInline() {
     return enableInlining == cl::BOU_TRUE
-        || (enableInlining == cl::BOU_UNSET && optimizeLevel >= 3);
+        || (enableInlining == cl::BOU_UNSET && optimizeLevel >= 2);
 }
 
 // Determine whether the inliner will be run.
@@ -94,123 +109,96 @@ bool optimize() {
     return optimizeLevel || doInline() || !passList.empty();
 }
 
-static void addPass(PassManager& pm, Pass* pass) {
-    pm.add(pass);
+// -O4 and -O5 emit bitcode object files, which are only compiled to native
+// code at link time, together with the rest of the program.
+bool doLTO() {
+    return optimizeLevel >= 4;
+}
 
-    if (verifyEach) pm.add(createVerifierPass());
+// Pass managers which run the verifier after every pass with -verify-each,
+// including the ones added by PassManagerBuilder.
+namespace {
+    class VerifyingPassManager : public PassManager {
+    public:
+        void add(Pass* pass) {
+            PassManager::add(pass);
+            if (verifyEach) PassManager::add(createVerifierPass());
+        }
+    };
+
+    class VerifyingFunctionPassManager : public FunctionPassManager {
+    public:
+        VerifyingFunctionPassManager(Module* m) : FunctionPassManager(m) {}
+        void add(Pass* pass) {
+            FunctionPassManager::add(pass);
+            if (verifyEach) FunctionPassManager::add(createVerifierPass());
+        }
+    };
 }
 
-// this function inserts some or all of the std-compile-opts passes depending on the
-// optimization level given.
-static void addPassesForOptLevel(PassManager& pm) {
-    // -O1
-    if (optimizeLevel >= 1)
-    {
-        //addPass(pm, createStripDeadPrototypesPass());
-        addPass(pm, createGlobalDCEPass());
-        addPass(pm, createPromoteMemoryToRegisterPass());
-        addPass(pm, createCFGSimplificationPass());
-        if (optimizeLevel == 1)
-            addPass(pm, createPromoteMemoryToRegisterPass());
-        else
-            addPass(pm, createScalarReplAggregatesPass());
-        addPass(pm, createGlobalOptimizerPass());
-    }
+// Adds the D-specific passes. They run on every function after it has been
+// inlined into, when the scalar optimizations have had a go at it.
+static void addDPasses(const PassManagerBuilder& builder, PassManagerBase& pm) {
+    if (builder.OptLevel < 2 || disableLangSpecificPasses)
+        return;
 
-    // -O2
-    if (optimizeLevel >= 2)
-    {
-        addPass(pm, createIPConstantPropagationPass());
-        addPass(pm, createDeadArgEliminationPass());
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createCFGSimplificationPass());
-        addPass(pm, createPruneEHPass());
-        
-        // FIXME: Adding this pass crashes LLVM 2.9 in
-        // PMTopLevelManager::schedulePass(), commented out for a quick fix.
-        // addPass(pm, createFunctionAttrsPass());
-
-        addPass(pm, createTailCallEliminationPass());
-        addPass(pm, createCFGSimplificationPass());
-        addPass(pm, createGVNPass());
-    }
+    if (!disableSimplifyRuntimeCalls)
+        pm.add(createSimplifyDRuntimeCalls());
 
-    // -inline
-    if (doInline()) {
-        addPass(pm, createFunctionInliningPass());
-
-        if (optimizeLevel >= 2) {
-            // Run some optimizations to clean up after inlining.
-            addPass(pm, createScalarReplAggregatesPass());
-            addPass(pm, createInstructionCombiningPass());
-            // -instcombine + gvn == devirtualization :)
-            addPass(pm, createGVNPass());
-
-            // Inline again, to catch things like now nonvirtual
-            // function calls, foreach delegates passed to inlined
-            // opApply's, etc. where the actual function being called
-            // wasn't known during the first inliner pass.
-            addPass(pm, createFunctionInliningPass());
-        }
+    if (!disableGCToStack) {
+        pm.add(createClosureFrame2Stack());
+#if USE_METADATA
+        pm.add(createGarbageCollect2Stack());
+#endif // USE_METADATA
+        // Break up the allocas that replaced the GC allocations.
+        pm.add(createScalarReplAggregatesPass());
     }
 
-    if (optimizeLevel >= 2) {
-        if (!disableLangSpecificPasses) {
-            if (!disableSimplifyRuntimeCalls)
-                addPass(pm, createSimplifyDRuntimeCalls());
+    // The loops have been rotated and their induction variables simplified
+    // by now, which the bounds check elimination relies on.
+    if (!disableBoundsCheckElim)
+        pm.add(createBoundsCheckElimination());
+}
 
 #if USE_METADATA
-            if (!disableGCToStack)
-                addPass(pm, createGarbageCollect2Stack());
+// Adds the passes which need to run before the inliner does, so that it gets
+// to see the direct calls they introduce.
+static void addEarlyDPasses(const PassManagerBuilder& builder, PassManagerBase& pm) {
+    if (builder.OptLevel < 2 || disableLangSpecificPasses)
+        return;
+
+    if (!disableSpecDevirt)
+        pm.add(createSpeculativeDevirtualization());
+}
 #endif // USE_METADATA
-        }
-        // Run some clean-up passes
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createScalarReplAggregatesPass());
-        addPass(pm, createCFGSimplificationPass());
-        addPass(pm, createInstructionCombiningPass());
-    }
 
-    // -O3
-    if (optimizeLevel >= 3)
-    {
-        addPass(pm, createArgumentPromotionPass());
-        addPass(pm, createSimplifyLibCallsPass());
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createJumpThreadingPass());
-        addPass(pm, createCFGSimplificationPass());
-        addPass(pm, createScalarReplAggregatesPass());
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createConstantPropagationPass());
-
-        addPass(pm, createReassociatePass());
-        addPass(pm, createLoopRotatePass());
-        addPass(pm, createLICMPass());
-        addPass(pm, createLoopUnswitchPass());
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createIndVarSimplifyPass());
-        addPass(pm, createLoopDeletionPass());
-        addPass(pm, createLoopUnrollPass());
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createGVNPass());
-        addPass(pm, createMemCpyOptPass());
-        addPass(pm, createSCCPPass());
-
-        addPass(pm, createInstructionCombiningPass());
-        addPass(pm, createConstantPropagationPass());
-
-        addPass(pm, createDeadStoreEliminationPass());
-        addPass(pm, createAggressiveDCEPass());
-        addPass(pm, createCFGSimplificationPass());
-        addPass(pm, createConstantMergePass());
-    }
+// Sets up builder to create the same passes as opt -O<N> for the optimization
+// level given. -O4 and -O5 get the -O3 pipeline.
+static void populateBuilder(PassManagerBuilder& builder) {
+    builder.OptLevel = std::min<unsigned>(optimizeLevel, 3);
+    builder.SizeLevel = 0;
+    builder.DisableUnrollLoops = optimizeLevel == 0;
+
+    if (doInline())
+        builder.Inliner = createFunctionInliningPass(optimizeLevel >= 3 ? 275 : 225);
+    else
+        builder.Inliner = createAlwaysInlinerPass();
+
+#if USE_METADATA
+    builder.addExtension(PassManagerBuilder::EP_EarlyAsPossible, addEarlyDPasses);
+#endif // USE_METADATA
+    builder.addExtension(PassManagerBuilder::EP_ScalarOptimizerLate, addDPasses);
+}
+
+// this function inserts the module level passes for the optimization level
+// given.
+static void addPassesForOptLevel(PassManagerBuilder& builder, PassManagerBase& pm) {
+    builder.populateModulePassManager(pm);
 
     if (optimizeLevel >= 1) {
-        addPass(pm, createStripExternalsPass());
-        addPass(pm, createGlobalDCEPass());
+        pm.add(createStripExternalsPass());
+        pm.add(createGlobalDCEPass());
     }
-
-    // level -O4 and -O5 are linktime optimizations
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -221,14 +209,15 @@ bool ldc_optimize_module(llvm::Module* m)
     if (!optimize())
         return false;
 
-    PassManager pm;
-
-    if (verifyEach) pm.add(createVerifierPass());
+    VerifyingPassManager pm;
 
-    addPass(pm, new TargetData(m));
+    pm.add(new TargetData(m));
 
     bool optimize = optimizeLevel != 0 || doInline();
 
+    PassManagerBuilder builder;
+    populateBuilder(builder);
+
     unsigned optPos = optimizeLevel != 0
                     ? optimizeLevel.getPosition()
                     : enableInlining.getPosition();
@@ -236,13 +225,13 @@ bool ldc_optimize_module(llvm::Module* m)
     for (size_t i = 0; i < passList.size(); i++) {
         // insert -O<N> / -enable-inlining in right position
         if (optimize && optPos < passList.getPosition(i)) {
-            addPassesForOptLevel(pm);
+            addPassesForOptLevel(builder, pm);
             optimize = false;
         }
 
         const PassInfo* pass = passList[i];
         if (PassInfo::NormalCtor_t ctor = pass->getNormalCtor()) {
-            addPass(pm, ctor());
+            pm.add(ctor());
         } else {
             const char* arg = pass->getPassArgument(); // may return null
             if (arg)
@@ -254,8 +243,57 @@ bool ldc_optimize_module(llvm::Module* m)
     }
     // insert -O<N> / -enable-inlining if specified at the end,
     if (optimize)
-        addPassesForOptLevel(pm);
+        addPassesForOptLevel(builder, pm);
+
+    // Like opt, run the early per-function simplifications over the whole
+    // module first.
+    if (optimizeLevel != 0) {
+        VerifyingFunctionPassManager fpm(m);
+        fpm.add(new TargetData(m));
+        builder.populateFunctionPassManager(fpm);
+
+        fpm.doInitialization();
+        for (Module::iterator F = m->begin(), E = m->end(); F != E; ++F)
+            fpm.run(*F);
+        fpm.doFinalization();
+    }
 
     pm.run(*m);
+
+    // -time-passes normally reports once at exit, summed over all modules.
+    if (TimePassesIsEnabled) {
+        errs() << "Optimization of module '" << m->getModuleIdentifier() << "':\n";
+        TimerGroup::printAll(errs());
+    }
     return true;
 }
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Runs the link-time optimizations on the whole program m. Unless exportList
+// is null, all symbols not in it are internalized first.
+void ldc_optimize_program(llvm::Module* m, const std::vector<const char*>* exportList)
+{
+    VerifyingPassManager pm;
+    pm.add(new TargetData(m));
+
+    if (exportList)
+        pm.add(createInternalizePass(*exportList));
+
+    PassManagerBuilder builder;
+    builder.OptLevel = 3;
+    builder.populateLTOPassManager(pm, false, doInline());
+
+    // The runtime functions may have been inlined now, give the D-specific
+    // passes another go.
+    addDPasses(builder, pm);
+    pm.add(createInstructionCombiningPass());
+    pm.add(createCFGSimplificationPass());
+    pm.add(createGlobalDCEPass());
+
+    pm.run(*m);
+
+    if (TimePassesIsEnabled) {
+        errs() << "Link-time optimization:\n";
+        TimerGroup::printAll(errs());
+    }
+}
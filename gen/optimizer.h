@@ -1,10 +1,15 @@
 #ifndef LDC_GEN_OPTIMIZER_H
 #define LDC_GEN_OPTIMIZER_H
 
+#include <vector>
+
 namespace llvm { class Module; }
 
 bool ldc_optimize_module(llvm::Module* m);
 
+// Link-time optimization of the whole program, see doLTO().
+void ldc_optimize_program(llvm::Module* m, const std::vector<const char*>* exportList);
+
 // Determines whether the inliner will run in the -O<N> list of passes
 bool doInline();
 // Determines whether the inliner will be run at all.
@@ -14,5 +19,7 @@ int optLevel();
 
 bool optimize();
 
+bool doLTO();
+
 #endif
 
@@ -0,0 +1,375 @@
+//===- BoundsCheckElimination - Remove redundant array bounds checks ------===//
+//
+//                             The LLVM D Compiler
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The frontend guards every array index and slice expression with a branch
+// to a block calling _d_array_bounds (see DtoArrayBoundsCheck()). This pass
+// removes the checks which are known to succeed:
+//
+//  - checks implied by a dominating condition, e.g. by an earlier check of
+//    the same index against the same length, or by an 'if (i < a.length)',
+//  - checks of the canonical induction variable of a loop running from 0 to
+//    the length which is checked against (foreach (i; 0 .. a.length) a[i]),
+//
+// and hoists loop invariant checks which are performed at the start of each
+// iteration into the loop preheader.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dboundscheck"
+
+#include "Passes.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumChecksRemoved, "Number of redundant bounds checks removed");
+STATISTIC(NumChecksHoisted, "Number of loop invariant bounds checks hoisted");
+
+namespace {
+    /// A condition 'LHS Pred RHS' known to be true.
+    struct Fact {
+        ICmpInst::Predicate Pred;
+        Value *LHS, *RHS;
+    };
+
+    /// A bounds check: branches to Fail unless Cond holds.
+    struct BoundsCheck {
+        BranchInst *Br;
+        BasicBlock *Fail;
+        Fact Cond;
+    };
+
+    /// This pass removes and hoists array bounds checks.
+    ///
+    class LLVM_LIBRARY_VISIBILITY BoundsCheckElimination : public FunctionPass {
+        DominatorTree *DT;
+        LoopInfo *LI;
+
+        // The checks of the function, by the block they terminate.
+        DenseMap<BasicBlock*, BoundsCheck> Checks;
+
+        bool getBranchFact(BasicBlock *From, BasicBlock *To, Fact &F);
+        bool isKnownAt(const Fact &F, BasicBlock *BB);
+        bool isInductionBelow(Value *V, Value *Length, Loop *L);
+        bool isRedundant(const BoundsCheck &C);
+        bool hoist(BoundsCheck &C);
+
+    public:
+        static char ID; // Pass identification
+        BoundsCheckElimination() : FunctionPass(ID) {}
+
+        bool runOnFunction(Function &F);
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+          AU.addRequired<DominatorTree>();
+          AU.addRequired<LoopInfo>();
+        }
+    };
+    char BoundsCheckElimination::ID = 0;
+} // end anonymous namespace.
+
+static RegisterPass<BoundsCheckElimination>
+X("dboundscheck", "Remove redundant array bounds checks");
+
+// Public interface to the pass.
+FunctionPass *createBoundsCheckElimination() {
+  return new BoundsCheckElimination();
+}
+
+/// isFailBlock - Returns whether BB is the failure branch of a bounds check.
+static bool isFailBlock(BasicBlock *BB) {
+    for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+        CallSite CS(I);
+        if (!CS.getInstruction())
+            continue;
+        Function *Callee = CS.getCalledFunction();
+        if (Callee && Callee->getName() == "_d_array_bounds")
+            return true;
+    }
+    return false;
+}
+
+/// canonicalize - Puts constants on the right hand side, and turns 'greater'
+/// comparisons into 'less' ones.
+static void canonicalize(Fact &F) {
+    if (isa<Constant>(F.LHS) && !isa<Constant>(F.RHS)) {
+        std::swap(F.LHS, F.RHS);
+        F.Pred = ICmpInst::getSwappedPredicate(F.Pred);
+    }
+    if ((F.Pred == ICmpInst::ICMP_UGT || F.Pred == ICmpInst::ICMP_UGE) &&
+            !isa<Constant>(F.RHS)) {
+        std::swap(F.LHS, F.RHS);
+        F.Pred = ICmpInst::getSwappedPredicate(F.Pred);
+    }
+}
+
+/// implies - Returns whether Known being true means that F is true as well.
+static bool implies(const Fact &Known, const Fact &F) {
+    if (Known.LHS != F.LHS)
+        return false;
+
+    if (Known.RHS == F.RHS) {
+        if (Known.Pred == F.Pred)
+            return true;
+        switch (F.Pred) {
+        case ICmpInst::ICMP_ULE:
+            return Known.Pred == ICmpInst::ICMP_ULT || Known.Pred == ICmpInst::ICMP_EQ;
+        case ICmpInst::ICMP_NE:
+            return Known.Pred == ICmpInst::ICMP_ULT || Known.Pred == ICmpInst::ICMP_UGT;
+        default:
+            return false;
+        }
+    }
+
+    // x < c1 implies x < c2 for c1 <= c2, x > c implies x != 0
+    ConstantInt *KC = dyn_cast<ConstantInt>(Known.RHS);
+    ConstantInt *FC = dyn_cast<ConstantInt>(F.RHS);
+    if (!KC || !FC || KC->getType() != FC->getType())
+        return false;
+    if (Known.Pred == ICmpInst::ICMP_ULT &&
+            (F.Pred == ICmpInst::ICMP_ULT || F.Pred == ICmpInst::ICMP_ULE))
+        return KC->getValue().ule(FC->getValue());
+    if (Known.Pred == ICmpInst::ICMP_UGT && F.Pred == ICmpInst::ICMP_NE)
+        return FC->isZero();
+    return false;
+}
+
+/// getBranchFact - If From ends with a conditional branch on a comparison,
+/// returns the condition that holds when going to its successor To.
+bool BoundsCheckElimination::getBranchFact(BasicBlock *From, BasicBlock *To, Fact &F) {
+    // The conditions of checks that have been folded already are still known.
+    DenseMap<BasicBlock*, BoundsCheck>::iterator It = Checks.find(From);
+    if (It != Checks.end()) {
+        if (To == It->second.Fail)
+            return false;
+        F = It->second.Cond;
+        return true;
+    }
+
+    BranchInst *Br = dyn_cast<BranchInst>(From->getTerminator());
+    if (!Br || !Br->isConditional() || Br->getSuccessor(0) == Br->getSuccessor(1))
+        return false;
+    ICmpInst *Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+    if (!Cmp)
+        return false;
+
+    F.Pred = Cmp->getPredicate();
+    F.LHS = Cmp->getOperand(0);
+    F.RHS = Cmp->getOperand(1);
+    if (Br->getSuccessor(1) == To)
+        F.Pred = ICmpInst::getInversePredicate(F.Pred);
+    canonicalize(F);
+    return true;
+}
+
+/// isKnownAt - Returns whether F holds whenever BB is executed, because some
+/// dominating branch only leads to BB if it does.
+bool BoundsCheckElimination::isKnownAt(const Fact &F, BasicBlock *BB) {
+    for (DomTreeNode *N = DT->getNode(BB); N && N->getIDom(); N = N->getIDom()) {
+        BasicBlock *Dom = N->getIDom()->getBlock();
+        // Find the successor of Dom leading to BB. It needs to have Dom as its
+        // only predecessor for the branch condition to hold in it.
+        TerminatorInst *Term = Dom->getTerminator();
+        for (unsigned i = 0, e = Term->getNumSuccessors(); i != e; ++i) {
+            BasicBlock *Succ = Term->getSuccessor(i);
+            if (Succ->getSinglePredecessor() != Dom || !DT->dominates(Succ, BB))
+                continue;
+            Fact Known;
+            if (getBranchFact(Dom, Succ, Known) && implies(Known, F))
+                return true;
+        }
+    }
+    return false;
+}
+
+/// isInductionBelow - Returns whether V is the canonical induction variable
+/// of L, counting up from zero, and L exits once it reaches Length.
+bool BoundsCheckElimination::isInductionBelow(Value *V, Value *Length, Loop *L) {
+    PHINode *PN = dyn_cast<PHINode>(V);
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!PN || PN->getParent() != Header || PN->getNumIncomingValues() != 2 ||
+            !Preheader || !Latch || !L->isLoopInvariant(Length))
+        return false;
+
+    ConstantInt *Start = dyn_cast<ConstantInt>(PN->getIncomingValueForBlock(Preheader));
+    BinaryOperator *Inc = dyn_cast<BinaryOperator>(PN->getIncomingValueForBlock(Latch));
+    if (!Start || !Start->isZero() || !Inc || Inc->getOpcode() != Instruction::Add ||
+            Inc->getOperand(0) != PN)
+        return false;
+    ConstantInt *Step = dyn_cast<ConstantInt>(Inc->getOperand(1));
+    if (!Step || !Step->isOne())
+        return false;
+
+    // The latch continues while i+1 < length, or i+1 != length.
+    Fact Continue;
+    if (!getBranchFact(Latch, Header, Continue) || Continue.LHS != Inc ||
+            Continue.RHS != Length ||
+            (Continue.Pred != ICmpInst::ICMP_ULT && Continue.Pred != ICmpInst::ICMP_NE))
+        return false;
+
+    // The first iteration needs a non-empty array. Loops are usually rotated
+    // at this point, with the original loop condition guarding the preheader.
+    Fact NonEmpty = { ICmpInst::ICMP_NE, Length, ConstantInt::get(Length->getType(), 0) };
+    return isKnownAt(NonEmpty, Preheader);
+}
+
+/// isRedundant - Returns whether the check C cannot fail.
+bool BoundsCheckElimination::isRedundant(const BoundsCheck &C) {
+    const Fact &F = C.Cond;
+
+    // Constant index into a static array.
+    ConstantInt *Index = dyn_cast<ConstantInt>(F.LHS);
+    ConstantInt *Length = dyn_cast<ConstantInt>(F.RHS);
+    if (Index && Length) {
+        if (F.Pred == ICmpInst::ICMP_ULT)
+            return Index->getValue().ult(Length->getValue());
+        return Index->getValue().ule(Length->getValue());
+    }
+
+    if (isKnownAt(F, C.Br->getParent()))
+        return true;
+
+    if (Loop *L = LI->getLoopFor(C.Br->getParent()))
+        return isInductionBelow(F.LHS, F.RHS, L);
+    return false;
+}
+
+/// hoist - Moves the loop invariant check C into the preheader of its loop,
+/// if it is performed at the start of every iteration anyway.
+bool BoundsCheckElimination::hoist(BoundsCheck &C) {
+    BasicBlock *BB = C.Br->getParent();
+    Loop *L = LI->getLoopFor(BB);
+    if (!L || !L->isLoopInvariant(C.Cond.LHS) || !L->isLoopInvariant(C.Cond.RHS))
+        return false;
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Preheader || !isa<BranchInst>(Preheader->getTerminator()))
+        return false;
+
+    // Nothing observable may happen between entering the loop and the check:
+    // all blocks from the header down to BB have to be executed
+    // unconditionally (except for the failure branches of other bounds
+    // checks), without any side effects.
+    BasicBlock *Header = L->getHeader();
+    for (BasicBlock *Cur = BB; ; ) {
+        for (BasicBlock::iterator I = Cur->begin(), E = Cur->end(); I != E; ++I)
+            if (I->mayHaveSideEffects())
+                return false;
+        if (Cur == Header)
+            break;
+        BasicBlock *Pred = Cur->getSinglePredecessor();
+        if (!Pred || !L->contains(Pred))
+            return false;
+        BranchInst *Br = dyn_cast<BranchInst>(Pred->getTerminator());
+        if (!Br || (Br->isConditional() && !Checks.count(Pred)))
+            return false;
+        Cur = Pred;
+    }
+
+    // The failure block must not depend on anything computed in the loop.
+    if (isa<PHINode>(C.Fail->begin()))
+        return false;
+    for (BasicBlock::iterator I = C.Fail->begin(), E = C.Fail->end(); I != E; ++I) {
+        for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI) {
+            Instruction *Op = dyn_cast<Instruction>(*OI);
+            if (Op && Op->getParent() != C.Fail && !DT->dominates(Op->getParent(), Preheader))
+                return false;
+        }
+    }
+
+    DEBUG(errs() << "BoundsCheckElimination hoisting: " << *C.Br);
+
+    // Check in a new block in front of the loop, which becomes the new
+    // preheader, so that more checks can be hoisted.
+    SplitEdge(Preheader, Header, this);
+    TerminatorInst *Term = Preheader->getTerminator();
+    ICmpInst *Cmp = new ICmpInst(Term, C.Cond.Pred, C.Cond.LHS, C.Cond.RHS, "boundscheck");
+    BranchInst::Create(Term->getSuccessor(0), C.Fail, Cmp, Preheader);
+    Term->eraseFromParent();
+
+    if (BasicBlock *FailDom = DT->findNearestCommonDominator(Preheader, C.Fail))
+        DT->changeImmediateDominator(C.Fail, FailDom);
+    return true;
+}
+
+/// runOnFunction - Top level algorithm.
+///
+bool BoundsCheckElimination::runOnFunction(Function &F) {
+    DEBUG(errs() << "\nRunning -dboundscheck on function " << F.getName() << '\n');
+
+    DT = &getAnalysis<DominatorTree>();
+    LI = &getAnalysis<LoopInfo>();
+
+    // Find the checks first, the failure blocks are shared by the two
+    // comparisons of slice bounds checks.
+    Checks.clear();
+    SmallVector<BasicBlock*, 16> Order;
+    for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+        BranchInst *Br = dyn_cast<BranchInst>(BB->getTerminator());
+        if (!Br || !Br->isConditional())
+            continue;
+
+        BoundsCheck C;
+        C.Br = Br;
+        unsigned OkIdx;
+        if (isFailBlock(Br->getSuccessor(1)))
+            OkIdx = 0;
+        else if (isFailBlock(Br->getSuccessor(0)))
+            OkIdx = 1;
+        else
+            continue;
+        C.Fail = Br->getSuccessor(1 - OkIdx);
+
+        if (!getBranchFact(BB, Br->getSuccessor(OkIdx), C.Cond))
+            continue;
+        if (C.Cond.Pred != ICmpInst::ICMP_ULT && C.Cond.Pred != ICmpInst::ICMP_ULE)
+            continue;
+
+        Checks[BB] = C;
+        Order.push_back(BB);
+    }
+
+    bool Changed = false;
+    for (unsigned i = 0, e = Order.size(); i != e; ++i) {
+        BoundsCheck &C = Checks[Order[i]];
+
+        bool Removed = isRedundant(C);
+        if (Removed) {
+            DEBUG(errs() << "BoundsCheckElimination removing: " << *C.Br);
+            ++NumChecksRemoved;
+        } else if (hoist(C)) {
+            ++NumChecksHoisted;
+            Removed = true;
+        }
+
+        // Leave the now dead failure branch to -simplifycfg.
+        if (Removed) {
+            bool OkOnTrue = C.Br->getSuccessor(1) == C.Fail;
+            C.Br->setCondition(ConstantInt::get(Type::getInt1Ty(F.getContext()), OkOnTrue));
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
@@ -0,0 +1,249 @@
+//===- ClosureFrame2Stack - Stack-allocate non-escaping closure frames ----===//
+//
+//                             The LLVM D Compiler
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The frontend allocates the frame of a function on the GC heap as soon as
+// one of its nested functions might be called after it has returned. Most of
+// the time, the delegate referencing the frame is only passed to opApply or
+// some other function which just calls it. Once those have been inlined (or
+// the nested function's context parameter has been found to be 'nocapture'),
+// the frame pointer provably does not escape, and this pass turns the
+// _d_allocmemory call back into an alloca.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dclosure2stack"
+
+#include "Passes.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumFramesToStack, "Number of closure frames promoted to allocas");
+STATISTIC(NumTooLarge, "Number of closure frames too large to promote");
+
+static cl::opt<unsigned>
+MaxFrameSize("dclosure2stack-max-size",
+    cl::desc("Largest closure frame (in bytes) to promote to the stack"),
+    cl::init(1024));
+
+// The frames are allocated with the alignment the GC would give them.
+static const unsigned FrameAlignment = 16;
+
+namespace {
+    /// This pass replaces non-escaping closure frame allocations with allocas.
+    ///
+    class LLVM_LIBRARY_VISIBILITY ClosureFrame2Stack : public FunctionPass {
+    public:
+        static char ID; // Pass identification
+        ClosureFrame2Stack() : FunctionPass(ID) {}
+
+        bool runOnFunction(Function &F);
+    };
+    char ClosureFrame2Stack::ID = 0;
+} // end anonymous namespace.
+
+static RegisterPass<ClosureFrame2Stack>
+X("dclosure2stack", "Promote non-escaping closure frames to stack");
+
+// Public interface to the pass.
+FunctionPass *createClosureFrame2Stack() {
+  return new ClosureFrame2Stack();
+}
+
+/// isInCycle - Returns whether BB can be reached from itself. An alloca in
+/// the entry block cannot stand in for an allocation executed more than once.
+static bool isInCycle(BasicBlock* BB) {
+    if (BB == &BB->getParent()->getEntryBlock())
+        return false;
+
+    SmallVector<BasicBlock*, 16> Worklist;
+    SmallPtrSet<BasicBlock*, 16> Visited;
+    Worklist.push_back(BB);
+    while (!Worklist.empty()) {
+        TerminatorInst* Term = Worklist.pop_back_val()->getTerminator();
+        for (unsigned i = 0, e = Term->getNumSuccessors(); i != e; ++i) {
+            BasicBlock* Succ = Term->getSuccessor(i);
+            if (Succ == BB)
+                return true;
+            if (Visited.insert(Succ))
+                Worklist.push_back(Succ);
+        }
+    }
+    return false;
+}
+
+/// isEscaping - Returns whether the frame pointer Frame (or anything derived
+/// from it) may outlive the current call of the function. Like LLVM's
+/// PointerMayBeCaptured(), but delegate calls are followed through the
+/// aggregates built for them.
+static bool isEscaping(Instruction* Frame) {
+    SmallVector<Use*, 16> Worklist;
+    SmallPtrSet<Use*, 16> Visited;
+
+    for (Value::use_iterator UI = Frame->use_begin(), UE = Frame->use_end();
+         UI != UE; ++UI) {
+        Use *U = &UI.getUse();
+        Visited.insert(U);
+        Worklist.push_back(U);
+    }
+
+    while (!Worklist.empty()) {
+        Use *U = Worklist.pop_back_val();
+        Instruction *I = cast<Instruction>(U->getUser());
+        Value* V = U->get();
+
+        switch (I->getOpcode()) {
+        case Instruction::Call:
+        case Instruction::Invoke: {
+            CallSite CS(I);
+            // Calling through the frame pointer (which never happens) or
+            // passing it as a 'nocapture' argument is fine.
+            if (CS.getCalledValue() == V)
+                break;
+            CallSite::arg_iterator B = CS.arg_begin(), E = CS.arg_end();
+            for (CallSite::arg_iterator A = B; A != E; ++A)
+                if (A->get() == V && !CS.paramHasAttr(A - B + 1, Attribute::NoCapture))
+                    return true;
+            break;
+        }
+        case Instruction::Load:
+        case Instruction::ICmp:
+            break;
+        case Instruction::Store:
+            // Storing the frame pointer anywhere may let it escape; storing
+            // to the frame is what it is there for.
+            if (V == I->getOperand(0))
+                return true;
+            break;
+        case Instruction::InsertValue: {
+            // The context pointer of a delegate. Only follow the delegate if
+            // its context pointer is extracted again and nothing else
+            // happens to it (the function pointer gets inserted afterwards).
+            if (V != I->getOperand(1))
+                return true;
+            ArrayRef<unsigned> Idxs = cast<InsertValueInst>(I)->getIndices();
+            SmallVector<Instruction*, 4> Aggrs;
+            Aggrs.push_back(I);
+            while (!Aggrs.empty()) {
+                Instruction* Aggr = Aggrs.pop_back_val();
+                for (Value::use_iterator UI = Aggr->use_begin(), UE = Aggr->use_end();
+                     UI != UE; ++UI) {
+                    if (ExtractValueInst* EVI = dyn_cast<ExtractValueInst>(*UI)) {
+                        if (!EVI->getIndices().equals(Idxs))
+                            continue;
+                        for (Value::use_iterator EI = EVI->use_begin(), EE = EVI->use_end();
+                             EI != EE; ++EI) {
+                            Use *EU = &EI.getUse();
+                            if (Visited.insert(EU))
+                                Worklist.push_back(EU);
+                        }
+                    } else if (InsertValueInst* IVI = dyn_cast<InsertValueInst>(*UI)) {
+                        if (IVI->getAggregateOperand() != Aggr || IVI->getIndices().equals(Idxs))
+                            return true;
+                        Aggrs.push_back(IVI);
+                    } else {
+                        return true;
+                    }
+                }
+            }
+            break;
+        }
+        case Instruction::BitCast:
+        case Instruction::GetElementPtr:
+        case Instruction::PHI:
+        case Instruction::Select:
+            // The original value does not escape via this if the new value
+            // does not.
+            for (Value::use_iterator UI = I->use_begin(), UE = I->use_end();
+                 UI != UE; ++UI) {
+                Use *DU = &UI.getUse();
+                if (Visited.insert(DU))
+                    Worklist.push_back(DU);
+            }
+            break;
+        default:
+            // Returned, converted to an integer, ... - be conservative.
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// runOnFunction - Top level algorithm.
+///
+bool ClosureFrame2Stack::runOnFunction(Function &F) {
+    DEBUG(errs() << "\nRunning -dclosure2stack on function " << F.getName() << '\n');
+
+    BasicBlock& Entry = F.getEntryBlock();
+
+    bool Changed = false;
+    for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+        for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ) {
+            Instruction* Inst = I++;
+            CallSite CS(Inst);
+            if (!CS.getInstruction())
+                continue;
+
+            // Closure frames come from _d_allocmemory, with a constant size.
+            Function *Callee = CS.getCalledFunction();
+            if (Callee == 0 || !Callee->isDeclaration() ||
+                    Callee->getName() != "_d_allocmemory" || CS.arg_size() != 1)
+                continue;
+            ConstantInt* Size = dyn_cast<ConstantInt>(CS.getArgument(0));
+            if (!Size)
+                continue;
+            // Frames capturing large static arrays could overflow the stack.
+            if (Size->getValue().ugt(MaxFrameSize)) {
+                ++NumTooLarge;
+                continue;
+            }
+
+            DEBUG(errs() << "ClosureFrame2Stack inspecting: " << *Inst);
+
+            if (isInCycle(BB) || isEscaping(Inst))
+                continue;
+
+            IRBuilder<> Builder(&Entry, Entry.begin());
+            Type* FrameTy = ArrayType::get(Builder.getInt8Ty(), Size->getZExtValue());
+            AllocaInst* Alloca = Builder.CreateAlloca(FrameTy, 0, ".stack_frame");
+            Alloca->setAlignment(FrameAlignment);
+            Value* NewVal = Builder.CreateBitCast(Alloca, Inst->getType());
+
+            DEBUG(errs() << "Promoted to: " << *Alloca);
+
+            if (InvokeInst* Invoke = dyn_cast<InvokeInst>(Inst)) {
+                // Keep the control flow intact, -simplifycfg will clean up.
+                BranchInst::Create(Invoke->getNormalDest(), Invoke->getUnwindDest(),
+                    ConstantInt::getTrue(F.getContext()), Invoke->getParent());
+            }
+            Inst->replaceAllUsesWith(NewVal);
+            NewVal->takeName(Inst);
+            Inst->eraseFromParent();
+
+            ++NumFramesToStack;
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
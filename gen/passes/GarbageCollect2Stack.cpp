@@ -29,7 +29,6 @@
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/Dominators.h"
-#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
@@ -42,9 +41,14 @@
 using namespace llvm;
 
 STATISTIC(NumGcToStack, "Number of calls promoted to constant-size allocas");
-STATISTIC(NumToDynSize, "Number of calls promoted to dynamically-sized allocas");
+STATISTIC(NumToDynSize, "Number of calls promoted to stack buffers with a GC fallback");
 STATISTIC(NumDeleted, "Number of GC calls deleted because the return value was unused");
 
+static cl::opt<unsigned>
+MaxStackSize("dgc2stack-max-size",
+    cl::desc("Largest allocation (in bytes) to promote to the stack"),
+    cl::init(1024));
+
 
 namespace {
     struct Analysis {
@@ -52,8 +56,10 @@ namespace {
         const Module& M;
         CallGraph* CG;
         CallGraphNode* CGNode;
-        
-        const Type* getTypeFor(Value* typeinfo) const;
+
+        MDNode* getMetadataFor(Value* typeinfo) const;
+        Type* getTypeFor(Value* typeinfo) const;
+        Constant* getElemInitFor(Value* typeinfo) const;
     };
 }
 
@@ -61,20 +67,16 @@ namespace {
 // Helper functions
 //===----------------------------------------------------------------------===//
 
+static void AddCallEdge(CallInst* CI, const Analysis& A) {
+    if (A.CGNode)
+        A.CGNode->addCalledFunction(CallSite(CI),
+            A.CG->getOrInsertFunction(CI->getCalledFunction()));
+}
+
 void EmitMemSet(IRBuilder<>& B, Value* Dst, Value* Val, Value* Len,
                 const Analysis& A) {
     Dst = B.CreateBitCast(Dst, PointerType::getUnqual(B.getInt8Ty()));
-    
-    Module *M = B.GetInsertBlock()->getParent()->getParent();
-    const Type* intTy = Len->getType();
-    const Type *VoidPtrTy = PointerType::getUnqual(B.getInt8Ty());
-    const Type *Tys[2] ={VoidPtrTy, intTy};
-    Function *MemSet = Intrinsic::getDeclaration(M, Intrinsic::memset, Tys, 2);
-    Value *Align = ConstantInt::get(B.getInt32Ty(), 1);
-    
-    CallSite CS = B.CreateCall5(MemSet, Dst, Val, Len, Align, B.getFalse());
-    if (A.CGNode)
-        A.CGNode->addCalledFunction(CS, A.CG->getOrInsertFunction(MemSet));
+    AddCallEdge(B.CreateMemSet(Dst, Val, Len, 1), A);
 }
 
 static void EmitMemZero(IRBuilder<>& B, Value* Dst, Value* Len,
@@ -82,117 +84,296 @@ static void EmitMemZero(IRBuilder<>& B, Value* Dst, Value* Len,
     EmitMemSet(B, Dst, ConstantInt::get(B.getInt8Ty(), 0), Len, A);
 }
 
+/// EmitInit - Stores Init to the Count elements starting at Ptr. Byte-sized
+/// initializers become a memset, everything else gets a loop. B is left
+/// pointing after the initialization.
+static void EmitInit(IRBuilder<>& B, Value* Ptr, Value* Count, Constant* Init,
+                     const Analysis& A) {
+    if (Init->getType()->isIntegerTy(8)) {
+        Value* Len = B.CreateIntCast(Count, A.TD.getIntPtrType(B.getContext()), false);
+        EmitMemSet(B, Ptr, Init, Len, A);
+        return;
+    }
+
+    Ptr = B.CreateBitCast(Ptr, PointerType::getUnqual(Init->getType()));
+
+    BasicBlock* Pre = B.GetInsertBlock();
+    BasicBlock* Exit = Pre->splitBasicBlock(B.GetInsertPoint(), "gc2stack.initdone");
+    BasicBlock* Loop = BasicBlock::Create(B.getContext(), "gc2stack.init",
+                                          Pre->getParent(), Exit);
+    Pre->getTerminator()->eraseFromParent();
+    B.SetInsertPoint(Pre);
+    Value* Zero = ConstantInt::get(Count->getType(), 0);
+    B.CreateCondBr(B.CreateICmpEQ(Count, Zero), Exit, Loop);
+
+    B.SetInsertPoint(Loop);
+    PHINode* Idx = B.CreatePHI(Count->getType(), 2);
+    Idx->addIncoming(Zero, Pre);
+    B.CreateStore(Init, B.CreateGEP(Ptr, Idx));
+    Value* Next = B.CreateAdd(Idx, ConstantInt::get(Count->getType(), 1));
+    Idx->addIncoming(Next, Loop);
+    B.CreateCondBr(B.CreateICmpEQ(Next, Count), Exit, Loop);
+
+    B.SetInsertPoint(Exit, Exit->begin());
+}
+
 
 //===----------------------------------------------------------------------===//
 // Helpers for specific types of GC calls.
 //===----------------------------------------------------------------------===//
 
 namespace {
+    // How promoted memory needs to be initialized.
+    enum InitKind {
+        NoInit,         // Uninitialized.
+        ZeroInit,       // Zero-initialized.
+        ElemInit        // Every element set to its default initializer.
+    };
+
     class FunctionInfo {
     protected:
-        const Type* Ty;
-        
+        Type* Ty;
+
     public:
         unsigned TypeInfoArgNr;
         bool SafeToDelete;
-        
+
         // Analyze the current call, filling in some fields. Returns true if
         // this is an allocation we can stack-allocate.
         virtual bool analyze(CallSite CS, const Analysis& A) {
             Value* TypeInfo = CS.getArgument(TypeInfoArgNr);
             Ty = A.getTypeFor(TypeInfo);
-            return (Ty != NULL);
+            return Ty != NULL && A.TD.getTypeAllocSize(Ty) <= MaxStackSize;
         }
-        
-        // Returns the alloca to replace this call.
-        // It will always be inserted before the call.
-        virtual AllocaInst* promote(CallSite CS, IRBuilder<>& B, const Analysis& A) {
+
+        // Returns the value to replace this call with. B is positioned at
+        // the call. The call is deleted afterwards, unless it is still used
+        // (e.g. as a fallback).
+        virtual Value* promote(CallSite CS, IRBuilder<>& B, const Analysis& A) {
             NumGcToStack++;
-            
+
             Instruction* Begin = CS.getCaller()->getEntryBlock().begin();
             return new AllocaInst(Ty, ".nongc_mem", Begin); // FIXME: align?
         }
-        
+
         FunctionInfo(unsigned typeInfoArgNr, bool safeToDelete)
         : TypeInfoArgNr(typeInfoArgNr), SafeToDelete(safeToDelete) {}
     };
-    
+
+    // Builds the return value of the D2 array allocation functions (a void[])
+    // from the length and pointer of the new array. The D1 ones just return
+    // the pointer.
+    static Value* MakeArrayResult(CallSite CS, IRBuilder<>& B, Value* Len, Value* Ptr) {
+        Type* RetTy = CS.getType();
+        if (!isa<StructType>(RetTy))
+            return Ptr;
+        StructType* SliceTy = cast<StructType>(RetTy);
+        Value* Res = UndefValue::get(RetTy);
+        Res = B.CreateInsertValue(Res, B.CreateIntCast(Len, SliceTy->getElementType(0), false), 0);
+        Res = B.CreateInsertValue(Res, B.CreateBitCast(Ptr, SliceTy->getElementType(1)), 1);
+        return Res;
+    }
+
     class ArrayFI : public FunctionInfo {
         Value* arrSize;
         int ArrSizeArgNr;
-        bool Initialized;
-        
+        InitKind Init;
+        Constant* InitVal;
+
     public:
-        ArrayFI(unsigned tiArgNr, bool safeToDelete, bool initialized,
+        ArrayFI(unsigned tiArgNr, bool safeToDelete, InitKind init,
                 unsigned arrSizeArgNr)
         : FunctionInfo(tiArgNr, safeToDelete),
           ArrSizeArgNr(arrSizeArgNr),
-          Initialized(initialized)
+          Init(init)
         {}
-        
+
         virtual bool analyze(CallSite CS, const Analysis& A) {
-            if (!FunctionInfo::analyze(CS, A))
+            Value* TypeInfo = CS.getArgument(TypeInfoArgNr);
+            Ty = A.getTypeFor(TypeInfo);
+            if (!Ty)
                 return false;
-            
+            if (Init == ElemInit && !(InitVal = A.getElemInitFor(TypeInfo)))
+                return false;
+
             arrSize = CS.getArgument(ArrSizeArgNr);
-            const IntegerType* SizeType =
-                dyn_cast<IntegerType>(arrSize->getType());
-            if (!SizeType)
+            if (!isa<IntegerType>(arrSize->getType()))
                 return false;
-            unsigned bits = SizeType->getBitWidth();
-            if (bits > 32) {
-                // The array size of an alloca must be an i32, so make sure
-                // the conversion is safe.
-                APInt Mask = APInt::getHighBitsSet(bits, bits - 32);
-                APInt KnownZero(bits, 0), KnownOne(bits, 0);
-                ComputeMaskedBits(arrSize, Mask, KnownZero, KnownOne, &A.TD);
-                if ((KnownZero & Mask) != Mask)
-                    return false;
-            }
             // Extract the element type from the array type.
-            const StructType* ArrTy = dyn_cast<StructType>(Ty);
+            StructType* ArrTy = dyn_cast<StructType>(Ty);
             assert(ArrTy && "Dynamic array type not a struct?");
             assert(isa<IntegerType>(ArrTy->getElementType(0)));
-            const PointerType* PtrTy =
+            PointerType* PtrTy =
                 cast<PointerType>(ArrTy->getElementType(1));
             Ty = PtrTy->getElementType();
-            return true;
+
+            uint64_t ElemSize = A.TD.getTypeAllocSize(Ty);
+            if (ConstantInt* C = dyn_cast<ConstantInt>(arrSize))
+                return C->getValue().ule(MaxStackSize / (ElemSize ? ElemSize : 1));
+            // Dynamically-sized arrays get a stack buffer of the maximum
+            // size and fall back to the GC if they don't fit. The call needs
+            // to stay where it is for that, so invokes are left alone.
+            return isa<CallInst>(CS.getInstruction()) && ElemSize != 0 &&
+                ElemSize <= MaxStackSize;
+        }
+
+        void emitInit(IRBuilder<>& B, Value* Ptr, Value* Count, const Analysis& A) {
+            if (Init == ZeroInit) {
+                uint64_t size = A.TD.getTypeStoreSize(Ty);
+                Value* TypeSize = ConstantInt::get(Count->getType(), size);
+                Value* Size = B.CreateMul(TypeSize, Count);
+                EmitMemZero(B, Ptr, Size, A);
+            } else if (Init == ElemInit) {
+                EmitInit(B, Ptr, Count, InitVal, A);
+            }
         }
-        
-        virtual AllocaInst* promote(CallSite CS, IRBuilder<>& B, const Analysis& A) {
-            IRBuilder<> Builder = B;
-            // If the allocation is of constant size it's best to put it in the
-            // entry block, so do so if we're not already there.
-            // For dynamically-sized allocations it's best to avoid the overhead
-            // of allocating them if possible, so leave those where they are.
-            // While we're at it, update statistics too.
+
+        virtual Value* promote(CallSite CS, IRBuilder<>& B, const Analysis& A) {
+            BasicBlock& Entry = CS.getCaller()->getEntryBlock();
+            IRBuilder<> AllocaBuilder(&Entry, Entry.begin());
+
+            // Constant-size allocations are simply replaced by an alloca in
+            // the entry block.
             if (isa<Constant>(arrSize)) {
-                BasicBlock& Entry = CS.getCaller()->getEntryBlock();
-                if (Builder.GetInsertBlock() != &Entry)
-                    Builder.SetInsertPoint(&Entry, Entry.begin());
                 NumGcToStack++;
-            } else {
-                NumToDynSize++;
+                Value* count = AllocaBuilder.CreateIntCast(arrSize, B.getInt32Ty(), false);
+                AllocaInst* alloca = AllocaBuilder.CreateAlloca(Ty, count, ".nongc_mem"); // FIXME: align?
+                // Put initialization at the allocation site.
+                emitInit(B, alloca, arrSize, A);
+                return MakeArrayResult(CS, B, arrSize, alloca);
             }
-            
-            // Convert array size to 32 bits if necessary
-            Value* count = Builder.CreateIntCast(arrSize, Builder.getInt32Ty(), false);
-            AllocaInst* alloca = Builder.CreateAlloca(Ty, count, ".nongc_mem"); // FIXME: align?
-            
-            if (Initialized) {
-                // For now, only zero-init is supported.
-                uint64_t size = A.TD.getTypeStoreSize(Ty);
-                Value* TypeSize = ConstantInt::get(arrSize->getType(), size);
-                // Use the original B to put initialization at the
-                // allocation site.
-                Value* Size = B.CreateMul(TypeSize, arrSize);
-                EmitMemZero(B, alloca, Size, A);
+
+            // Otherwise, use a buffer of the maximum size if the array fits
+            // and call the GC as before if it doesn't:
+            //   if (arrSize <= MaxElems) { init(buffer); res = buffer; }
+            //   else res = gc_alloc(...);
+            NumToDynSize++;
+            uint64_t MaxElems = MaxStackSize / A.TD.getTypeAllocSize(Ty);
+            AllocaInst* buffer = AllocaBuilder.CreateAlloca(
+                ArrayType::get(Ty, MaxElems), 0, ".nongc_buf");
+
+            // Heap gets the call, Join everything after it.
+            Instruction* Call = CS.getInstruction();
+            BasicBlock* Pre = Call->getParent();
+            BasicBlock* Heap = Pre->splitBasicBlock(Call, "gc2stack.heap");
+            BasicBlock* Join = Heap->splitBasicBlock(++BasicBlock::iterator(Call), "gc2stack.join");
+
+            BasicBlock* Stack = BasicBlock::Create(B.getContext(), "gc2stack.stack",
+                                                  Pre->getParent(), Heap);
+            Pre->getTerminator()->eraseFromParent();
+            B.SetInsertPoint(Pre);
+            Value* Fits = B.CreateICmpULE(arrSize, ConstantInt::get(arrSize->getType(), MaxElems));
+            B.CreateCondBr(Fits, Stack, Heap);
+
+            B.SetInsertPoint(BranchInst::Create(Join, Stack));
+            Value* Ptr = B.CreateConstInBoundsGEP2_32(buffer, 0, 0);
+            emitInit(B, Ptr, arrSize, A);
+            Value* StackRes = MakeArrayResult(CS, B, arrSize, Ptr);
+            BasicBlock* StackEnd = B.GetInsertBlock();
+
+            B.SetInsertPoint(Join, Join->begin());
+            PHINode* Res = B.CreatePHI(Call->getType(), 2, ".gc2stack_mem");
+            Res->addIncoming(StackRes, StackEnd);
+            Res->addIncoming(Call, Heap);
+            return Res;
+        }
+    };
+
+    // FunctionInfo for the D2 multi-dimensional array allocations,
+    // void[] _d_newarraymT(TypeInfo ti, size_t ndims, ...), with the
+    // dimensions passed as varargs. Only arrays of constant dimensions are
+    // handled; they are laid out as one block of slices per dimension.
+    class MultiArrayFI : public FunctionInfo {
+        InitKind Init;
+        Constant* InitVal;
+        SmallVector<uint64_t, 4> Dims;
+        // The element type of each dimension (the last one is the scalar
+        // element type).
+        SmallVector<Type*, 4> ElemTys;
+
+    public:
+        MultiArrayFI(unsigned tiArgNr, InitKind init)
+        : FunctionInfo(tiArgNr, true), Init(init) {}
+
+        virtual bool analyze(CallSite CS, const Analysis& A) {
+            Value* TypeInfo = CS.getArgument(TypeInfoArgNr);
+            Ty = A.getTypeFor(TypeInfo);
+            if (!Ty)
+                return false;
+            if (Init == ElemInit && !(InitVal = A.getElemInitFor(TypeInfo)))
+                return false;
+
+            ConstantInt* NDims = dyn_cast<ConstantInt>(CS.getArgument(1));
+            if (!NDims || CS.arg_size() != 2 + NDims->getZExtValue())
+                return false;
+
+            Dims.clear();
+            ElemTys.clear();
+            uint64_t Count = 1, Size = 0;
+            Type* T = Ty;
+            for (unsigned i = 0; i < NDims->getZExtValue(); i++) {
+                ConstantInt* Dim = dyn_cast<ConstantInt>(CS.getArgument(2 + i));
+                StructType* ArrTy = dyn_cast<StructType>(T);
+                if (!Dim || !ArrTy || ArrTy->getNumElements() != 2 ||
+                        !ArrTy->getElementType(1)->isPointerTy())
+                    return false;
+                T = cast<PointerType>(ArrTy->getElementType(1))->getElementType();
+                Count *= Dim->getZExtValue();
+                Size += Count * A.TD.getTypeAllocSize(T);
+                if (Size > MaxStackSize)
+                    return false;
+                Dims.push_back(Dim->getZExtValue());
+                ElemTys.push_back(T);
+            }
+            return !Dims.empty() && isa<StructType>(CS.getType());
+        }
+
+        virtual Value* promote(CallSite CS, IRBuilder<>& B, const Analysis& A) {
+            NumGcToStack++;
+
+            BasicBlock& Entry = CS.getCaller()->getEntryBlock();
+            IRBuilder<> AllocaBuilder(&Entry, Entry.begin());
+
+            // One alloca per dimension.
+            SmallVector<Value*, 4> Levels;
+            uint64_t Count = 1;
+            for (unsigned i = 0; i < Dims.size(); i++) {
+                Count *= Dims[i];
+                Levels.push_back(AllocaBuilder.CreateAlloca(
+                    ArrayType::get(ElemTys[i], Count), 0, ".nongc_mem"));
+            }
+
+            // Point the slices of each dimension into the next one.
+            Count = 1;
+            for (unsigned i = 0; i + 1 < Dims.size(); i++) {
+                Count *= Dims[i];
+                StructType* SliceTy = cast<StructType>(ElemTys[i]);
+                for (uint64_t j = 0; j < Count; j++) {
+                    Value* Slice = UndefValue::get(SliceTy);
+                    Slice = B.CreateInsertValue(Slice,
+                        ConstantInt::get(SliceTy->getElementType(0), Dims[i + 1]), 0);
+                    Slice = B.CreateInsertValue(Slice,
+                        B.CreateConstInBoundsGEP2_64(Levels[i + 1], 0, j * Dims[i + 1]), 1);
+                    B.CreateStore(Slice, B.CreateConstInBoundsGEP2_64(Levels[i], 0, j));
+                }
+            }
+
+            // Initialize the scalars.
+            Count *= Dims.back();
+            Value* Elems = B.CreateConstInBoundsGEP2_32(Levels.back(), 0, 0);
+            Value* NElems = ConstantInt::get(A.TD.getIntPtrType(B.getContext()), Count);
+            if (Init == ZeroInit) {
+                uint64_t size = A.TD.getTypeStoreSize(ElemTys.back());
+                EmitMemZero(B, Elems, ConstantInt::get(NElems->getType(), size * Count), A);
+            } else if (Init == ElemInit) {
+                EmitInit(B, Elems, NElems, InitVal, A);
             }
-            
-            return alloca;
+
+            Value* First = B.CreateConstInBoundsGEP2_32(Levels[0], 0, 0);
+            return MakeArrayResult(CS, B, ConstantInt::get(NElems->getType(), Dims[0]), First);
         }
     };
-    
+
     // FunctionInfo for _d_allocclass
     class AllocClassFI : public FunctionInfo {
         public:
@@ -213,7 +394,7 @@ namespace {
             if (!meta)
                 return false;
 
-            MDNode* node = static_cast<MDNode*>(meta->getElement(0));
+            MDNode* node = meta->getOperand(0);
             if (!node || MD_GetNumElements(node) != CD_NumFields)
                 return false;
 
@@ -226,17 +407,17 @@ namespace {
             Constant* hasCustomDelete = dyn_cast<Constant>(MD_GetElement(node, CD_CustomDelete));
             if (hasDestructor == NULL || hasCustomDelete == NULL)
                 return false;
-            
+
             if (ConstantExpr::getOr(hasDestructor, hasCustomDelete)
                     != ConstantInt::getFalse(A.M.getContext()))
                 return false;
-            
+
             Ty = MD_GetElement(node, CD_BodyType)->getType();
-            return true;
+            return A.TD.getTypeAllocSize(Ty) <= MaxStackSize;
         }
-        
+
         // The default promote() should be fine.
-        
+
         AllocClassFI() : FunctionInfo(~0u, true) {}
     };
 }
@@ -252,29 +433,31 @@ namespace {
     class LLVM_LIBRARY_VISIBILITY GarbageCollect2Stack : public FunctionPass {
         StringMap<FunctionInfo*> KnownFunctions;
         Module* M;
-        
+
         FunctionInfo AllocMemoryT;
         ArrayFI NewArrayVT;
         ArrayFI NewArrayT;
+        ArrayFI NewArrayIT;
+        MultiArrayFI NewArrayMT;
+        MultiArrayFI NewArrayMIT;
         AllocClassFI AllocClass;
-        
+
     public:
         static char ID; // Pass identification
         GarbageCollect2Stack();
-        
+
         bool doInitialization(Module &M) {
             this->M = &M;
             return false;
         }
-        
+
         bool runOnFunction(Function &F);
-        
+
         virtual void getAnalysisUsage(AnalysisUsage &AU) const {
           AU.addRequired<TargetData>();
           AU.addRequired<DominatorTree>();
-          
+
           AU.addPreserved<CallGraph>();
-          AU.addPreserved<DominatorTree>();
         }
     };
     char GarbageCollect2Stack::ID = 0;
@@ -285,18 +468,26 @@ X("dgc2stack", "Promote (GC'ed) heap allocations to stack");
 
 // Public interface to the pass.
 FunctionPass *createGarbageCollect2Stack() {
-  return new GarbageCollect2Stack(); 
+  return new GarbageCollect2Stack();
 }
 
 GarbageCollect2Stack::GarbageCollect2Stack()
-: FunctionPass(&ID),
+: FunctionPass(ID),
   AllocMemoryT(0, true),
-  NewArrayVT(0, true, false, 1),
-  NewArrayT(0, true, true, 1)
+  NewArrayVT(0, true, NoInit, 1),
+  NewArrayT(0, true, ZeroInit, 1),
+  NewArrayIT(0, true, ElemInit, 1),
+  NewArrayMT(0, ZeroInit),
+  NewArrayMIT(0, ElemInit)
 {
     KnownFunctions["_d_allocmemoryT"] = &AllocMemoryT;
     KnownFunctions["_d_newarrayvT"] = &NewArrayVT;
     KnownFunctions["_d_newarrayT"] = &NewArrayT;
+    KnownFunctions["_d_newarrayiT"] = &NewArrayIT;
+#if DMDV2
+    KnownFunctions["_d_newarraymT"] = &NewArrayMT;
+    KnownFunctions["_d_newarraymiT"] = &NewArrayMIT;
+#endif
     KnownFunctions[_d_allocclass] = &AllocClass;
 }
 
@@ -305,7 +496,7 @@ static void RemoveCall(CallSite CS, const Analysis& A) {
         InvokeInst* Invoke = cast<InvokeInst>(CS.getInstruction());
         // If this was an invoke instruction, we need to do some extra
         // work to preserve the control flow.
-        
+
         // Create a "conditional" branch that -simplifycfg can clean up, so we
         // can keep using the DominatorTree without updating it.
         BranchInst::Create(Invoke->getNormalDest(), Invoke->getUnwindDest(),
@@ -323,81 +514,102 @@ static bool isSafeToStackAllocate(Instruction* Alloc, DominatorTree& DT);
 ///
 bool GarbageCollect2Stack::runOnFunction(Function &F) {
     DEBUG(errs() << "\nRunning -dgc2stack on function " << F.getName() << '\n');
-    
+
     TargetData& TD = getAnalysis<TargetData>();
     DominatorTree& DT = getAnalysis<DominatorTree>();
     CallGraph* CG = getAnalysisIfAvailable<CallGraph>();
     CallGraphNode* CGNode = CG ? (*CG)[&F] : NULL;
-    
+
     Analysis A = { TD, *M, CG, CGNode };
-    
-    BasicBlock& Entry = F.getEntryBlock();
-    
-    IRBuilder<> AllocaBuilder(&Entry, Entry.begin());
-    
+
+    // Promoting dynamically-sized allocations changes the CFG, so the calls
+    // are all analyzed (using the DominatorTree) before any is promoted.
+    typedef std::pair<CallSite, FunctionInfo*> Candidate;
+    SmallVector<Candidate, 16> Candidates;
+
     bool Changed = false;
     for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
         for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ) {
             // Ignore non-calls.
             Instruction* Inst = I++;
-            CallSite CS = CallSite::get(Inst);
+            CallSite CS(Inst);
             if (!CS.getInstruction())
                 continue;
-            
+
             // Ignore indirect calls and calls to non-external functions.
             Function *Callee = CS.getCalledFunction();
             if (Callee == 0 || !Callee->isDeclaration() ||
                     !(Callee->hasExternalLinkage() || Callee->hasDLLImportLinkage()))
                 continue;
-            
+
             // Ignore unknown calls.
             StringMap<FunctionInfo*>::iterator OMI =
                 KnownFunctions.find(Callee->getName());
             if (OMI == KnownFunctions.end()) continue;
-            
-            assert(isa<PointerType>(Inst->getType())
-                && "GC function doesn't return a pointer?");
-            
+
             FunctionInfo* info = OMI->getValue();
-            
+
             if (Inst->use_empty() && info->SafeToDelete) {
                 Changed = true;
                 NumDeleted++;
                 RemoveCall(CS, A);
                 continue;
             }
-            
+
             DEBUG(errs() << "GarbageCollect2Stack inspecting: " << *Inst);
-            
-            if (!info->analyze(CS, A) || !isSafeToStackAllocate(Inst, DT))
-                continue;
-            
-            // Let's alloca this!
-            Changed = true;
-            
-            IRBuilder<> Builder(BB, Inst);
-            Value* newVal = info->promote(CS, Builder, A);
-            
-            DEBUG(errs() << "Promoted to: " << *newVal);
-            
-            // Make sure the type is the same as it was before, and replace all
-            // uses of the runtime call with the alloca.
-            if (newVal->getType() != Inst->getType())
-                newVal = Builder.CreateBitCast(newVal, Inst->getType());
-            Inst->replaceAllUsesWith(newVal);
-            
-            RemoveCall(CS, A);
+
+            if (info->analyze(CS, A) && isSafeToStackAllocate(Inst, DT))
+                Candidates.push_back(Candidate(CS, info));
+        }
+    }
+
+    for (size_t i = 0; i < Candidates.size(); i++) {
+        CallSite CS = Candidates[i].first;
+        FunctionInfo* info = Candidates[i].second;
+        Instruction* Inst = CS.getInstruction();
+
+        // The analysis results are gone by now, so redo them. This cannot
+        // fail, only the CFG has changed since.
+        bool ok = info->analyze(CS, A);
+        assert(ok && "Promotable allocation changed?");
+        (void)ok;
+
+        // Let's alloca this!
+        Changed = true;
+
+        IRBuilder<> Builder(Inst->getParent(), Inst);
+        Value* newVal = info->promote(CS, Builder, A);
+
+        DEBUG(errs() << "Promoted to: " << *newVal);
+
+        // Make sure the type is the same as it was before, and replace all
+        // uses of the runtime call with the new value. If the call is kept
+        // as a fallback, only its original uses are replaced.
+        if (newVal->getType() != Inst->getType())
+            newVal = Builder.CreateBitCast(newVal, Inst->getType());
+        if (PHINode* Phi = dyn_cast<PHINode>(newVal)) {
+            SmallVector<Use*, 16> Uses;
+            for (Value::use_iterator UI = Inst->use_begin(), UE = Inst->use_end();
+                 UI != UE; ++UI)
+                if (*UI != Phi)
+                    Uses.push_back(&UI.getUse());
+            for (size_t j = 0; j < Uses.size(); j++)
+                Uses[j]->set(Phi);
+            continue;
         }
+        Inst->replaceAllUsesWith(newVal);
+
+        RemoveCall(CS, A);
     }
-    
+
     return Changed;
 }
 
-const Type* Analysis::getTypeFor(Value* typeinfo) const {
+MDNode* Analysis::getMetadataFor(Value* typeinfo) const {
     GlobalVariable* ti_global = dyn_cast<GlobalVariable>(typeinfo->stripPointerCasts());
     if (!ti_global)
         return NULL;
-    
+
     std::string metaname = TD_PREFIX;
     metaname += ti_global->getName();
 
@@ -405,7 +617,7 @@ const Type* Analysis::getTypeFor(Value* typeinfo) const {
     if (!meta)
         return NULL;
 
-    MDNode* node = static_cast<MDNode*>(meta->getElement(0));
+    MDNode* node = meta->getOperand(0);
     if (!node)
         return NULL;
 
@@ -414,15 +626,25 @@ const Type* Analysis::getTypeFor(Value* typeinfo) const {
     if (TD_Confirm >= 0 && (!MD_GetElement(node, TD_Confirm) ||
             MD_GetElement(node, TD_Confirm)->stripPointerCasts() != ti_global))
         return NULL;
-    
-    return MD_GetElement(node, TD_Type)->getType();
+
+    return node;
+}
+
+Type* Analysis::getTypeFor(Value* typeinfo) const {
+    MDNode* node = getMetadataFor(typeinfo);
+    return node ? MD_GetElement(node, TD_Type)->getType() : NULL;
+}
+
+Constant* Analysis::getElemInitFor(Value* typeinfo) const {
+    MDNode* node = getMetadataFor(typeinfo);
+    return node ? dyn_cast_or_null<Constant>(MD_GetElement(node, TD_ElemInit)) : NULL;
 }
 
 /// Returns whether Def is used by any instruction that is reachable from Alloc
 /// (without executing Def again).
 static bool mayBeUsedAfterRealloc(Instruction* Def, Instruction* Alloc, DominatorTree& DT) {
     DEBUG(errs() << "### mayBeUsedAfterRealloc()\n" << *Def << *Alloc);
-    
+
     // If the definition isn't used it obviously won't be used after the
     // allocation.
     // If it does not dominate the allocation, there's no way for it to be used
@@ -432,12 +654,12 @@ static bool mayBeUsedAfterRealloc(Instruction* Def, Instruction* Alloc, Dominato
         DEBUG(errs() << "### No uses or does not dominate allocation\n");
         return false;
     }
-    
+
     DEBUG(errs() << "### Def dominates Alloc\n");
-    
+
     BasicBlock* DefBlock = Def->getParent();
     BasicBlock* AllocBlock = Alloc->getParent();
-    
+
     // Create a set of users and one of blocks containing users.
     SmallSet<User*, 16> Users;
     SmallSet<BasicBlock*, 16> UserBlocks;
@@ -446,7 +668,7 @@ static bool mayBeUsedAfterRealloc(Instruction* Def, Instruction* Alloc, Dominato
         Instruction* User = cast<Instruction>(*UI);
         DEBUG(errs() << "USER: " << *User);
         BasicBlock* UserBlock = User->getParent();
-        
+
         // This dominance check is not performed if they're in the same block
         // because it will just walk the instruction list to figure it out.
         // We will instead do that ourselves in the first iteration (for all
@@ -457,34 +679,34 @@ static bool mayBeUsedAfterRealloc(Instruction* Def, Instruction* Alloc, Dominato
             DEBUG(errs() << "### Alloc dominates user " << *User);
             return true;
         }
-        
+
         // Phi nodes are checked separately, so no need to enter them here.
         if (!isa<PHINode>(User)) {
             Users.insert(User);
             UserBlocks.insert(UserBlock);
         }
     }
-    
+
     // Contains first instruction of block to inspect.
     typedef std::pair<BasicBlock*, BasicBlock::iterator> StartPoint;
     SmallVector<StartPoint, 16> Worklist;
     // Keeps track of successors that have been added to the work list.
     SmallSet<BasicBlock*, 16> Visited;
-    
+
     // Start just after the allocation.
     // Note that we don't insert AllocBlock into the Visited set here so the
     // start of the block will get inspected if it's reachable.
     BasicBlock::iterator Start = Alloc;
     ++Start;
     Worklist.push_back(StartPoint(AllocBlock, Start));
-    
+
     while (!Worklist.empty()) {
         StartPoint sp = Worklist.pop_back_val();
         BasicBlock* B = sp.first;
         BasicBlock::iterator BBI = sp.second;
         // BBI is either just after the allocation (in the first iteration)
         // or just after the last phi node in B (in subsequent iterations) here.
-        
+
         // This whole 'if' is just a way to avoid performing the inner 'for'
         // loop when it can be determined not to be necessary, avoiding
         // potentially expensive walks of the instruction list.
@@ -517,7 +739,7 @@ static bool mayBeUsedAfterRealloc(Instruction* Def, Instruction* Alloc, Dominato
             // No users and no definition or allocation after the start point,
             // so just keep going.
         }
-        
+
         // All instructions after the starting point in this block have been
         // accounted for. Look for successors to add to the work list.
         TerminatorInst* Term = B->getTerminator();
@@ -555,43 +777,45 @@ static bool mayBeUsedAfterRealloc(Instruction* Def, Instruction* Alloc, Dominato
 /// escape from the function and no derived pointers are live at the call site
 /// (i.e. if it's in a loop then the function can't use any pointer returned
 /// from an earlier call after a new call has been made)
-/// 
+///
 /// This is currently conservative where loops are involved: it can handle
 /// simple loops, but returns false if any derived pointer is used in a
 /// subsequent iteration.
-/// 
+///
 /// Based on LLVM's PointerMayBeCaptured(), which only does escape analysis but
-/// doesn't care about loops.
+/// doesn't care about loops. Unlike that, it also follows the pointer through
+/// the D2 array slices ({ length, ptr } aggregates) containing it.
 bool isSafeToStackAllocate(Instruction* Alloc, DominatorTree& DT) {
-  assert(isa<PointerType>(Alloc->getType()) && "Allocation is not a pointer?");
+  assert((isa<PointerType>(Alloc->getType()) || isa<StructType>(Alloc->getType()))
+    && "Allocation is not a pointer or slice?");
   Value* V = Alloc;
-  
+
   SmallVector<Use*, 16> Worklist;
   SmallSet<Use*, 16> Visited;
-  
+
   for (Value::use_iterator UI = V->use_begin(), UE = V->use_end();
        UI != UE; ++UI) {
     Use *U = &UI.getUse();
     Visited.insert(U);
     Worklist.push_back(U);
   }
-  
+
   while (!Worklist.empty()) {
     Use *U = Worklist.pop_back_val();
     Instruction *I = cast<Instruction>(U->getUser());
     V = U->get();
-    
+
     switch (I->getOpcode()) {
     case Instruction::Call:
     case Instruction::Invoke: {
-      CallSite CS = CallSite::get(I);
+      CallSite CS(I);
       // Not captured if the callee is readonly, doesn't return a copy through
       // its return value and doesn't unwind (a readonly function can leak bits
       // by throwing an exception or not depending on the input value).
       if (CS.onlyReadsMemory() && CS.doesNotThrow() &&
           I->getType() == Type::getVoidTy(I->getContext()))
         break;
-      
+
       // Not captured if only passed via 'nocapture' arguments.  Note that
       // calling a function pointer does not in itself cause the pointer to
       // be captured.  This is a subtle point considering that (for example)
@@ -601,16 +825,15 @@ bool isSafeToStackAllocate(Instruction* Alloc, DominatorTree& DT) {
       // (think of self-referential objects).
       CallSite::arg_iterator B = CS.arg_begin(), E = CS.arg_end();
       for (CallSite::arg_iterator A = B; A != E; ++A)
-        if (A->get() == V && !CS.paramHasAttr(A - B + 1, Attribute::NoCapture))
-          // The parameter is not marked 'nocapture' - captured.
+        if (A->get() == V && (!isa<PointerType>(V->getType()) ||
+            !CS.paramHasAttr(A - B + 1, Attribute::NoCapture)))
+          // The parameter is not marked 'nocapture' (or is a slice) -
+          // captured.
           return false;
       // Only passed via 'nocapture' arguments, or is the called function - not
       // captured.
       break;
     }
-    case Instruction::Free:
-      // Freeing a pointer does not cause it to be captured.
-      break;
     case Instruction::Load:
       // Loading from a pointer does not cause it to be captured.
       break;
@@ -620,15 +843,21 @@ bool isSafeToStackAllocate(Instruction* Alloc, DominatorTree& DT) {
         return false;
       // Storing to the pointee does not cause the pointer to be captured.
       break;
+    case Instruction::ExtractValue:
+      // The length of a slice is of no interest.
+      if (!isa<PointerType>(I->getType()))
+        break;
+      // Fall through.
     case Instruction::BitCast:
     case Instruction::GetElementPtr:
     case Instruction::PHI:
     case Instruction::Select:
+    case Instruction::InsertValue:
       // It's not safe to stack-allocate if this derived pointer is live across
       // the original allocation.
       if (mayBeUsedAfterRealloc(I, Alloc, DT))
         return false;
-      
+
       // The original value is not captured via this if the new value isn't.
       for (Instruction::use_iterator UI = I->use_begin(), UE = I->use_end();
            UI != UE; ++UI) {
@@ -642,7 +871,7 @@ bool isSafeToStackAllocate(Instruction* Alloc, DominatorTree& DT) {
       return false;
     }
   }
-  
+
   // All uses examined - not captured or live across original allocation.
   return true;
 }
@@ -12,8 +12,19 @@ llvm::FunctionPass* createSimplifyDRuntimeCalls();
 
 #if USE_METADATA
 llvm::FunctionPass* createGarbageCollect2Stack();
+
+// Guards direct calls of the implementations the frontend found to be the
+// only ones of virtual functions.
+llvm::FunctionPass* createSpeculativeDevirtualization();
 #endif // USE_METADATA
 
+// Turns closure frames which do not escape into stack memory.
+llvm::FunctionPass* createClosureFrame2Stack();
+
+// Removes array bounds checks which cannot fail, and hoists loop invariant
+// ones out of loops.
+llvm::FunctionPass* createBoundsCheckElimination();
+
 llvm::ModulePass* createStripExternalsPass();
 
 #endif
@@ -0,0 +1,184 @@
+//===- SpeculativeDevirtualization - Guard direct calls of virtual functions ===//
+//
+//                             The LLVM D Compiler
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -singleobj, the frontend tags the vtbl loads of virtual calls with the
+// implementation of the function if no class known to the compilation
+// overrides it (see DtoVirtualFunctionPointer). Classes from other object
+// files or libraries may still do so, so the calls are rewritten into
+//
+//   if (fptr == &impl) impl(...); else fptr(...);
+//
+// The direct call can then be inlined, and the comparison is usually well
+// predicted.
+//
+//===----------------------------------------------------------------------===//
+
+#if USE_METADATA
+
+#define DEBUG_TYPE "dspecdevirt"
+
+#include "gen/metadata.h"
+
+#include "Passes.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumGuardedCalls, "Number of virtual calls turned into guarded direct calls");
+
+namespace {
+    /// This pass adds direct calls to the implementations known for virtual
+    /// calls, guarded by a comparison with the function pointer from the vtbl.
+    ///
+    class LLVM_LIBRARY_VISIBILITY SpeculativeDevirtualization : public FunctionPass {
+        unsigned DevirtKind;
+
+        void guardCall(CallSite CS, LoadInst* Load, Function* Target);
+
+    public:
+        static char ID; // Pass identification
+        SpeculativeDevirtualization() : FunctionPass(ID) {}
+
+        bool doInitialization(Module &M) {
+            DevirtKind = M.getContext().getMDKindID(DEVIRT_MD_KIND);
+            return false;
+        }
+
+        bool runOnFunction(Function &F);
+    };
+    char SpeculativeDevirtualization::ID = 0;
+} // end anonymous namespace.
+
+static RegisterPass<SpeculativeDevirtualization>
+X("dspecdevirt", "Guarded direct calls of single implementation virtual functions");
+
+// Public interface to the pass.
+FunctionPass *createSpeculativeDevirtualization() {
+  return new SpeculativeDevirtualization();
+}
+
+/// guardCall - Replaces the call CS through the function pointer loaded by
+/// Load with a branch on whether it points to Target, calling Target directly
+/// if so and through the pointer otherwise.
+void SpeculativeDevirtualization::guardCall(CallSite CS, LoadInst* Load, Function* Target) {
+    Instruction* Call = CS.getInstruction();
+    LLVMContext& Context = Call->getContext();
+    Function* F = Call->getParent()->getParent();
+
+    // Split off the call; Head falls through to Tail afterwards.
+    BasicBlock* Head = Call->getParent();
+    BasicBlock* Tail;
+    if (InvokeInst* Invoke = dyn_cast<InvokeInst>(Call)) {
+        // Give both invokes a common normal destination for the result phi.
+        BasicBlock* Normal = Invoke->getNormalDest();
+        Tail = BasicBlock::Create(Context, "devirt.cont", F, Normal);
+        BranchInst::Create(Normal, Tail);
+        for (BasicBlock::iterator I = Normal->begin(); isa<PHINode>(I); ++I) {
+            PHINode* PN = cast<PHINode>(I);
+            PN->setIncomingBlock(PN->getBasicBlockIndex(Head), Tail);
+        }
+        Invoke->setNormalDest(Tail);
+    } else {
+        Tail = Head->splitBasicBlock(Call, "devirt.cont");
+        Head->getTerminator()->eraseFromParent();
+    }
+
+    BasicBlock* DirectBB = BasicBlock::Create(Context, "devirt.direct", F, Tail);
+    BasicBlock* IndirectBB = BasicBlock::Create(Context, "devirt.indirect", F, Tail);
+
+    // The call through the vtbl becomes the fallback.
+    Instruction* DirectCall = Call->clone();
+    Call->removeFromParent();
+    IndirectBB->getInstList().push_back(Call);
+    DirectBB->getInstList().push_back(DirectCall);
+    CallSite(DirectCall).setCalledFunction(
+        ConstantExpr::getBitCast(Target, CS.getCalledValue()->getType()));
+    if (!Call->getType()->isVoidTy())
+        DirectCall->setName(Call->getName() + ".direct");
+    if (isa<CallInst>(Call)) {
+        BranchInst::Create(Tail, DirectBB);
+        BranchInst::Create(Tail, IndirectBB);
+    } else {
+        // Landing pads may have phis too.
+        BasicBlock* Unwind = cast<InvokeInst>(Call)->getUnwindDest();
+        for (BasicBlock::iterator I = Unwind->begin(); isa<PHINode>(I); ++I) {
+            PHINode* PN = cast<PHINode>(I);
+            int Idx = PN->getBasicBlockIndex(Head);
+            PN->setIncomingBlock(Idx, IndirectBB);
+            PN->addIncoming(PN->getIncomingValue(Idx), DirectBB);
+        }
+    }
+
+    IRBuilder<> Builder(Head);
+    Value* IsTarget = Builder.CreateICmpEQ(Load,
+        ConstantExpr::getBitCast(Target, Load->getType()), "devirt.cmp");
+    Builder.CreateCondBr(IsTarget, DirectBB, IndirectBB);
+
+    if (!Call->getType()->isVoidTy() && !Call->use_empty()) {
+        PHINode* PN = PHINode::Create(Call->getType(), 2, "", Tail->begin());
+        Call->replaceAllUsesWith(PN);
+        PN->addIncoming(DirectCall, DirectBB);
+        PN->addIncoming(Call, IndirectBB);
+        PN->takeName(Call);
+    }
+}
+
+/// runOnFunction - Top level algorithm.
+///
+bool SpeculativeDevirtualization::runOnFunction(Function &F) {
+    DEBUG(errs() << "\nRunning -dspecdevirt on function " << F.getName() << '\n');
+
+    // Collect the calls first, guarding them splits the blocks.
+    SmallVector<std::pair<CallSite, LoadInst*>, 16> Calls;
+    for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+        for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+            CallSite CS(I);
+            if (!CS.getInstruction())
+                continue;
+            LoadInst* Load = dyn_cast<LoadInst>(CS.getCalledValue()->stripPointerCasts());
+            if (Load && Load->getMetadata(DevirtKind))
+                Calls.push_back(std::make_pair(CS, Load));
+        }
+    }
+
+    bool Changed = false;
+    for (unsigned i = 0, e = Calls.size(); i != e; ++i) {
+        CallSite CS = Calls[i].first;
+        LoadInst* Load = Calls[i].second;
+        // The operand is nulled out if the function has been deleted.
+        Value* Impl = Load->getMetadata(DevirtKind)->getOperand(0);
+        Function* Target = Impl ? dyn_cast<Function>(Impl->stripPointerCasts()) : 0;
+        if (!Target)
+            continue;
+
+        DEBUG(errs() << "Guarding call to " << Target->getName() << ": "
+                     << *CS.getInstruction() << '\n');
+
+        guardCall(CS, Load, Target);
+
+        ++NumGuardedCalls;
+        Changed = true;
+    }
+
+    return Changed;
+}
+
+#endif // USE_METADATA
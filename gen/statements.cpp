@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <math.h>
 #include <fstream>
+#include <map>
+#include <set>
 
 #include "gen/llvm.h"
 #include "llvm/InlineAsm.h"
@@ -31,6 +33,59 @@
 
 //////////////////////////////////////////////////////////////////////////////
 
+#if DMDV2
+
+// Whether the append operand e can be evaluated before the preceding appends
+// to v in the same chain without changing the result.
+static bool isInvariantAppendOperand(Expression* e, VarDeclaration* v)
+{
+    switch (e->op)
+    {
+    case TOKstring:
+    case TOKint64:
+    case TOKfloat64:
+    case TOKnull:
+        return true;
+    case TOKvar: {
+        // ref variables might refer to v
+        VarDeclaration* vd = ((VarExp*)e)->var->isVarDeclaration();
+        return vd && vd != v && !(vd->storage_class & (STCref | STCout | STClazy));
+    }
+    default:
+        return false;
+    }
+}
+
+// If s is a 'v ~= ...' statement for a dynamic array variable v that can be
+// part of an append chain, adds the appended operands to ops and returns v.
+static VarDeclaration* isChainableAppend(Statement* s, std::vector<Expression*>& ops)
+{
+    ExpStatement* es = s ? s->isExpStatement() : NULL;
+    if (!es || !es->exp || es->exp->op != TOKcatass)
+        return NULL;
+
+    CatAssignExp* ce = (CatAssignExp*)es->exp;
+    if (ce->e1->op != TOKvar || ce->e1->type->toBasetype()->ty != Tarray)
+        return NULL;
+    VarDeclaration* v = ((VarExp*)ce->e1)->var->isVarDeclaration();
+    if (!v || (v->storage_class & (STCref | STCout | STClazy)))
+        return NULL;
+
+    std::vector<Expression*> mine;
+    if (!collectCatOperands(ce->e1->type, ce->e2, mine))
+        return NULL;
+    for (size_t i = 0; i < mine.size(); i++)
+    {
+        if (!isInvariantAppendOperand(mine[i], v))
+            return NULL;
+    }
+
+    ops.insert(ops.end(), mine.begin(), mine.end());
+    return v;
+}
+
+#endif
+
 void CompoundStatement::toIR(IRState* p)
 {
     Logger::println("CompoundStatement::toIR(): %s", loc.toChars());
@@ -39,6 +94,30 @@ void CompoundStatement::toIR(IRState* p)
     for (unsigned i=0; i<statements->dim; i++)
     {
         Statement* s = (Statement*)statements->data[i];
+#if DMDV2
+        // Fuse runs of 's ~= a; s ~= b; ...' into a single append, growing
+        // the array only once.
+        std::vector<Expression*> ops;
+        VarDeclaration* v = isChainableAppend(s, ops);
+        unsigned n = 1;
+        while (v && i + n < statements->dim)
+        {
+            std::vector<Expression*> next;
+            if (isChainableAppend((Statement*)statements->data[i + n], next) != v)
+                break;
+            ops.insert(ops.end(), next.begin(), next.end());
+            n++;
+        }
+        if (n > 1)
+        {
+            Logger::println("fusing %u appends to %s", n, v->toChars());
+            DtoDwarfStopPoint(s->loc.linnum);
+            CatAssignExp* ce = (CatAssignExp*)((ExpStatement*)s)->exp;
+            DtoCatAssignArrays(ce->loc, ce->e1->toElem(p), ops);
+            i += n - 1;
+            continue;
+        }
+#endif
         if (s) {
             s->toIR(p);
         }
@@ -858,6 +937,131 @@ static LLValue* call_string_switch_runtime(llvm::Value* table, Expression* e)
     return call.getInstruction();
 }
 
+// String switches with more cases than this still call into the runtime, to
+// keep the code size in check.
+static const unsigned maxInlineStringSwitch = 1024;
+
+// Emits the inline replacement for _d_switch_string and friends: a switch on
+// the length of the string, followed by a decision tree on the characters
+// that tell the remaining cases apart, and finally a memcmp against the only
+// candidate left. Like the runtime functions, it yields the index into the
+// sorted case array, or -1 if there is no match.
+struct StringSwitchEmitter
+{
+    Array& caseArray;
+    LLValue* ptr;
+    size_t charSize;
+    llvm::BasicBlock* insertBefore;
+    llvm::BasicBlock* nomatchbb;
+    llvm::BasicBlock* endbb;
+    llvm::PHINode* result;
+
+    StringSwitchEmitter(Array& caseArray, llvm::BasicBlock* insertBefore)
+        : caseArray(caseArray), insertBefore(insertBefore) {}
+
+    StringExp* str(size_t i) {
+        return ((Case*)caseArray.data[i])->str;
+    }
+
+    llvm::BasicBlock* newBlock(const char* name) {
+        return llvm::BasicBlock::Create(gIR->context(), name, gIR->topfunc(), insertBefore);
+    }
+
+    LLValue* emit(Expression* e);
+    void emitTree(const std::vector<size_t>& cands, size_t len);
+};
+
+LLValue* StringSwitchEmitter::emit(Expression* e)
+{
+    DValue* val = e->toElemDtor(gIR);
+    LLValue* len = DtoArrayLen(val);
+    ptr = DtoArrayPtr(val);
+    charSize = e->type->toBasetype()->nextOf()->toBasetype()->size();
+
+    nomatchbb = newBlock("stringswitchnomatch");
+    endbb = newBlock("stringswitchend");
+    LLType* resultTy = LLType::getInt32Ty(gIR->context());
+    result = llvm::PHINode::Create(resultTy, caseArray.dim + 1, "stringswitchidx", endbb);
+    llvm::BranchInst::Create(endbb, nomatchbb);
+    result->addIncoming(LLConstantInt::get(resultTy, -1, true), nomatchbb);
+
+    // the case array is sorted by length first
+    llvm::SwitchInst* si = llvm::SwitchInst::Create(len, nomatchbb, caseArray.dim, gIR->scopebb());
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    for (size_t i = 0; i < caseArray.dim; )
+    {
+        size_t n = str(i)->len;
+        std::vector<size_t> cands;
+        for (; i < caseArray.dim && str(i)->len == n; ++i)
+            cands.push_back(i);
+
+        llvm::BasicBlock* bb = newBlock("stringswitchlen");
+        si->addCase(DtoConstSize_t(n), bb);
+        gIR->scope() = IRScope(bb, oldend);
+        emitTree(cands, n);
+    }
+
+    gIR->scope() = IRScope(endbb, oldend);
+    return result;
+}
+
+void StringSwitchEmitter::emitTree(const std::vector<size_t>& cands, size_t len)
+{
+    llvm::BasicBlock* oldend = gIR->scopeend();
+
+    if (cands.size() == 1)
+    {
+        size_t i = cands[0];
+        if (len == 0)
+        {
+            result->addIncoming(DtoConstUint(i), gIR->scopebb());
+            llvm::BranchInst::Create(endbb, gIR->scopebb());
+            return;
+        }
+        LLConstant* caseVal = str(i)->toConstElem(gIR);
+        unsigned ptrIdx = 1;
+        LLValue* casePtr = llvm::ConstantExpr::getExtractValue(caseVal, ptrIdx);
+        LLValue* cmp = DtoMemCmp(ptr, casePtr, DtoConstSize_t(len * charSize));
+        cmp = gIR->ir->CreateICmpEQ(cmp, LLConstantInt::get(cmp->getType(), 0), "tmp");
+        result->addIncoming(DtoConstUint(i), gIR->scopebb());
+        llvm::BranchInst::Create(endbb, nomatchbb, cmp, gIR->scopebb());
+        return;
+    }
+
+    // Branch on the character which splits the candidates into the most
+    // groups. As all candidates are distinct strings of the same length,
+    // there is at least one position with two different characters.
+    size_t pos = 0;
+    size_t ngroups = 0;
+    for (size_t j = 0; j < len; ++j)
+    {
+        std::set<unsigned> chars;
+        for (size_t k = 0; k < cands.size(); ++k)
+            chars.insert(str(cands[k])->charAt(j));
+        if (chars.size() > ngroups)
+        {
+            pos = j;
+            ngroups = chars.size();
+        }
+    }
+    assert(ngroups > 1);
+
+    std::map<unsigned, std::vector<size_t> > groups;
+    for (size_t k = 0; k < cands.size(); ++k)
+        groups[str(cands[k])->charAt(pos)].push_back(cands[k]);
+
+    LLValue* c = DtoLoad(DtoGEPi1(ptr, pos), "stringswitchchar");
+    llvm::IntegerType* charTy = llvm::cast<llvm::IntegerType>(c->getType());
+    llvm::SwitchInst* si = llvm::SwitchInst::Create(c, nomatchbb, groups.size(), gIR->scopebb());
+    for (std::map<unsigned, std::vector<size_t> >::iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+        llvm::BasicBlock* bb = newBlock("stringswitchchar");
+        si->addCase(LLConstantInt::get(charTy, it->first), bb);
+        gIR->scope() = IRScope(bb, oldend);
+        emitTree(it->second, len);
+    }
+}
+
 void SwitchStatement::toIR(IRState* p)
 {
     Logger::println("SwitchStatement::toIR(): %s", loc.toChars());
@@ -938,14 +1142,19 @@ void SwitchStatement::toIR(IRState* p)
             // first sort it
             caseArray.sort();
             // iterate and add indices to cases
-            std::vector<LLConstant*> inits(caseArray.dim);
             for (size_t i=0; i<caseArray.dim; ++i)
             {
                 Case* c = (Case*)caseArray.data[i];
                 CaseStatement* cs = (CaseStatement*)cases->data[c->index];
                 cs->llvmIdx = DtoConstUint(i);
-                inits[i] = c->str->toConstElem(p);
             }
+        }
+        // only huge switches use the runtime binary search
+        if (caseArray.dim > maxInlineStringSwitch)
+        {
+            std::vector<LLConstant*> inits(caseArray.dim);
+            for (size_t i=0; i<caseArray.dim; ++i)
+                inits[i] = ((Case*)caseArray.data[i])->str->toConstElem(p);
             // build static array for ptr or final array
             LLType* elemTy = DtoType(condition->type);
             LLArrayType* arrTy = llvm::ArrayType::get(elemTy, inits.size());
@@ -974,9 +1183,12 @@ void SwitchStatement::toIR(IRState* p)
             condVal = cond->getRVal();
         }
         // string switch
-        else {
+        else if (switchTable) {
             condVal = call_string_switch_runtime(switchTable, condition);
         }
+        else {
+            condVal = StringSwitchEmitter(caseArray, bodybb).emit(condition);
+        }
 
         // create switch and add the cases
         llvm::SwitchInst* si = llvm::SwitchInst::Create(condVal, defbb ? defbb : endbb, cases->dim, p->scopebb());
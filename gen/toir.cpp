@@ -2592,6 +2592,15 @@ DValue* CatAssignExp::toElem(IRState* p)
     Type* elemtype = e1type->nextOf()->toBasetype();
     Type* e2type = e2->type->toBasetype();
 
+#if DMDV2
+    // append all operands of s ~= x ~ y directly, without a temporary
+    std::vector<Expression*> ops;
+    if (e2->op == TOKcat && collectCatOperands(e1type, e2, ops)) {
+        DtoCatAssignArrays(loc, l, ops);
+        return l;
+    }
+#endif
+
     if (e2type == elemtype) {
         DtoCatAssignElement(loc, e1type, l, e2);
     }
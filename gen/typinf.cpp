@@ -340,10 +340,22 @@ void DtoResolveTypeInfo(TypeInfoDeclaration* tid)
             if (TD_Confirm >= 0)
                 mdVals[TD_Confirm] = llvm::cast<MDNodeField>(irg->value);
             mdVals[TD_Type] = llvm::UndefValue::get(DtoType(tid->tinfo));
+            // The element initializer lets the optimizer initialize arrays
+            // it moves to the stack.
+            mdVals[TD_ElemInit] = NULL;
+            // Only the checks look through enums and typedefs, their
+            // initializer may differ from the one of the base type.
+            Type* elemType = tid->tinfo;
+            if (elemType->toBasetype()->ty == Tarray) {
+                while (elemType->toBasetype()->ty == Tarray)
+                    elemType = elemType->toBasetype()->nextOf();
+                if (elemType->toBasetype()->isscalar())
+                    mdVals[TD_ElemInit] = DtoConstExpInit(tid->loc, elemType, elemType->defaultInit(tid->loc));
+            }
             // Construct the metadata
-            llvm::MetadataBase* metadata = llvm::MDNode::get(gIR->context(), mdVals, TD_NumFields);
+            llvm::MDNode* metadata = llvm::MDNode::get(gIR->context(), mdVals);
             // Insert it into the module
-            llvm::NamedMDNode::Create(gIR->context(), metaname, &metadata, 1, gIR->module);
+            gIR->module->getOrInsertNamedMetadata(metaname)->addOperand(metadata);
         }
     }
 #endif // USE_METADATA
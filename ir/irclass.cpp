@@ -23,6 +23,7 @@ extern LLConstant* get_default_initializer(VarDeclaration* vd, Initializer* init
 extern size_t add_zeros(std::vector<llvm::Constant*>& constants, size_t diff);
 
 extern LLConstant* DtoDefineClassInfo(ClassDeclaration* cd);
+extern LLConstant* DtoDefineClassDisplay(ClassDeclaration* cd);
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -88,10 +89,10 @@ LLGlobalVariable * IrStruct::getClassInfoSymbol()
         mdVals[CD_Finalize] = LLConstantInt::get(LLType::getInt1Ty(gIR->context()), hasDestructor);
         mdVals[CD_CustomDelete] = LLConstantInt::get(LLType::getInt1Ty(gIR->context()), hasCustomDelete);
         // Construct the metadata
-        llvm::MetadataBase* metadata = llvm::MDNode::get(gIR->context(), mdVals, CD_NumFields);
+        llvm::MDNode* metadata = llvm::MDNode::get(gIR->context(), mdVals);
         // Insert it into the module
         std::string metaname = CD_PREFIX + initname;
-        llvm::NamedMDNode::Create(gIR->context(), metaname, &metadata, 1, gIR->module);
+        gIR->module->getOrInsertNamedMetadata(metaname)->addOperand(metadata);
     }
 #endif // USE_METADATA
 
@@ -201,6 +202,10 @@ LLConstant * IrStruct::getVtblInit()
         constants.push_back(c);
     }
 
+    // the ancestor display goes behind the virtual functions
+    if (global.params.useClassDisplay)
+        constants.push_back(DtoDefineClassDisplay(cd));
+
     // build the constant struct
     LLType* vtblTy = stripModifiers(type)->irtype->isClass()->getVtbl();
     constVtbl = LLConstantStruct::get(isaStruct(vtblTy), constants);
@@ -265,7 +265,19 @@ llvm::Type* IrTypeClass::buildType()
     // VTBL
 
     // set vtbl type body
-    vtbl_type->setBody(buildVtblType(ClassDeclaration::classinfo->type, &cd->vtbl));
+    std::vector<llvm::Type*> vtbl_types = buildVtblType(ClassDeclaration::classinfo->type, &cd->vtbl);
+
+    // classes get their ancestor display appended, see DtoDefineClassDisplay
+    if (global.params.useClassDisplay && !cd->isInterfaceDeclaration())
+    {
+        unsigned depth = 0;
+        for (ClassDeclaration* base = cd->baseClass; base; base = base->baseClass)
+            depth++;
+        vtbl_types.push_back(llvm::StructType::get(DtoSize_t(),
+            llvm::ArrayType::get(getVoidPtrType(), depth + 1), NULL));
+    }
+
+    vtbl_type->setBody(vtbl_types);
 
     IF_LOG Logger::cout() << "class type: " << *type << std::endl;
 
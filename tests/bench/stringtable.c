@@ -0,0 +1,125 @@
+
+/* Micro-benchmark for dmd2/root/stringtable.c
+ *
+ * Replays the two heaviest users of StringTable: Lexer::idPool interning
+ * identifiers, and Type::merge interning decos (long strings sharing
+ * prefixes). Build it against the root sources of the tree to measure:
+ *
+ *   g++ -O2 -DPOSIX=1 -I../../dmd2/root stringtable.c \
+ *       ../../dmd2/root/stringtable.c ../../dmd2/root/rmem.c \
+ *       ../../dmd2/root/dchar.c ../../dmd2/root/lstring.c -o stbench
+ *   ./stbench [N]
+ *
+ * N defaults to 100000.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "root.h"
+#include "rmem.h"
+#include "stringtable.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Identifiers as the lexer sees them: short, mostly distinct, with
+ * common prefixes and suffixes.
+ */
+static char *makeIdent(unsigned i)
+{
+    static const char *prefix[] = { "", "_", "m", "get", "set", "is", "opt" };
+    char buf[64];
+    sprintf(buf, "%s%c%u%s", prefix[i % 7], 'a' + (i / 7) % 26, i,
+        (i & 1) ? "Value" : "");
+    return strdup(buf);
+}
+
+/* Decos of function types in nested templates: long strings that differ
+ * only far from the start.
+ */
+static char *makeDeco(unsigned i)
+{
+    char buf[256];
+    sprintf(buf, "FS3std9algorithm%u__T3mapS%uZ3MapZS3std5range%u__T4TakeTAyaZ4Take",
+        i % 97, i, i / 97);
+    return strdup(buf);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned n = argc > 1 ? atoi(argv[1]) : 100000;
+
+    char **idents = (char **)malloc(n * sizeof(char *));
+    char **decos = (char **)malloc(n * sizeof(char *));
+    for (unsigned i = 0; i < n; i++)
+    {
+        idents[i] = makeIdent(i);
+        decos[i] = makeDeco(i);
+    }
+
+    // Lexer::idPool: every identifier is seen several times
+    double t0 = now();
+    StringTable idtable;
+    idtable.init();
+    unsigned created = 0;
+    for (int pass = 0; pass < 4; pass++)
+    {
+        for (unsigned i = 0; i < n; i++)
+        {
+            StringValue *sv = idtable.update(idents[i], strlen(idents[i]));
+            if (!sv->ptrvalue)
+            {   sv->ptrvalue = idents[i];
+                created++;
+            }
+        }
+    }
+    for (unsigned i = 0; i < n; i++)
+    {
+        StringValue *sv = idtable.lookup(idents[i], strlen(idents[i]));
+        if (!sv || sv->ptrvalue != idents[i])
+        {   printf("idPool lookup failed for %s\n", idents[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    double t1 = now();
+
+    // Type::merge: each deco is merged twice
+    StringTable decotable;
+    decotable.init();
+    unsigned merged = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (unsigned i = 0; i < n; i++)
+        {
+            StringValue *sv = decotable.update(decos[i], strlen(decos[i]));
+            if (!sv->ptrvalue)
+                sv->ptrvalue = decos[i];
+            else
+                merged++;
+        }
+    }
+    for (unsigned i = 0; i < n; i++)
+    {
+        StringValue *sv = decotable.lookup(decos[i], strlen(decos[i]));
+        if (!sv || sv->ptrvalue != decos[i])
+        {   printf("deco lookup failed for %s\n", decos[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    double t2 = now();
+
+    if (created != n || merged != n)
+    {   printf("wrong number of entries: %u created, %u merged\n", created, merged);
+        return EXIT_FAILURE;
+    }
+
+    printf("N = %u: idPool %.3fs, deco merge %.3fs\n", n, t1 - t0, t2 - t1);
+    return EXIT_SUCCESS;
+}